@@ -0,0 +1,109 @@
+//Standalone benchmark of the batched frustum culling against the scalar path, it doesnt need a window or a GL context.
+//Build from the root of the repo (add -mavx or -mavx512f to test 8 or 16 boxes per iteration):
+//	g++ -O2 -msse2 -Isrc benchmarks/frustum_benchmark.cpp src/frustumcull.cpp -o frustum_benchmark
+//(with Visual Studio just add both files to an empty console project)
+
+#include "frustumcull.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+
+using namespace GTR;
+
+//same as Camera::testBoxInFrustum + planeBoxOverlap, one box (AoS) at a time
+static char testBoxInFrustum(const float frustum[6][4], const Vector3& center, const Vector3& halfsize)
+{
+	int o = 0;
+	for (int p = 0; p < 6; ++p)
+	{
+		const float* plane = frustum[p];
+		float radius = fabs(halfsize.x * plane[0]) + fabs(halfsize.y * plane[1]) + fabs(halfsize.z * plane[2]);
+		float distance = plane[0] * center.x + plane[1] * center.y + plane[2] * center.z + plane[3];
+		if (distance <= -radius)
+			return CLIP_OUTSIDE;
+		o += distance <= radius ? CLIP_OVERLAP : CLIP_INSIDE;
+	}
+	return o == 0 ? CLIP_INSIDE : CLIP_OVERLAP;
+}
+
+static double elapsedNs(std::chrono::high_resolution_clock::time_point start)
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+static float randomRange(float min, float max)
+{
+	return min + (max - min) * (rand() / (float)RAND_MAX);
+}
+
+int main()
+{
+	//camera in the origin looking to -Z (fov 60, aspect 16:9, near 0.1, far 1000), planes pointing inside
+	float half_v = 30.0f * 3.14159265f / 180.0f;
+	float half_h = std::atan(std::tan(half_v) * 16.0f / 9.0f);
+	float frustum[6][4] = {
+		{ std::cos(half_h), 0, -std::sin(half_h), 0 },
+		{ -std::cos(half_h), 0, -std::sin(half_h), 0 },
+		{ 0, std::cos(half_v), -std::sin(half_v), 0 },
+		{ 0, -std::cos(half_v), -std::sin(half_v), 0 },
+		{ 0, 0, -1, -0.1f },
+		{ 0, 0, 1, 1000.0f } };
+
+	printf("batch width: %d boxes\n", FRUSTUMCULL_WIDTH);
+	printf("%8s %14s %14s %14s %9s\n", "boxes", "AoS scalar", "SoA scalar", "SoA SIMD", "visible");
+
+	const int sizes[3] = { 1000, 10000, 100000 };
+	for (int s = 0; s < 3; ++s)
+	{
+		int count = sizes[s];
+		int iterations = 10000000 / count;
+
+		//boxes all around the camera, roughly a sixth of them are visible
+		std::vector<BoundingBox> boxes(count);
+		sBoxesSoA soa;
+		soa.resize(count);
+		for (int i = 0; i < count; ++i)
+		{
+			boxes[i] = BoundingBox(Vector3(randomRange(-1000, 1000), randomRange(-200, 200), randomRange(-1000, 1000)),
+				Vector3(randomRange(1, 20), randomRange(1, 20), randomRange(1, 20)));
+			soa.set(i, boxes[i].center, boxes[i].halfsize);
+		}
+		std::vector<uint32_t> mask_aos((count + 31) / 32), mask_scalar((count + 31) / 32), mask_simd((count + 31) / 32);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		int visible_aos = 0;
+		for (int it = 0; it < iterations; ++it)
+		{
+			visible_aos = 0;
+			std::fill(mask_aos.begin(), mask_aos.end(), 0);
+			for (int i = 0; i < count; ++i)
+				if (testBoxInFrustum(frustum, boxes[i].center, boxes[i].halfsize) != CLIP_OUTSIDE)
+				{
+					mask_aos[i >> 5] |= 1u << (i & 31);
+					visible_aos++;
+				}
+		}
+		double time_aos = elapsedNs(start) / iterations;
+
+		start = std::chrono::high_resolution_clock::now();
+		int visible_scalar = 0;
+		for (int it = 0; it < iterations; ++it)
+			visible_scalar = cullBoxesScalar(frustum, soa, 0, count, &mask_scalar[0]);
+		double time_scalar = elapsedNs(start) / iterations;
+
+		start = std::chrono::high_resolution_clock::now();
+		int visible_simd = 0;
+		for (int it = 0; it < iterations; ++it)
+			visible_simd = cullBoxesSIMD(frustum, soa, 0, count, &mask_simd[0]);
+		double time_simd = elapsedNs(start) / iterations;
+
+		printf("%8d %11.1f us %11.1f us %11.1f us %9d\n", count, time_aos / 1000.0, time_scalar / 1000.0, time_simd / 1000.0, visible_simd);
+		if (mask_aos != mask_scalar || mask_aos != mask_simd || visible_aos != visible_simd || visible_scalar != visible_simd)
+		{
+			printf("results dont match!\n");
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,132 @@
+//Standalone benchmark of the software occlusion culler, it doesnt need a window or a GL context.
+//Build from the root of the repo:
+//	g++ -O2 -msse2 -pthread -Isrc benchmarks/occlusion_benchmark.cpp src/occlusion.cpp -o occlusion_benchmark
+//(with Visual Studio just add both files to an empty console project)
+
+#include "occlusion.h"
+
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <thread>
+
+using namespace GTR;
+
+//the rest of Matrix44 lives in framework.cpp, which needs GL
+Matrix44::Matrix44()
+{
+	memset(m, 0, sizeof(m));
+	m[0] = m[5] = m[10] = m[15] = 1.0f;
+}
+
+static Matrix44 perspective(float fov, float aspect, float near_plane, float far_plane)
+{
+	Matrix44 p;
+	float f = 1.0f / tan(fov * 3.14159265f / 180.0f * 0.5f);
+	p.m[0] = f / aspect;
+	p.m[5] = f;
+	p.m[10] = (far_plane + near_plane) / (near_plane - far_plane);
+	p.m[11] = -1.0f;
+	p.m[14] = 2.0f * (far_plane * near_plane) / (near_plane - far_plane);
+	p.m[15] = 0.0f;
+	return p;
+}
+
+static Matrix44 translation(float x, float y, float z)
+{
+	Matrix44 t;
+	t.m[12] = x; t.m[13] = y; t.m[14] = z;
+	return t;
+}
+
+//grid of quads in the XY plane of size 1x1 centered in the origin
+struct sGridMesh {
+	std::vector<float> positions;
+	std::vector<unsigned int> indices;
+
+	sGridMesh(int cells)
+	{
+		for (int y = 0; y <= cells; ++y)
+			for (int x = 0; x <= cells; ++x)
+			{
+				positions.push_back(x / (float)cells - 0.5f);
+				positions.push_back(y / (float)cells - 0.5f);
+				positions.push_back(0.0f);
+			}
+		for (int y = 0; y < cells; ++y)
+			for (int x = 0; x < cells; ++x)
+			{
+				unsigned int i = y * (cells + 1) + x;
+				unsigned int quad[6] = { i, i + 1, i + cells + 2, i, i + cells + 2, i + cells + 1 };
+				indices.insert(indices.end(), quad, quad + 6);
+			}
+	}
+};
+
+static double elapsedMs(std::chrono::high_resolution_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+int main()
+{
+	const int iterations = 50;
+
+	//camera in the origin looking to -Z, so the view is the identity
+	Matrix44 viewprojection = perspective(60.0f, 2.0f, 0.1f, 1000.0f);
+
+	//a wall that covers the center of the view, and many small walls to stress the rasterizer
+	sGridMesh wall(1);
+	sGridMesh tessellated(16);
+	std::vector<Matrix44> models;
+	Matrix44 wall_model = translation(0, 0, -30);
+	wall_model.m[0] = 60.0f; wall_model.m[5] = 20.0f;
+	for (int i = 0; i < 64; ++i)
+	{
+		Matrix44 model = translation((i % 8 - 3.5f) * 6.0f, (i / 8 - 3.5f) * 3.0f, -20.0f - (i % 5));
+		model.m[0] = 4.0f; model.m[5] = 2.0f;
+		models.push_back(model);
+	}
+
+	//boxes on a grid, half of them in front of the wall and half behind
+	std::vector<BoundingBox> boxes;
+	for (int z = 0; z < 40; ++z)
+		for (int x = 0; x < 50; ++x)
+			for (int y = 0; y < 5; ++y)
+				boxes.push_back(BoundingBox(Vector3((x - 25) * 1.2f, (y - 2) * 1.5f, -5.0f - z * 1.5f), Vector3(0.4f, 0.4f, 0.4f)));
+
+	printf("occlusion buffer %dx%d, %d boxes, %d hardware threads\n", OCCLUSION_WIDTH, OCCLUSION_HEIGHT, (int)boxes.size(), (int)std::thread::hardware_concurrency());
+
+	OcclusionCuller culler;
+	culler.setViewProjection(viewprojection);
+	for (int threads = 1; threads <= OCCLUSION_MAX_THREADS; threads *= 2)
+	{
+		culler.num_threads = threads;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < iterations; ++i)
+		{
+			culler.addOccluder(wall_model, &wall.positions[0], sizeof(float) * 3, (int)wall.positions.size() / 3, &wall.indices[0], (int)wall.indices.size());
+			for (size_t j = 0; j < models.size(); ++j)
+				culler.addOccluder(models[j], &tessellated.positions[0], sizeof(float) * 3, (int)tessellated.positions.size() / 3, &tessellated.indices[0], (int)tessellated.indices.size());
+			culler.render();
+		}
+		printf("render %d threads: %.3f ms (%d triangles)\n", threads, elapsedMs(start) / iterations, culler.num_triangles);
+	}
+
+	int visible = 0;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < iterations; ++i)
+	{
+		culler.num_tested = culler.num_culled = 0;
+		visible = 0;
+		for (size_t j = 0; j < boxes.size(); ++j)
+			visible += culler.isVisible(boxes[j]) ? 1 : 0;
+	}
+	double test_time = elapsedMs(start) / iterations;
+	printf("test %d boxes: %.3f ms (%.1f ns per box), %d visible, %d culled\n", culler.num_tested, test_time, test_time * 1e6 / culler.num_tested, visible, culler.num_culled);
+
+	//sanity check: a box right in front of the camera is visible and one far behind the center of the wall is not
+	bool ok = culler.isVisible(BoundingBox(Vector3(0, 0, -10), Vector3(1, 1, 1))) && !culler.isVisible(BoundingBox(Vector3(0, 0, -50), Vector3(1, 1, 1)));
+	printf("sanity check: %s\n", ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
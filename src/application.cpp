@@ -10,10 +10,12 @@
 #include "prefab.h"
 #include "gltf_loader.h"
 #include "renderer.h"
+#include "bvh.h"
 
 #include "scene.h"
 #include "entity.h"
 #include "sphericalharmonics.h"
+#include "profiler.h"
 
 #include <cmath>
 #include <string>
@@ -50,6 +52,9 @@ Application::Application(int window_width, int window_height, SDL_Window* window
 	time = 0.0f;
 	elapsed_time = 0.0f;
 	mouse_locked = false;
+	pick_pending = false;
+	camera_path = false;
+	camera_path_frame = 0;
 
 	//loads and compiles several shaders from one single file
     //change to "data/shader_atlas_osx.txt" if you are in XCODE
@@ -91,6 +96,14 @@ void Application::render(void)
 	//be sure no errors present in opengl before start
 	checkGLErrors();
 
+	//counters are accumulated during the frame
+	GTR::Profiler::resetCounters();
+	Shader::s_gl_calls_issued = 0;
+	Shader::s_gl_calls_skipped = 0;
+	PrefabEntity::s_matrix_products = 0;
+	PrefabEntity::s_matrix_products_saved = 0;
+	Shader::resetStateCache();	//the gui binds its own textures
+
 	//set the clear color (the background color)
 	glClearColor(bg_color.x, bg_color.y, bg_color.z, bg_color.w);
 	glClearColor(1.0, 1.0, 1.0, 1.0);
@@ -116,6 +129,11 @@ void Application::render(void)
 		drawGrid();
 
 
+	GTR::Profiler::setCounter("shader gl calls issued", Shader::s_gl_calls_issued);
+	GTR::Profiler::setCounter("shader gl calls skipped", Shader::s_gl_calls_skipped);
+	GTR::Profiler::setCounter("world matrix products", PrefabEntity::s_matrix_products);
+	GTR::Profiler::setCounter("world matrix products saved", PrefabEntity::s_matrix_products_saved);
+
 	//render anything in the gui after this
 
 	//the swap buffers is done in the main loop after this function
@@ -163,6 +181,14 @@ void Application::update(double seconds_elapsed)
 	if (Input::isKeyPressed(SDL_SCANCODE_Q)) camera->moveGlobal(Vector3(0.0f, -1.0f, 0.0f) * speed);
 	if (Input::isKeyPressed(SDL_SCANCODE_E)) camera->moveGlobal(Vector3(0.0f, 1.0f, 0.0f) * speed);
 
+	//fixed step instead of the elapsed time, every run renders the same frames
+	if (camera_path)
+	{
+		Matrix44 rotation;
+		rotation.setRotation(++camera_path_frame * 0.005f, Vector3(0, 1, 0));
+		camera->lookAt(camera_path_center + rotation.rotateVector(camera_path_offset), camera_path_center, Vector3(0, 1, 0));
+	}
+
 	//to navigate with the mouse fixed in the middle
 	SDL_ShowCursor(!mouse_locked);
 	#ifndef SKIP_IMGUI
@@ -203,10 +229,14 @@ void Application::renderDebugGizmo()
 		mCurrentGizmoOperation = ImGuizmo::SCALE;
 	float matrixTranslation[3], matrixRotation[3], matrixScale[3];
 	ImGuizmo::DecomposeMatrixToComponents(matrix.m, matrixTranslation, matrixRotation, matrixScale);
-	ImGui::InputFloat3("Tr", matrixTranslation, 3);
-	ImGui::InputFloat3("Rt", matrixRotation, 3);
-	ImGui::InputFloat3("Sc", matrixScale, 3);
-	ImGuizmo::RecomposeMatrixFromComponents(matrixTranslation, matrixRotation, matrixScale, matrix.m);
+	bool changed = ImGui::InputFloat3("Tr", matrixTranslation, 3);
+	changed |= ImGui::InputFloat3("Rt", matrixRotation, 3);
+	changed |= ImGui::InputFloat3("Sc", matrixScale, 3);
+	if (changed)
+	{
+		ImGuizmo::RecomposeMatrixFromComponents(matrixTranslation, matrixRotation, matrixScale, matrix.m);
+		Scene::getInstance()->gizmoEntity->markDirty();
+	}
 
 	if (mCurrentGizmoOperation != ImGuizmo::SCALE)
 	{
@@ -240,6 +270,8 @@ void Application::renderDebugGizmo()
 	ImGuiIO& io = ImGui::GetIO();
 	ImGuizmo::SetRect(0, 0, io.DisplaySize.x, io.DisplaySize.y);
 	ImGuizmo::Manipulate(camera->view_matrix.m, camera->projection_matrix.m, mCurrentGizmoOperation, mCurrentGizmoMode, matrix.m, NULL, useSnap ? &snap.x : NULL);
+	if (ImGuizmo::IsUsing())
+		Scene::getInstance()->gizmoEntity->markDirty();
 	#endif
 }
 
@@ -262,8 +294,20 @@ void Application::renderDebugGUI(void)
 		ImGui::TreePop();
 	}
 
+	//timings of the different passes
+	if (ImGui::TreeNode((void*)&GTR::Profiler::enabled, "Profiler")) {
+		GTR::Profiler::renderInMenu();
+		ImGui::TreePop();
+	}
+
 	//add info to the debug panel about the camera
 	if (ImGui::TreeNode(camera, "Camera")) {
+		if (ImGui::Checkbox("Benchmark camera path", &camera_path) && camera_path)
+		{
+			camera_path_frame = 0;
+			camera_path_center = camera->center;
+			camera_path_offset = camera->eye - camera->center;
+		}
 		camera->renderInMenu();
 		ImGui::TreePop();
 	}
@@ -298,6 +342,15 @@ void Application::renderDebugGUI(void)
 				ImGui::TreePop();
 			}
 		}
+
+		//DECALS
+		for (int i = 0; i < Scene::getInstance()->decalEntities.size(); i++)
+		{
+			if (ImGui::TreeNode(Scene::getInstance()->decalEntities.at(i), "Decal")) {
+				Scene::getInstance()->decalEntities.at(i)->renderInMenu();
+				ImGui::TreePop();
+			}
+		}
 		ImGui::TreePop();
 	}
 
@@ -341,10 +394,35 @@ void Application::onMouseButtonDown( SDL_MouseButtonEvent event )
 		mouse_locked = !mouse_locked;
 		SDL_ShowCursor(!mouse_locked);
 	}
+
+	//the gui and the gizmo keep their clicks
+	if (event.button == SDL_BUTTON_LEFT)
+	{
+		pick_pending = !mouse_locked;
+		#ifndef SKIP_IMGUI
+			if (ImGui::GetIO().WantCaptureMouse || ImGuizmo::IsOver() || ImGuizmo::IsUsing())
+				pick_pending = false;
+		#endif
+		pick_mouse_position = Input::mouse_position;
+	}
 }
 
 void Application::onMouseButtonUp(SDL_MouseButtonEvent event)
 {
+	//pick the entity under the mouse to edit it with the gizmo, only on clicks (left drag orbits the camera)
+	if (event.button == SDL_BUTTON_LEFT && pick_pending && renderer->use_bvh)
+	{
+		Vector2 delta = Input::mouse_position - pick_mouse_position;
+		if (delta.x * delta.x + delta.y * delta.y <= 9.0f)
+		{
+			Vector3 dir = camera->getRayDirection((int)Input::mouse_position.x, (int)Input::mouse_position.y, (float)window_width, (float)window_height);
+			int item = renderer->bvh->raycast(camera->eye, dir, camera->far_plane);
+			if (item != -1)
+				Scene::getInstance()->gizmoEntity = renderer->bvh->items[item].entity;
+		}
+	}
+	if (event.button == SDL_BUTTON_LEFT)
+		pick_pending = false;
 }
 
 void Application::onMouseWheel(SDL_MouseWheelEvent event)
@@ -35,6 +35,12 @@ public:
 
 	//some vars
 	bool mouse_locked; //tells if the mouse is locked (blocked in the center and not visible)
+	bool pick_pending; //left click outside the gui, picks on release if the mouse didnt move (dragging orbits)
+	Vector2 pick_mouse_position;
+	bool camera_path; //benchmark: the camera orbits the same amount every frame so runs can be compared
+	int camera_path_frame;
+	Vector3 camera_path_center;
+	Vector3 camera_path_offset; //eye relative to the center when the path started
 	bool render_wireframe; //in case we want to render everything in wireframe mode
 
 	Application( int window_width, int window_height, SDL_Window* window );
@@ -0,0 +1,353 @@
+#include "bvh.h"
+
+#include "camera.h"
+#include "entity.h"
+#include "prefab.h"
+#include "mesh.h"
+
+#include <algorithm>
+
+using namespace GTR;
+
+//a node is drawn only if all its ancestors are visible too
+static bool isNodeVisible(Node* node)
+{
+	for (; node; node = node->parent)
+		if (!node->visible)
+			return false;
+	return true;
+}
+
+static void copyWorldNode(sBVHItem& item, PrefabEntity::sWorldNode& world_node)
+{
+	item.model = world_node.model;
+	item.box = world_node.box;
+}
+
+//distance along the ray to the box, -1 if it misses
+static float rayBoxDistance(const Vector3& min, const Vector3& max, const Vector3& origin, const Vector3& inv_direction)
+{
+	float tmin = 0.0f, tmax = 1e20f;
+	for (int i = 0; i < 3; ++i)
+	{
+		float t0 = ((&min.x)[i] - (&origin.x)[i]) * (&inv_direction.x)[i];
+		float t1 = ((&max.x)[i] - (&origin.x)[i]) * (&inv_direction.x)[i];
+		if (t0 > t1)
+			std::swap(t0, t1);
+		tmin = std::max(tmin, t0);
+		tmax = std::min(tmax, t1);
+		if (tmin > tmax)
+			return -1.0f;
+	}
+	return tmin;
+}
+
+static bool sphereBoxOverlap(const Vector3& min, const Vector3& max, const Vector3& center, float radius)
+{
+	float dist2 = 0.0f;
+	for (int i = 0; i < 3; ++i)
+	{
+		float v = (&center.x)[i];
+		float d = v < (&min.x)[i] ? (&min.x)[i] - v : (v > (&max.x)[i] ? v - (&max.x)[i] : 0.0f);
+		dist2 += d * d;
+	}
+	return dist2 <= radius * radius;
+}
+
+SceneBVH::SceneBVH()
+{
+	num_refits = 0;
+	num_visited = 0;
+	use_tree = true;
+}
+
+void SceneBVH::build(std::vector<PrefabEntity*>& entities)
+{
+	this->entities = entities;
+	items.clear();
+	nodes.clear();
+	entity_versions.resize(entities.size());
+	entity_items.assign(entities.size(), std::vector<int>());
+
+	for (int i = 0; i < entities.size(); ++i)
+	{
+		std::vector<PrefabEntity::sWorldNode>& world_nodes = entities[i]->getWorldNodes();
+		entity_versions[i] = entities[i]->world_version;
+		for (int j = 0; j < world_nodes.size(); ++j)
+		{
+			sBVHItem item;
+			item.entity = entities[i];
+			item.world_index = j;
+			item.node = world_nodes[j].node;
+			copyWorldNode(item, world_nodes[j]);
+			entity_items[i].push_back((int)items.size());
+			items.push_back(item);
+		}
+	}
+
+	item_order.resize(items.size());
+	item_leaf.resize(items.size());
+	for (int i = 0; i < items.size(); ++i)
+		item_order[i] = i;
+
+	if (items.size())
+	{
+		nodes.reserve(items.size() * 2);
+		buildNode(0, (int)items.size(), -1);
+	}
+
+	item_slot.resize(items.size());
+	boxes.resize((int)items.size());
+	for (int i = 0; i < item_order.size(); ++i)
+	{
+		item_slot[item_order[i]] = i;
+		boxes.set(i, items[item_order[i]].box.center, items[item_order[i]].box.halfsize);
+	}
+}
+
+//top down, splitting the longest axis of the centers by the median
+int SceneBVH::buildNode(int first, int count, int parent)
+{
+	int index = (int)nodes.size();
+	sBVHNode node;
+	node.parent = parent;
+	node.left = node.right = -1;
+	node.first = first;
+	node.count = count;
+	nodes.push_back(node);
+
+	if (count <= BVH_LEAF_SIZE)
+	{
+		for (int i = first; i < first + count; ++i)
+			item_leaf[item_order[i]] = index;
+		computeNodeBounds(index);
+		return index;
+	}
+
+	Vector3 center_min(1e20f, 1e20f, 1e20f), center_max(-1e20f, -1e20f, -1e20f);
+	for (int i = first; i < first + count; ++i)
+	{
+		center_min.setMin(items[item_order[i]].box.center);
+		center_max.setMax(items[item_order[i]].box.center);
+	}
+	Vector3 extent = center_max - center_min;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+	int half = count / 2;
+	std::nth_element(item_order.begin() + first, item_order.begin() + first + half, item_order.begin() + first + count,
+		[this, axis](int a, int b) { return (&items[a].box.center.x)[axis] < (&items[b].box.center.x)[axis]; });
+
+	int left = buildNode(first, half, index);
+	int right = buildNode(first + half, count - half, index);
+	nodes[index].left = left;
+	nodes[index].right = right;
+	computeNodeBounds(index);
+	return index;
+}
+
+void SceneBVH::computeNodeBounds(int index)
+{
+	sBVHNode& node = nodes[index];
+	if (node.left == -1)
+	{
+		node.min.set(1e20f, 1e20f, 1e20f);
+		node.max.set(-1e20f, -1e20f, -1e20f);
+		for (int i = node.first; i < node.first + node.count; ++i)
+		{
+			BoundingBox& box = items[item_order[i]].box;
+			node.min.setMin(box.center - box.halfsize);
+			node.max.setMax(box.center + box.halfsize);
+		}
+		return;
+	}
+	node.min = nodes[node.left].min;
+	node.max = nodes[node.left].max;
+	node.min.setMin(nodes[node.right].min);
+	node.max.setMax(nodes[node.right].max);
+}
+
+bool SceneBVH::update(std::vector<PrefabEntity*>& entities)
+{
+	if (entities != this->entities)
+	{
+		build(entities);
+		return true;
+	}
+
+	bool changed = false;
+	for (int i = 0; i < entities.size(); ++i)
+	{
+		//the cache of the entity is only recomputed if it moved
+		std::vector<PrefabEntity::sWorldNode>& world_nodes = entities[i]->getWorldNodes();
+		if (world_nodes.size() != entity_items[i].size())
+		{
+			build(entities);
+			return true;
+		}
+		if (entities[i]->world_version != entity_versions[i])
+		{
+			entity_versions[i] = entities[i]->world_version;
+			refitEntity(i);
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+void SceneBVH::refitEntity(int entity_index)
+{
+	std::vector<int>& indices = entity_items[entity_index];
+	std::vector<PrefabEntity::sWorldNode>& world_nodes = entities[entity_index]->getWorldNodes();
+	for (int i = 0; i < indices.size(); ++i)
+	{
+		sBVHItem& item = items[indices[i]];
+		copyWorldNode(item, world_nodes[item.world_index]);
+		boxes.set(item_slot[indices[i]], item.box.center, item.box.halfsize);
+	}
+
+	//children are always stored after their parent, so refitting the dirty nodes from the last to the first is bottom up
+	std::vector<int> dirty;
+	std::vector<bool> marked(nodes.size(), false);
+	for (int i = 0; i < indices.size(); ++i)
+		for (int node = item_leaf[indices[i]]; node != -1 && !marked[node]; node = nodes[node].parent)
+		{
+			marked[node] = true;
+			dirty.push_back(node);
+		}
+	std::sort(dirty.begin(), dirty.end());
+	for (int i = (int)dirty.size() - 1; i >= 0; --i)
+		computeNodeBounds(dirty[i]);
+	num_refits += (int)dirty.size();
+}
+
+void SceneBVH::addSubtree(int index, std::vector<int>& result)
+{
+	sBVHNode& node = nodes[index];
+	for (int i = node.first; i < node.first + node.count; ++i)
+		if (isNodeVisible(items[item_order[i]].node))
+			result.push_back(item_order[i]);
+}
+
+void SceneBVH::cullFrustum(Camera* camera, std::vector<int>& result)
+{
+	num_visited = 0;
+	if (nodes.empty())
+		return;
+
+	if (!use_tree)
+	{
+		visible_mask.resize((items.size() + 31) / 32);
+		cullBoxesSIMD(camera->frustum, boxes, 0, (int)items.size(), &visible_mask[0]);
+		for (int i = 0; i < item_order.size(); ++i)
+			if ((visible_mask[i >> 5] & (1u << (i & 31))) && isNodeVisible(items[item_order[i]].node))
+				result.push_back(item_order[i]);
+		return;
+	}
+
+	int stack[64];
+	int stack_size = 0;
+	stack[stack_size++] = 0;
+	while (stack_size)
+	{
+		int index = stack[--stack_size];
+		sBVHNode& node = nodes[index];
+		num_visited++;
+
+		Vector3 halfsize = (node.max - node.min) * 0.5f;
+		char clip = camera->testBoxInFrustum(node.min + halfsize, halfsize);
+		if (clip == CLIP_OUTSIDE)
+			continue;
+		if (clip == CLIP_INSIDE)	//the whole subtree is visible, no more tests
+		{
+			addSubtree(index, result);
+			continue;
+		}
+
+		if (node.left != -1)
+		{
+			stack[stack_size++] = node.left;
+			stack[stack_size++] = node.right;
+			continue;
+		}
+
+		uint32_t mask;
+		cullBoxesSIMD(camera->frustum, boxes, node.first, node.count, &mask);
+		for (int i = 0; i < node.count; ++i)
+			if ((mask & (1u << i)) && isNodeVisible(items[item_order[node.first + i]].node))
+				result.push_back(item_order[node.first + i]);
+	}
+}
+
+void SceneBVH::queryRadius(const Vector3& center, float radius, std::vector<int>& result, int max_results)
+{
+	int end_size = max_results ? (int)result.size() + max_results : -1;
+	if (nodes.empty())
+		return;
+
+	int stack[64];
+	int stack_size = 0;
+	stack[stack_size++] = 0;
+	while (stack_size)
+	{
+		sBVHNode& node = nodes[stack[--stack_size]];
+		if (!sphereBoxOverlap(node.min, node.max, center, radius))
+			continue;
+		if (node.left != -1)
+		{
+			stack[stack_size++] = node.left;
+			stack[stack_size++] = node.right;
+			continue;
+		}
+		for (int i = node.first; i < node.first + node.count; ++i)
+		{
+			BoundingBox& box = items[item_order[i]].box;
+			if (sphereBoxOverlap(box.center - box.halfsize, box.center + box.halfsize, center, radius))
+			{
+				result.push_back(item_order[i]);
+				if (result.size() == end_size)
+					return;
+			}
+		}
+	}
+}
+
+int SceneBVH::raycast(const Vector3& origin, const Vector3& direction, float max_distance, float* distance)
+{
+	if (nodes.empty())
+		return -1;
+
+	Vector3 inv_direction(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+	int closest = -1;
+	float closest_distance = max_distance;
+
+	int stack[64];
+	int stack_size = 0;
+	stack[stack_size++] = 0;
+	while (stack_size)
+	{
+		sBVHNode& node = nodes[stack[--stack_size]];
+		float t = rayBoxDistance(node.min, node.max, origin, inv_direction);
+		if (t < 0.0f || t > closest_distance)
+			continue;
+		if (node.left != -1)
+		{
+			stack[stack_size++] = node.left;
+			stack[stack_size++] = node.right;
+			continue;
+		}
+		for (int i = node.first; i < node.first + node.count; ++i)
+		{
+			sBVHItem& item = items[item_order[i]];
+			t = rayBoxDistance(item.box.center - item.box.halfsize, item.box.center + item.box.halfsize, origin, inv_direction);
+			if (t > 0.0f && t < closest_distance && isNodeVisible(item.node))	//t is 0 with the origin inside the box
+			{
+				closest = item_order[i];
+				closest_distance = t;
+			}
+		}
+	}
+
+	if (distance && closest != -1)
+		*distance = closest_distance;
+	return closest;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "framework.h"
+#include "frustumcull.h"
+#include <vector>
+
+//forward declarations
+class Camera;
+class PrefabEntity;
+
+#define BVH_LEAF_SIZE 4	//max items stored in a leaf of the tree
+
+namespace GTR {
+
+	class Node;
+
+	//a node of a prefab instanced by an entity, with its world bounding box
+	struct sBVHItem {
+		PrefabEntity* entity;
+		int world_index;	//in the world nodes of the entity
+		Node* node;
+		Matrix44 model;	//global matrix of the node
+		BoundingBox box;	//world space
+	};
+
+	struct sBVHNode {
+		Vector3 min;
+		Vector3 max;
+		int parent;
+		int left;	//-1 in the leaves
+		int right;
+		int first;	//range of item_order covered by this node (all the subtree)
+		int count;
+	};
+
+	//Bounding volume hierarchy over the nodes with mesh of all the prefab entities.
+	//It is built once and refitted when the world transforms of an entity change, so the topology only
+	//gets worse if things move a lot; it is rebuilt when entities or nodes are added or removed.
+	class SceneBVH
+	{
+	public:
+		std::vector<sBVHItem> items;
+		std::vector<sBVHNode> nodes;	//nodes[0] is the root
+		std::vector<int> item_order;	//items sorted by leaf, every tree node covers a contiguous range
+		sBoxesSoA boxes;	//world boxes of the items in item_order, the leaves are culled in one batch
+		bool use_tree;	//false culls all the boxes in batches without traversing the tree (for comparison)
+
+		//stats of the last queries
+		int num_refits;
+		int num_visited;
+
+		SceneBVH();
+
+		void build(std::vector<PrefabEntity*>& entities);
+
+		//rebuilds if the entities changed and refits the ones that moved, returns true if something changed
+		bool update(std::vector<PrefabEntity*>& entities);
+
+		//copies the boxes of the items of an entity and recomputes their ancestors
+		void refitEntity(int entity_index);
+
+		//appends the index of the items that could be visible from the camera
+		void cullFrustum(Camera* camera, std::vector<int>& result);
+		//items whose box touches the sphere, stops after max_results if it is not 0
+		void queryRadius(const Vector3& center, float radius, std::vector<int>& result, int max_results = 0);
+		//closest item whose box is hit by the ray, -1 if none. Boxes containing the origin are ignored,
+		//so from inside a building the ray picks what is in it and not the building
+		int raycast(const Vector3& origin, const Vector3& direction, float max_distance, float* distance = NULL);
+
+	private:
+		std::vector<PrefabEntity*> entities;
+		std::vector<int> entity_versions;	//world_version of the entities when they were last refitted
+		std::vector<std::vector<int>> entity_items;
+		std::vector<int> item_leaf;	//leaf that contains every item
+		std::vector<int> item_slot;	//position of every item in item_order
+		std::vector<uint32_t> visible_mask;
+
+		int buildNode(int first, int count, int parent);
+		void computeNodeBounds(int index);
+		void addSubtree(int index, std::vector<int>& result);
+	};
+
+};
@@ -0,0 +1,228 @@
+#include "clusters.h"
+
+#include "camera.h"
+#include "texture.h"
+#include "shader.h"
+#include "entity.h"
+#include "bvh.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+using namespace GTR;
+
+//shader names must be literals, the shader caches the pointer of the string
+static const char* cluster_shadow_map_names[MAX_CLUSTERED_SHADOW_FBOS] = {
+	"u_cluster_shadow_map_0", "u_cluster_shadow_map_1", "u_cluster_shadow_map_2", "u_cluster_shadow_map_3" };
+
+LightClusters::LightClusters()
+{
+	near_plane = 1.0f;
+	far_plane = 10000.0f;
+	num_lights = 0;
+	num_indices = 0;
+	bvh = NULL;
+	shadow_atlas = NULL;
+
+	light_data.resize(MAX_CLUSTERED_LIGHTS * CLUSTER_LIGHT_TEXELS * 4);
+	cluster_data.resize(CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z * 2);
+	index_data.resize(CLUSTER_INDEX_WIDTH * CLUSTER_INDEX_HEIGHT);
+	counts.resize(CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z);
+	light_ranges.resize(MAX_CLUSTERED_LIGHTS * 6);
+
+	light_data_texture = new Texture(CLUSTER_LIGHT_TEXELS, MAX_CLUSTERED_LIGHTS, GL_RGBA, GL_FLOAT, false, NULL, GL_RGBA32F);
+	cluster_texture = new Texture(CLUSTERS_X * CLUSTERS_Y, CLUSTERS_Z, GL_RG, GL_FLOAT, false, NULL, GL_RG32F);
+	index_texture = new Texture(CLUSTER_INDEX_WIDTH, CLUSTER_INDEX_HEIGHT, GL_RED, GL_FLOAT, false, NULL, GL_R32F);
+}
+
+LightClusters::~LightClusters()
+{
+	delete light_data_texture;
+	delete cluster_texture;
+	delete index_texture;
+}
+
+//exponential slicing, so the clusters close to the camera are thinner
+static int depthToSlice(float depth, float near_plane, float far_plane)
+{
+	int slice = (int)floor(log(depth / near_plane) / log(far_plane / near_plane) * CLUSTERS_Z);
+	return (int)clamp((float)slice, 0.0f, CLUSTERS_Z - 1.0f);
+}
+
+bool GTR::computeClusterRange(Camera* camera, const Vector3& center, float radius, float near_plane, float far_plane, int* range)
+{
+	Vector3 view_pos = camera->view_matrix * center;
+	float depth = -view_pos.z;	//camera looks towards -Z
+	float zmin = std::max(depth - radius, near_plane);
+	float zmax = std::min(depth + radius, far_plane);
+	if (zmin > zmax)
+		return false;
+
+	range[4] = depthToSlice(zmin, near_plane, far_plane);
+	range[5] = depthToSlice(zmax, near_plane, far_plane);
+
+	//project the corners of the view space box (clipped to the near plane) to find its screen rect
+	Vector2 ndc_min(1.0f, 1.0f);
+	Vector2 ndc_max(-1.0f, -1.0f);
+	for (int i = 0; i < 8; ++i)
+	{
+		Vector4 corner( view_pos.x + (i & 1 ? radius : -radius),
+						view_pos.y + (i & 2 ? radius : -radius),
+						-(i & 4 ? zmax : zmin), 1.0f);
+		Vector4 clip = camera->projection_matrix * corner;
+		float x = clip.x / clip.w;
+		float y = clip.y / clip.w;
+		ndc_min.x = std::min(ndc_min.x, x);
+		ndc_min.y = std::min(ndc_min.y, y);
+		ndc_max.x = std::max(ndc_max.x, x);
+		ndc_max.y = std::max(ndc_max.y, y);
+	}
+
+	if (ndc_min.x > 1.0f || ndc_min.y > 1.0f || ndc_max.x < -1.0f || ndc_max.y < -1.0f)
+		return false;
+
+	range[0] = (int)clamp(floor((ndc_min.x * 0.5f + 0.5f) * CLUSTERS_X), 0.0f, CLUSTERS_X - 1.0f);
+	range[1] = (int)clamp(floor((ndc_max.x * 0.5f + 0.5f) * CLUSTERS_X), 0.0f, CLUSTERS_X - 1.0f);
+	range[2] = (int)clamp(floor((ndc_min.y * 0.5f + 0.5f) * CLUSTERS_Y), 0.0f, CLUSTERS_Y - 1.0f);
+	range[3] = (int)clamp(floor((ndc_max.y * 0.5f + 0.5f) * CLUSTERS_Y), 0.0f, CLUSTERS_Y - 1.0f);
+	return true;
+}
+
+int GTR::fillClusterLists(std::vector<int>& ranges, int num_items, std::vector<int>& counts, std::vector<float>& cluster_data, std::vector<float>& index_data)
+{
+	std::fill(counts.begin(), counts.end(), 0);
+
+	//count how many items fall in every cluster
+	for (int i = 0; i < num_items; ++i)
+	{
+		int* range = &ranges[i * 6];
+		for (int z = range[4]; z <= range[5]; ++z)
+			for (int y = range[2]; y <= range[3]; ++y)
+				for (int x = range[0]; x <= range[1]; ++x)
+					counts[x + y * CLUSTERS_X + z * CLUSTERS_X * CLUSTERS_Y]++;
+	}
+
+	//prefix sum to know where the list of every cluster starts
+	int max_indices = (int)index_data.size();
+	int offset = 0;
+	for (size_t i = 0; i < counts.size(); ++i)
+	{
+		int count = std::min(counts[i], max_indices - offset);
+		cluster_data[i * 2] = (float)offset;
+		cluster_data[i * 2 + 1] = 0.0f;	//filled in the second pass
+		counts[i] = count;
+		offset += count;
+	}
+
+	//second pass: write the item indices
+	for (int i = 0; i < num_items; ++i)
+	{
+		int* range = &ranges[i * 6];
+		for (int z = range[4]; z <= range[5]; ++z)
+			for (int y = range[2]; y <= range[3]; ++y)
+				for (int x = range[0]; x <= range[1]; ++x)
+				{
+					int cluster = x + y * CLUSTERS_X + z * CLUSTERS_X * CLUSTERS_Y;
+					float& count = cluster_data[cluster * 2 + 1];
+					if (count >= counts[cluster])
+						continue; //index list is full
+					index_data[(int)cluster_data[cluster * 2] + (int)count] = (float)i;
+					count += 1.0f;
+				}
+	}
+	return offset;
+}
+
+//computes the min and max cluster (x,y,z) covered by the sphere of influence of the light
+bool LightClusters::computeClusterRange(Camera* camera, Light* light, int* range)
+{
+	Vector3 light_pos = light->model.getTranslation();
+	float radius = light->maxDist;
+
+	if (camera->testSphereInFrustum(light_pos, radius) == CLIP_OUTSIDE)
+		return false;
+
+	if (bvh)
+	{
+		bvh_results.clear();
+		bvh->queryRadius(light_pos, radius, bvh_results, 1);
+		if (bvh_results.empty())
+			return false;
+	}
+
+	return GTR::computeClusterRange(camera, light_pos, radius, near_plane, far_plane, range);
+}
+
+void LightClusters::update(Camera* camera, std::vector<Light*>& lights, Texture* shadow_atlas)
+{
+	near_plane = camera->near_plane;
+	far_plane = camera->far_plane;
+	num_lights = 0;
+	num_indices = 0;
+	fbo_shadowed_lights.clear();
+	this->shadow_atlas = shadow_atlas;
+
+	//pack the visible lights and find their clusters
+	for (Light* light : lights)
+	{
+		if (!light->visible || num_lights >= MAX_CLUSTERED_LIGHTS)
+			continue;
+		if (light->light_type != lightType::POINT_LIGHT && light->light_type != lightType::SPOT)
+			continue;
+
+		int* range = &light_ranges[num_lights * 6];
+		if (!computeClusterRange(camera, light, range))
+			continue;
+
+		//all the tiles of the atlas are read from the same sampler
+		float shadow_slot = -1.0f;
+		if (light->hasShadowMap())
+		{
+			if (shadow_atlas && light->shadowMap == shadow_atlas)
+				shadow_slot = CLUSTER_ATLAS_SHADOW_SLOT;
+			else if (fbo_shadowed_lights.size() < MAX_CLUSTERED_SHADOW_FBOS)
+			{
+				shadow_slot = (float)fbo_shadowed_lights.size();
+				fbo_shadowed_lights.push_back(light);
+			}
+		}
+
+		Vector3 pos = light->model.getTranslation();
+		Vector3 dir = light->model.frontVector();
+		float* data = &light_data[num_lights * CLUSTER_LIGHT_TEXELS * 4];
+		data[0] = pos.x; data[1] = pos.y; data[2] = pos.z; data[3] = light->maxDist;
+		data[4] = light->color.x; data[5] = light->color.y; data[6] = light->color.z; data[7] = light->intensity;
+		data[8] = dir.x; data[9] = dir.y; data[10] = dir.z; data[11] = (float)light->light_type;
+		data[12] = (float)cos(DEG2RAD * light->angleCutoff);
+		data[13] = (float)cos(DEG2RAD * light->innerAngle);
+		data[14] = shadow_slot;
+		data[15] = light->bias;
+		memcpy(data + 16, &light->shadow_rect.x, sizeof(float) * 4);
+		memcpy(data + 20, light->camera->viewprojection_matrix.m, sizeof(float) * 16);	//one column per texel
+
+		num_lights++;
+	}
+
+	num_indices = fillClusterLists(light_ranges, num_lights, counts, cluster_data, index_data);
+
+	//upload everything
+	light_data_texture->upload(GL_RGBA, GL_FLOAT, false, (Uint8*)&light_data[0], GL_RGBA32F);
+	cluster_texture->upload(GL_RG, GL_FLOAT, false, (Uint8*)&cluster_data[0], GL_RG32F);
+	index_texture->upload(GL_RED, GL_FLOAT, false, (Uint8*)&index_data[0], GL_R32F);
+}
+
+void LightClusters::setUniforms(Shader* shader, int first_slot)
+{
+	shader->setUniform("u_light_data_texture", light_data_texture, first_slot);
+	shader->setUniform("u_cluster_texture", cluster_texture, first_slot + 1);
+	shader->setUniform("u_cluster_index_texture", index_texture, first_slot + 2);
+	shader->setUniform("u_cluster_dims", Vector3(CLUSTERS_X, CLUSTERS_Y, CLUSTERS_Z));
+	shader->setUniform("u_cluster_near", near_plane);
+	shader->setUniform("u_cluster_scale", CLUSTERS_Z / (float)log(far_plane / near_plane));
+	shader->setUniform("u_cluster_index_width", CLUSTER_INDEX_WIDTH);
+
+	shader->setUniform("u_shadow_atlas", shadow_atlas ? shadow_atlas : Texture::getWhiteTexture(), first_slot + 3);
+	for (int i = 0; i < MAX_CLUSTERED_SHADOW_FBOS; ++i)
+		shader->setUniform(cluster_shadow_map_names[i], i < fbo_shadowed_lights.size() ? fbo_shadowed_lights[i]->shadowMap : Texture::getWhiteTexture(), first_slot + 4 + i);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "framework.h"
+#include <vector>
+
+//forward declarations
+class Camera;
+class Texture;
+class Shader;
+class Light;
+
+#define CLUSTERS_X 16
+#define CLUSTERS_Y 9
+#define CLUSTERS_Z 24
+#define MAX_CLUSTERED_LIGHTS 1024
+#define MAX_CLUSTERED_SHADOW_FBOS 4	//shadowed lights outside the shadow atlas, the rest have no limit
+#define CLUSTER_ATLAS_SHADOW_SLOT MAX_CLUSTERED_SHADOW_FBOS	//slot of the lights with a tile in the atlas, same in deferred_clustered.fs
+#define CLUSTER_LIGHT_TEXELS 9
+#define CLUSTER_INDEX_WIDTH 1024	//width of the texture that stores the light indices
+#define CLUSTER_INDEX_HEIGHT 256
+
+namespace GTR {
+
+	class SceneBVH;
+
+	//min and max cluster (x,y,z) covered by a sphere, false if it is outside the frustum or the depth range
+	bool computeClusterRange(Camera* camera, const Vector3& center, float radius, float near_plane, float far_plane, int* range);
+
+	//from the cluster range of every item (6 ints each) fills the offset and count of every cluster and the index list,
+	//clusters that dont fit in the index list are truncated. Returns the amount of indices written
+	int fillClusterLists(std::vector<int>& ranges, int num_items, std::vector<int>& counts, std::vector<float>& cluster_data, std::vector<float>& index_data);
+
+	//Bins the point and spot lights of the scene into view space clusters (froxels),
+	//so the lighting pass only has to iterate the lights that can reach each pixel.
+	//Results are stored in float textures (like the irradiance probes) so they work in GL 3.3:
+	// - light_data_texture: 9 texels per light (one row per light), the last 5 are the rect and viewprojection of its shadowmap
+	// - cluster_texture: offset and count inside the index list for every cluster
+	// - index_texture: the list of light indices of all the clusters one after the other
+	class LightClusters
+	{
+	public:
+		Texture* light_data_texture;
+		Texture* cluster_texture;
+		Texture* index_texture;
+
+		float near_plane;	//range used to slice the depth exponentially
+		float far_plane;
+
+		int num_lights;	//lights uploaded this frame
+		int num_indices;	//light references stored in all the clusters
+
+		//shadowed lights that use their own fbo, the shader has a fixed amount of samplers for them
+		std::vector<Light*> fbo_shadowed_lights;
+		Texture* shadow_atlas;	//of the last update, NULL if there is none
+
+		SceneBVH* bvh;	//optional, lights whose sphere doesnt touch any node are not assigned
+
+		LightClusters();
+		~LightClusters();
+
+		//assign the lights to the clusters of this camera and upload the result
+		void update(Camera* camera, std::vector<Light*>& lights, Texture* shadow_atlas);
+
+		//uniforms needed by the shaders that read the clusters (uses slots from first_slot onwards)
+		void setUniforms(Shader* shader, int first_slot);
+
+	private:
+		std::vector<float> light_data;
+		std::vector<float> cluster_data;
+		std::vector<float> index_data;
+
+		std::vector<int> counts;
+		std::vector<int> light_ranges;	//min and max cluster of every light (6 ints per light)
+		std::vector<int> bvh_results;
+
+		bool computeClusterRange(Camera* camera, Light* light, int* range);
+	};
+
+};
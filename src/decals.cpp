@@ -0,0 +1,230 @@
+#include "decals.h"
+
+#include "camera.h"
+#include "clusters.h"
+#include "entity.h"
+#include "fbo.h"
+#include "mesh.h"
+#include "shader.h"
+#include "texture.h"
+
+#include <cmath>
+#include <set>
+
+using namespace GTR;
+
+#define DECAL_SLOTS_PER_ROW (DECAL_ATLAS_SIZE / DECAL_SLOT_SIZE)
+
+DecalSystem::DecalSystem()
+{
+	near_plane = 1.0f;
+	far_plane = 10000.0f;
+	num_decals = 0;
+	num_indices = 0;
+	num_slots = 0;
+	atlas_version = 0;
+	fbo_id = 0;
+	attached_texture = 0;
+	atlas_fbo_id = 0;
+	atlas = NULL;
+
+	decal_data.resize(MAX_DECALS * 4 * 4);
+	cluster_data.resize(CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z * 2);
+	index_data.resize(CLUSTER_INDEX_WIDTH * CLUSTER_INDEX_HEIGHT);
+	counts.resize(CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z);
+	decal_ranges.resize(MAX_DECALS * 6);
+
+	decal_data_texture = new Texture(4, MAX_DECALS, GL_RGBA, GL_FLOAT, false, NULL, GL_RGBA32F);
+	cluster_texture = new Texture(CLUSTERS_X * CLUSTERS_Y, CLUSTERS_Z, GL_RG, GL_FLOAT, false, NULL, GL_RG32F);
+	index_texture = new Texture(CLUSTER_INDEX_WIDTH, CLUSTER_INDEX_HEIGHT, GL_RED, GL_FLOAT, false, NULL, GL_R32F);
+}
+
+DecalSystem::~DecalSystem()
+{
+	delete atlas;
+	delete decal_data_texture;
+	delete cluster_texture;
+	delete index_texture;
+	if (fbo_id)
+		glDeleteFramebuffers(1, &fbo_id);
+	if (atlas_fbo_id)
+		glDeleteFramebuffers(1, &atlas_fbo_id);
+}
+
+int DecalSystem::getSlot(const std::string& filename)
+{
+	auto it = slots.find(filename);
+	if (it != slots.end())
+		return it->second;
+	if (num_slots >= DECAL_SLOTS_PER_ROW * DECAL_SLOTS_PER_ROW)
+		return -1;
+
+	Texture* texture = Texture::Get(filename.c_str());
+	if (!texture)
+	{
+		slots[filename] = -1;	//not loaded again until the atlas is cleared
+		return -1;
+	}
+
+	if (!atlas)
+	{
+		atlas = new Texture(DECAL_ATLAS_SIZE, DECAL_ATLAS_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, true);
+		glGenFramebuffers(1, &atlas_fbo_id);
+		glBindFramebuffer(GL_FRAMEBUFFER, atlas_fbo_id);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, atlas->texture_id, 0);
+	}
+
+	//the texture is resized to its slot when drawing it, only once per file
+	int slot = num_slots++;
+	glBindFramebuffer(GL_FRAMEBUFFER, atlas_fbo_id);
+	glPushAttrib(GL_VIEWPORT_BIT);
+	glViewport((slot % DECAL_SLOTS_PER_ROW) * DECAL_SLOT_SIZE, (slot / DECAL_SLOTS_PER_ROW) * DECAL_SLOT_SIZE, DECAL_SLOT_SIZE, DECAL_SLOT_SIZE);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+	texture->toViewport();
+	glPopAttrib();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	atlas->generateMipmaps();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, DECAL_ATLAS_LEVELS);
+
+	slots[filename] = slot;
+	return slot;
+}
+
+void DecalSystem::clearAtlas()
+{
+	slots.clear();
+	num_slots = 0;
+	atlas_version++;
+}
+
+void DecalSystem::update(Camera* camera, std::vector<DecalEntity*>& decals)
+{
+	near_plane = camera->near_plane;
+	far_plane = camera->far_plane;
+	num_decals = 0;
+	num_indices = 0;
+
+	float slot_scale = DECAL_SLOT_SIZE / (float)DECAL_ATLAS_SIZE;
+
+	//when the atlas is full and a visible decal needs a new texture, it is emptied so only the textures in use are packed
+	//(unless they dont fit either, then it would be repacked every frame)
+	if (num_slots >= DECAL_SLOTS_PER_ROW * DECAL_SLOTS_PER_ROW)
+	{
+		std::set<std::string> in_use;
+		bool missing = false;
+		for (DecalEntity* decal : decals)
+			if (decal->visible)
+			{
+				in_use.insert(decal->texture_filename);
+				missing = missing || slots.find(decal->texture_filename) == slots.end();
+			}
+		if (missing && in_use.size() <= DECAL_SLOTS_PER_ROW * DECAL_SLOTS_PER_ROW)
+			clearAtlas();
+	}
+
+	//pack the visible decals and find their clusters
+	for (DecalEntity* decal : decals)
+	{
+		if (!decal->visible || num_decals >= MAX_DECALS)
+			continue;
+		//a failed lookup is not retried until the atlas changes
+		if (decal->atlas_version != atlas_version)
+		{
+			decal->atlas_slot = getSlot(decal->texture_filename);
+			decal->atlas_version = atlas_version;
+		}
+		if (decal->atlas_slot == -1)
+			continue;
+
+		//sphere around the box, the half axes of the box are the columns of the model
+		float* m = decal->model.m;
+		Vector3 center = decal->model.getTranslation();
+		float radius = sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2] +
+							m[4] * m[4] + m[5] * m[5] + m[6] * m[6] +
+							m[8] * m[8] + m[9] * m[9] + m[10] * m[10]);
+		if (camera->testSphereInFrustum(center, radius) == CLIP_OUTSIDE)
+			continue;
+
+		int* range = &decal_ranges[num_decals * 6];
+		if (!computeClusterRange(camera, center, radius, near_plane, far_plane, range))
+			continue;
+
+		Matrix44 inverse_model = decal->model;
+		inverse_model.inverse();
+		float* im = inverse_model.m;
+		float* data = &decal_data[num_decals * 16];
+		for (int row = 0; row < 3; ++row)
+		{
+			data[row * 4] = im[row];
+			data[row * 4 + 1] = im[4 + row];
+			data[row * 4 + 2] = im[8 + row];
+			data[row * 4 + 3] = im[12 + row];
+		}
+		data[12] = (decal->atlas_slot % DECAL_SLOTS_PER_ROW) * slot_scale;
+		data[13] = (decal->atlas_slot / DECAL_SLOTS_PER_ROW) * slot_scale;
+		data[14] = slot_scale;
+		data[15] = decal->opacity;
+
+		num_decals++;
+	}
+
+	num_indices = fillClusterLists(decal_ranges, num_decals, counts, cluster_data, index_data);
+
+	//only the rows in use
+	if (num_decals)
+	{
+		decal_data_texture->bind();
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 4, num_decals, GL_RGBA, GL_FLOAT, &decal_data[0]);
+	}
+	cluster_texture->upload(GL_RG, GL_FLOAT, false, (Uint8*)&cluster_data[0], GL_RG32F);
+	index_texture->upload(GL_RED, GL_FLOAT, false, (Uint8*)&index_data[0], GL_R32F);
+}
+
+void DecalSystem::apply(Camera* camera, FBO* gbuffers, const Matrix44& inverse_viewprojection)
+{
+	if (!num_decals)
+		return;
+
+	Texture* color_texture = gbuffers->color_textures[0];
+	if (!fbo_id)
+		glGenFramebuffers(1, &fbo_id);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_id);
+	if (attached_texture != color_texture->texture_id)
+	{
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color_texture->texture_id, 0);
+		attached_texture = color_texture->texture_id;
+	}
+	GLenum buffer = GL_COLOR_ATTACHMENT0;
+	glDrawBuffers(1, &buffer);
+	glPushAttrib(GL_VIEWPORT_BIT);
+	glViewport(0, 0, color_texture->width, color_texture->height);
+
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	//the shader outputs the decals of the pixel already composited (premultiplied),
+	//the alpha of the gbuffer is kept, the packed layout stores the occlusion there
+	glBlendFuncSeparate(GL_ONE, GL_ONE_MINUS_SRC_ALPHA, GL_ZERO, GL_ONE);
+
+	Shader* shader = Shader::Get("decal");
+	shader->enable();
+	shader->setUniform("u_depth_texture", gbuffers->depth_texture, 0);
+	shader->setUniform("u_decal_atlas", atlas, 1);
+	shader->setUniform("u_decal_data_texture", decal_data_texture, 2);
+	shader->setUniform("u_cluster_texture", cluster_texture, 3);
+	shader->setUniform("u_cluster_index_texture", index_texture, 4);
+	shader->setUniform("u_inverse_viewprojection", inverse_viewprojection);
+	shader->setUniform("u_view", camera->view_matrix);
+	shader->setUniform("u_cluster_dims", Vector3(CLUSTERS_X, CLUSTERS_Y, CLUSTERS_Z));
+	shader->setUniform("u_cluster_near", near_plane);
+	shader->setUniform("u_cluster_scale", CLUSTERS_Z / (float)log(far_plane / near_plane));
+	shader->setUniform("u_cluster_index_width", CLUSTER_INDEX_WIDTH);
+	shader->setUniform("u_slot_texel", 1.0f / DECAL_ATLAS_SIZE);
+	Mesh::getQuad()->render(GL_TRIANGLES);
+	shader->disable();
+
+	glDisable(GL_BLEND);
+	glPopAttrib();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
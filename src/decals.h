@@ -0,0 +1,73 @@
+#pragma once
+
+#include "includes.h"
+#include "framework.h"
+#include <vector>
+#include <map>
+#include <string>
+
+//forward declarations
+class Camera;
+class Texture;
+class FBO;
+class DecalEntity;
+
+#define MAX_DECALS 4096
+#define DECAL_ATLAS_SIZE 4096
+#define DECAL_SLOT_SIZE 512	//every decal texture is resized to one square slot of the atlas
+#define DECAL_ATLAS_LEVELS 6	//last mipmap of the atlas, a slot keeps 8x8 texels so they dont bleed into each other
+
+namespace GTR {
+
+	//Draws all the decals of the scene over the color of the gbuffers in a single fullscreen pass.
+	//The textures are packed in one atlas (a slot per file, filled the first time a decal uses it) and the decals
+	//are binned into the same clusters as the lights, so every pixel only tests the boxes of its cluster.
+	//The pass renders to an fbo that only has the color of the gbuffers attached, so their depth can be read directly.
+	// - decal_data_texture: 4 texels per decal, the first 3 rows of the inverse model and the atlas slot + opacity
+	// - cluster_texture and index_texture: same layout as LightClusters
+	class DecalSystem
+	{
+	public:
+		Texture* atlas;
+		Texture* decal_data_texture;
+		Texture* cluster_texture;
+		Texture* index_texture;
+
+		float near_plane;	//range used to slice the depth exponentially
+		float far_plane;
+
+		int num_decals;	//decals uploaded this frame
+		int num_indices;	//decal references stored in all the clusters
+		int num_slots;	//textures packed in the atlas
+		int atlas_version;	//incremented when the slots are evicted, the decals assigned before must look up theirs again
+
+		DecalSystem();
+		~DecalSystem();
+
+		//assign the visible decals to the clusters of this camera and upload the result
+		void update(Camera* camera, std::vector<DecalEntity*>& decals);
+
+		//blends the decals over the first color texture of the gbuffers
+		void apply(Camera* camera, FBO* gbuffers, const Matrix44& inverse_viewprojection);
+
+		//slot of the texture in the atlas, packing it if it is the first time, -1 if the atlas is full or it cant be loaded
+		int getSlot(const std::string& filename);
+
+		//evicts all the textures, they are packed again by the next decals that use them
+		void clearAtlas();
+
+	private:
+		GLuint fbo_id;	//color of the gbuffers without depth
+		GLuint attached_texture;	//gbuffer texture attached to fbo_id, the gbuffers are recreated when their format changes
+		GLuint atlas_fbo_id;
+		std::map<std::string, int> slots;
+
+		std::vector<float> decal_data;
+		std::vector<float> cluster_data;
+		std::vector<float> index_data;
+
+		std::vector<int> counts;
+		std::vector<int> decal_ranges;	//min and max cluster of every decal (6 ints per decal)
+	};
+
+};
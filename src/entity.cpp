@@ -10,6 +10,8 @@
 #include "mesh.h"
 
 #include "shader.h"
+#include "profiler.h"
+#include "shadowatlas.h"
 
 class Application;
 
@@ -25,6 +27,51 @@ PrefabEntity::PrefabEntity(GTR::Prefab* pPrefab_)
 	selected = false;
 	pPrefab = pPrefab_;
 	factor = 1;
+	dirty = true;
+	nodes_version = -1;
+	world_version = 0;
+	is_static = true;
+	s_static_version++;
+}
+
+long PrefabEntity::s_matrix_products = 0;
+long PrefabEntity::s_matrix_products_saved = 0;
+int PrefabEntity::s_static_version = 0;
+
+void PrefabEntity::markDirty()
+{
+	dirty = true;
+	if (is_static)
+		s_static_version++;
+}
+
+std::vector<PrefabEntity::sWorldNode>& PrefabEntity::getWorldNodes()
+{
+	if (!dirty && nodes_version == GTR::Node::version)
+	{
+		s_matrix_products_saved += world_nodes.size() * 2;	//global matrix of the node and the product with the entity
+		return world_nodes;
+	}
+
+	//the flat prefab already has the global matrices of the nodes, only the entity model is applied here
+	GTR::sFlatPrefab& flat = pPrefab->getFlat();
+	world_nodes.clear();
+	for (int i = 0; i < flat.size(); ++i)
+	{
+		if (flat.mesh[i] == -1 || flat.material[i] == -1)
+			continue;
+		sWorldNode world_node;
+		world_node.node = flat.nodes[i];
+		world_node.model = flat.global[i] * model;
+		world_node.box = transformBoundingBox(world_node.model, flat.bounds[i]);
+		world_node.visible = flat.visible[i] != 0;
+		world_nodes.push_back(world_node);
+		s_matrix_products++;
+	}
+	dirty = false;
+	nodes_version = GTR::Node::version;
+	world_version++;
+	return world_nodes;
 }
 
 void PrefabEntity::render(Camera* camera, GTR::Renderer* renderer) {
@@ -36,6 +83,8 @@ void PrefabEntity::renderInMenu()
 	ImGui::Text("Name: %s", name.c_str());
 
 	ImGui::Checkbox("Active", &visible);
+	if (ImGui::Checkbox("Static (cached shadows)", &is_static))
+		s_static_version++;
 
 	if (ImGui::Button("Select"))
 		Scene::getInstance()->gizmoEntity = this;
@@ -44,10 +93,14 @@ void PrefabEntity::renderInMenu()
 	{
 		float matrixTranslation[3], matrixRotation[3], matrixScale[3];
 		ImGuizmo::DecomposeMatrixToComponents(model.m, matrixTranslation, matrixRotation, matrixScale);
-		ImGui::DragFloat3("Position", matrixTranslation, 0.1f);
-		ImGui::DragFloat3("Rotation", matrixRotation, 0.1f);
-		ImGui::DragFloat3("Scale", matrixScale, 0.1f);
-		ImGuizmo::RecomposeMatrixFromComponents(matrixTranslation, matrixRotation, matrixScale, model.m);
+		bool changed = ImGui::DragFloat3("Position", matrixTranslation, 0.1f);
+		changed |= ImGui::DragFloat3("Rotation", matrixRotation, 0.1f);
+		changed |= ImGui::DragFloat3("Scale", matrixScale, 0.1f);
+		if (changed)
+		{
+			ImGuizmo::RecomposeMatrixFromComponents(matrixTranslation, matrixRotation, matrixScale, model.m);
+			markDirty();
+		}
 
 		ImGui::TreePop();
 	}
@@ -71,6 +124,7 @@ Light::Light(lightType type_)
 	bias = 0.001f;
 
 	is_cascade = false;
+	cast_shadows = true;
 	renderedHighShadow = false;
 
 	angleCutoff = 30;
@@ -84,7 +138,18 @@ Light::Light(lightType type_)
 	far_directional_shadowmap_updated = false;
 
 	fbo = NULL;
-	shadowMap = new Texture();
+	empty_shadowmap = new Texture();
+	shadowMap = empty_shadowmap;
+	static_fbo = NULL;
+	static_target = NULL;
+	static_x = static_y = static_size = 0;
+	static_views = -1;
+	static_version = -1;
+	static_nodes_version = -1;
+	atlas_x = atlas_y = atlas_size = 0;
+	shadow_rect.set(0, 0, 1, 1);
+	shadow_size = 0;
+	memset(face_signatures, 0, sizeof(face_signatures));
 
 	camera = new Camera();
 	camera->projection_matrix = model;
@@ -100,6 +165,7 @@ Light::Light(lightType type_)
 	}
 	else if (type_ == lightType::POINT_LIGHT) { 
 		name = "Point light"; 
+		cast_shadows = false;	//six faces, enabled by hand
 		camera->setPerspective(
 			angleCutoff * 2,
 			Application::instance->window_width / (float)Application::instance->window_height,
@@ -111,6 +177,14 @@ Light::Light(lightType type_)
 	}
 }
 
+Light::~Light()
+{
+	delete camera;
+	delete fbo;
+	delete static_fbo;
+	delete empty_shadowmap;
+}
+
 void Light::renderInMenu()
 {
 	ImGui::Text("Name: %s", name.c_str()); // Edit 3 floats representing a color
@@ -122,6 +196,7 @@ void Light::renderInMenu()
 	ImGui::DragFloat("Intensity", &intensity);
 	ImGui::DragFloat("Max Distance", &maxDist);
 	ImGui::DragFloat("Bias", &bias, 0.001f);
+	ImGui::Checkbox("Cast shadows", &cast_shadows);
 
 	if (ImGui::Button("Selected"))
 		Scene::getInstance()->gizmoEntity = this;
@@ -176,92 +251,335 @@ void Light::renderShadowMap(GTR::Renderer* renderer, Camera* user_camera)
 		this->light_type != lightType::POINT_LIGHT)
 		return;
 
-	int w = 1024;
-	int h = 1024;
+	if (!cast_shadows)
+		return;
+
+	if (!this->camera)
+		return;
 
 	renderer->shadow = true;
 
-	if (!this->fbo)
+	//lights with a tile draw in the shared atlas, the rest in their own fbo
+	FBO* target;
+	int x = 0, y = 0;
+	int columns = getShadowColumns();
+	int rows = getShadowRows();
+	if (renderer->use_shadow_atlas && atlas_size)
 	{
-		if (light_type != lightType::POINT_LIGHT)
-		{
-			this->fbo = new FBO();
-			this->fbo->setDepthOnly(w, h);
-			this->shadowMap->create(fbo->depth_texture->width, fbo->depth_texture->height);
-		}
-		else
+		target = renderer->shadow_atlas->fbo;
+		x = atlas_x;
+		y = atlas_y;
+		shadow_size = atlas_size;
+		float atlas_width = (float)target->depth_texture->width;
+		shadow_rect.set(x / atlas_width, y / atlas_width, columns * shadow_size / atlas_width, rows * shadow_size / atlas_width);
+	}
+	else
+	{
+		if (!this->fbo)
 		{
+			int size = light_type == lightType::POINT_LIGHT ? 512 : 1024;
 			this->fbo = new FBO();
-			this->fbo->setDepthOnly(w, h);
-			this->shadowMap->create(fbo->depth_texture->width, fbo->depth_texture->height);
+			this->fbo->setDepthOnly(columns * size, rows * size);
 		}
+		target = this->fbo;
+		shadow_size = this->fbo->depth_texture->width / columns;
+		shadow_rect.set(0, 0, 1, 1);
+	}
 
+	if (light_type == lightType::POINT_LIGHT)
+		renderCubeShadowMap(renderer, user_camera, target, x, y);
+	else if (!renderer->use_shadow_cache)
+	{
+		target->bind();
+		glEnable(GL_SCISSOR_TEST);	//only clear our tile
+		glScissor(x, y, shadow_size, shadow_size);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		glDisable(GL_SCISSOR_TEST);
+		renderShadowViews(renderer, user_camera, x, y);
+		target->unbind();
+		this->shadowMap = target->depth_texture;
 	}
+	else
+		renderCachedShadowMap(renderer, user_camera, target, x, y);
 
-	if (!this->camera)
-		return;
+	renderer->shadow = false;
+	glDisable(GL_DEPTH_TEST);
+}
 
-	this->fbo->bind();
+bool Light::hasShadowMap()
+{
+	return cast_shadows && shadow_size > 0;
+}
 
-	this->camera->enable();
+//the static casters are drawn in their own depth map, only redrawn when the shadow cameras, the tile or a static entity
+//change; the dynamic casters are drawn every frame on top of a copy of it (in the tile of the atlas or the fbo of the light)
+void Light::renderCachedShadowMap(GTR::Renderer* renderer, Camera* user_camera, FBO* target, int x, int y)
+{
+	int size = shadow_size;
+	int width = size * getShadowColumns();
+	int height = size * getShadowRows();
+
+	//same tile in the static atlas, the own fbo is only for the lights outside the atlas
+	FBO* cache_fbo;
+	int cache_x = x, cache_y = y;
+	if (target != this->fbo)
+	{
+		cache_fbo = renderer->shadow_atlas->getStaticFBO();
+		if (static_fbo)
+		{
+			delete static_fbo;
+			static_fbo = NULL;
+		}
+	}
+	else
+	{
+		if (static_fbo && static_fbo->depth_texture->width != width)	//the fbo of the light changed size
+		{
+			delete static_fbo;
+			static_fbo = NULL;
+		}
+		if (!static_fbo)
+		{
+			static_fbo = new FBO();
+			static_fbo->setDepthOnly(width, height);
+		}
+		cache_fbo = static_fbo;
+		cache_x = cache_y = 0;
+	}
+	if (cache_fbo != static_target || cache_x != static_x || cache_y != static_y || size != static_size)
+	{
+		static_target = cache_fbo;
+		static_x = cache_x;
+		static_y = cache_y;
+		static_size = size;
+		static_views = -1;
+	}
 
-	if (light_type == lightType::SPOT)
+	//the cameras of this frame, they change if the light moves (or the view for directional lights)
+	Matrix44 viewprojections[4];
+	int num_views = getNumShadowViews();
+	for (int i = 0; i < num_views; ++i)
 	{
-		renderSpotShadowMap(renderer);
+		int viewport[4];
+		setupShadowView(i, user_camera, viewport);
+		viewprojections[i] = camera->viewprojection_matrix;
 	}
-	else if( light_type == lightType::DIRECTIONAL){
 
-		renderDirectionalShadowMap(renderer, is_cascade, user_camera);
+	bool valid = static_views == num_views && static_version == PrefabEntity::s_static_version &&
+		static_nodes_version == GTR::Node::version && !memcmp(viewprojections, static_viewprojections, sizeof(Matrix44) * num_views);
+	if (!valid)
+	{
+		static_target->bind();
+		glEnable(GL_SCISSOR_TEST);	//only clear our tile
+		glScissor(static_x, static_y, width, height);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		glDisable(GL_SCISSOR_TEST);
+		renderer->caster_filter = GTR::CASTERS_STATIC;
+		renderShadowViews(renderer, user_camera, static_x, static_y);
+		static_target->unbind();
+
+		memcpy(static_viewprojections, viewprojections, sizeof(Matrix44) * num_views);
+		static_views = num_views;
+		static_version = PrefabEntity::s_static_version;
+		static_nodes_version = GTR::Node::version;
+		GTR::Profiler::addCounter("static shadow redraws", 1);
+	}
+
+	bool dynamic = renderer->hasDynamicCasters();
+	if (!dynamic && target == this->fbo)
+	{
+		this->shadowMap = static_target->depth_texture;
+		renderer->caster_filter = GTR::CASTERS_ALL;
+		return;
 	}
 
-	this->fbo->unbind();
+	//copy of the static depth with the dynamic casters on top
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, static_target->fbo_id);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target->fbo_id);
+	glBlitFramebuffer(static_x, static_y, static_x + width, static_y + height, x, y, x + width, y + height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-	renderer->shadow = false;
-	glDisable(GL_DEPTH_TEST);
+	if (dynamic)
+	{
+		target->bind();
+		renderer->caster_filter = GTR::CASTERS_DYNAMIC;
+		renderShadowViews(renderer, user_camera, x, y);
+		target->unbind();
+	}
+	renderer->caster_filter = GTR::CASTERS_ALL;
+	this->shadowMap = target->depth_texture;
+}
 
-	float width = fbo->depth_texture->width;
-	float height = fbo->depth_texture->height;
+int Light::getNumShadowViews()
+{
+	if (light_type == lightType::POINT_LIGHT)
+		return 6;
+	return light_type == lightType::DIRECTIONAL && is_cascade ? 4 : 1;
+}
 
-	this->shadowMap = this->fbo->depth_texture;
+//cameras of all the views, the camera of the light ends as the last one
+void Light::setupShadowViews(Camera* user_camera, sShadowViews& views)
+{
+	views.num = getNumShadowViews();
+	for (int i = 0; i < views.num; ++i)
+	{
+		setupShadowView(i, user_camera, views.viewports[i]);
+		views.viewprojections[i] = camera->viewprojection_matrix;
+		memcpy(views.frustums[i], camera->frustum, sizeof(camera->frustum));
+	}
+}
 
+static unsigned int hashCombine(unsigned int hash, unsigned int value)
+{
+	return (hash ^ value) * 16777619u;	//FNV-1a step
 }
 
-void Light::renderSpotShadowMap(GTR::Renderer* renderer)
+//the faces that dont need to be redrawn keep their depth from the previous frames: a face is redrawn when the light or
+//its tile changes, or when the set of casters in its frustum (or the transform of any of them) changes
+void Light::renderCubeShadowMap(GTR::Renderer* renderer, Camera* user_camera, FBO* target, int x, int y)
 {
-	int w = this->fbo->depth_texture->width;
-	int h = this->fbo->depth_texture->height;
+	GTR::Profiler::begin("point light shadows");
+	long draws = Mesh::num_meshes_rendered;
+
+	sShadowViews views;
+	setupShadowViews(user_camera, views);
+	for (int i = 0; i < 6; ++i)
+		shadow_cubemap[i] = views.viewprojections[i];
+
+	Vector3 pos = model.getTranslation();
+	renderer->collectShadowCasters(views, NULL, pos, maxDist);
+
+	unsigned int base = 2166136261u;
+	unsigned int values[] = { (unsigned int)x, (unsigned int)y, (unsigned int)shadow_size, (unsigned int)target->fbo_id,
+		(unsigned int)GTR::Node::version, *(unsigned int*)&pos.x, *(unsigned int*)&pos.y, *(unsigned int*)&pos.z, *(unsigned int*)&maxDist };
+	for (unsigned int value : values)
+		base = hashCombine(base, value);
+
+	unsigned int signatures[6];
+	for (int i = 0; i < 6; ++i)
+		signatures[i] = base;
+	for (sShadowCaster& caster : renderer->shadow_casters)
+		for (int i = 0; i < 6; ++i)
+			if (caster.views & (1 << i))
+			{
+				signatures[i] = hashCombine(signatures[i], (unsigned int)(size_t)caster.entity);
+				signatures[i] = hashCombine(signatures[i], (unsigned int)caster.world_index);
+				signatures[i] = hashCombine(signatures[i], (unsigned int)caster.entity->world_version);
+			}
 
-	this->camera->lookAt(this->model.getTranslation(), 
-		this->model.getTranslation() + this->model.frontVector(),
-		Vector3(0, 1, 0));
+	int dirty = 0;
+	for (int i = 0; i < 6; ++i)
+		if (!renderer->use_shadow_cache || signatures[i] != face_signatures[i])
+			dirty |= 1 << i;
 
-	glClear(GL_DEPTH_BUFFER_BIT);
-	glViewport(0, 0, w, h);
+	if (dirty)
+	{
+		target->bind();
+		glEnable(GL_SCISSOR_TEST);
+		for (int i = 0; i < 6; ++i)
+			if (dirty & (1 << i))
+			{
+				int* viewport = views.viewports[i];
+				glScissor(x + viewport[0], y + viewport[1], viewport[2], viewport[3]);
+				glClear(GL_DEPTH_BUFFER_BIT);
+			}
+		glDisable(GL_SCISSOR_TEST);
+
+		if (!renderer->use_single_pass_shadows || !renderer->renderShadowViewsSinglePass(views, x, y, dirty))
+			for (int i = 0; i < 6; ++i)
+				if (dirty & (1 << i))
+				{
+					int viewport[4];
+					setupShadowView(i, user_camera, viewport);
+					glViewport(x + viewport[0], y + viewport[1], viewport[2], viewport[3]);
+					renderer->renderScene(this->camera);
+				}
+		target->unbind();
+	}
+	memcpy(face_signatures, signatures, sizeof(signatures));
+	this->shadowMap = target->depth_texture;
+
+	int num_dirty = 0;
+	for (int i = 0; i < 6; ++i)
+		num_dirty += (dirty >> i) & 1;
+	GTR::Profiler::addCounter("point shadow faces drawn", num_dirty);
+	GTR::Profiler::addCounter("point shadow faces cached", 6 - num_dirty);
+	GTR::Profiler::addCounter("shadow draw calls", Mesh::num_meshes_rendered - draws);
+	GTR::Profiler::end();
+}
+
+//x, y: corner of the shadowmap inside the target
+void Light::renderShadowViews(GTR::Renderer* renderer, Camera* user_camera, int x, int y)
+{
+	long draws = Mesh::num_meshes_rendered;
+	int num_views = getNumShadowViews();
 
-	for (auto& entity : Scene::getInstance()->prefabEntities)
+	//all the cascades at once, culled with the last cascade which contains the others
+	if (num_views > 1 && renderer->use_single_pass_shadows)
 	{
-		renderer->renderPrefab(entity->model, entity->pPrefab, this->camera);
+		sShadowViews views;
+		setupShadowViews(user_camera, views);
+		renderer->collectShadowCasters(views, this->camera, Vector3(), 0.0f);
+		if (renderer->renderShadowViewsSinglePass(views, x, y, (1 << num_views) - 1))
+		{
+			GTR::Profiler::addCounter("shadow draw calls", Mesh::num_meshes_rendered - draws);
+			return;
+		}
 	}
+
+	for (int i = 0; i < num_views; ++i)
+	{
+		int viewport[4];
+		setupShadowView(i, user_camera, viewport);
+		glViewport(x + viewport[0], y + viewport[1], viewport[2], viewport[3]);
+		renderer->renderScene(this->camera);
+	}
+	GTR::Profiler::addCounter("shadow draw calls", Mesh::num_meshes_rendered - draws);
 }
 
-void Light::renderDirectionalShadowMap(GTR::Renderer* renderer, bool is_cascade, Camera* user_camera)
+//places the camera of the light for one view of the shadowmap (a cascade for directional lights) and returns its viewport
+//relative to the corner of the shadowmap
+void Light::setupShadowView(int view, Camera* user_camera, int* viewport)
 {
+	float texture_width = (float)shadow_size;
+	float texture_height = (float)shadow_size;
+
+	viewport[0] = viewport[1] = 0;
+	viewport[2] = texture_width;
+	viewport[3] = texture_height;
+
+	if (light_type == lightType::SPOT)
+	{
+		this->camera->lookAt(this->model.getTranslation(),
+			this->model.getTranslation() + this->model.frontVector(),
+			Vector3(0, 1, 0));
+		return;
+	}
+
+	if (light_type == lightType::POINT_LIGHT)
+	{
+		//same faces than shadow_cube.inc in the shader atlas, face i goes to column i % 3 and row i / 3
+		static const Vector3 fronts[6] = { Vector3(1, 0, 0), Vector3(-1, 0, 0), Vector3(0, 1, 0), Vector3(0, -1, 0), Vector3(0, 0, 1), Vector3(0, 0, -1) };
+		static const Vector3 ups[6] = { Vector3(0, 1, 0), Vector3(0, 1, 0), Vector3(0, 0, 1), Vector3(0, 0, 1), Vector3(0, 1, 0), Vector3(0, 1, 0) };
+		Vector3 pos = model.getTranslation();
+		this->camera->setPerspective(90, 1, POINT_SHADOW_NEAR, maxDist);
+		this->camera->lookAt(pos, pos + fronts[view], ups[view]);
+
+		viewport[0] = (view % 3) * shadow_size;
+		viewport[1] = (view / 3) * shadow_size;
+		viewport[2] = viewport[3] = shadow_size;
+		return;
+	}
 
-	float texture_width = this->fbo->depth_texture->width;
-	float texture_height = this->fbo->depth_texture->height;
 	float w = cascade_size;
 	float h = cascade_size;
 	float grid;
 
-	glClear(GL_DEPTH_BUFFER_BIT);
-
-	Texture* background = Texture::getWhiteTexture();
 	this->camera->eye = user_camera->center + this->target_vector;
 	this->camera->lookAt(this->camera->eye, user_camera->center, Vector3(0, 1, 0));
 
 	if (!is_cascade)
 	{
-		glViewport(0, 0, texture_width, texture_height);
 		this->camera->setOrthographic(-w , w , -h , h ,
 			this->camera->near_plane, this->camera->far_plane);
 
@@ -270,55 +588,69 @@ void Light::renderDirectionalShadowMap(GTR::Renderer* renderer, bool is_cascade,
 		camera->view_matrix.M[3][0] = round(camera->view_matrix.M[3][0] / grid) * grid;
 
 		this->camera->viewprojection_matrix = camera->view_matrix * camera->projection_matrix;
-
-		for (auto& entity : Scene::getInstance()->prefabEntities)
-		{
-			renderer->renderPrefab(entity->model, entity->pPrefab, this->camera);
-		}
+		this->camera->extractFrustum();	//the culling must use the snapped view
+		return;
 	}
-	else {
 
-		for (int i = 1; i <= 4; i++)
-		{
-			this->camera->setOrthographic(-w * i, w * i, -h * i, h * i,
-				this->camera->near_plane, this->camera->far_plane);
+	int i = view + 1;
+	this->camera->setOrthographic(-w * i, w * i, -h * i, h * i,
+		this->camera->near_plane, this->camera->far_plane);
 
-			this->camera->updateProjectionMatrix();
+	this->camera->updateProjectionMatrix();
 
-			switch (i)
-			{
-			case 1:
-				glViewport(0, 0, texture_width / 2.0f, texture_height / 2.0f);
-				grid = w / (texture_width * 0.5f); break;
-			case 2:
-				glViewport(texture_width / 2.0f, 0, texture_width / 2.0f, texture_height / 2.0f); 
-				grid = (w * 2.0) / (this->fbo->depth_texture->width / 2); break;
-			case 3:
-				glViewport(0, texture_height / 2, texture_width / 2, texture_height / 2); 
-				grid = (w * 3.0) / (this->fbo->depth_texture->width / 2); break;
-			case 4:
-				glViewport(texture_width / 2, texture_height / 2, texture_width / 2, texture_height / 2); 
-				grid = (w * 4.0) / (this->fbo->depth_texture->width / 2); break;
-			default:
-				break;
-			}
+	//each cascade is a quarter of the atlas
+	viewport[0] = (i == 2 || i == 4) ? texture_width / 2 : 0;
+	viewport[1] = (i == 3 || i == 4) ? texture_height / 2 : 0;
+	viewport[2] = texture_width / 2;
+	viewport[3] = texture_height / 2;
 
-			//in order to find the size of each pixel in world coordinates we need to take the width of the frustum
-			//divided by the texture size. Since the texture is an atlas texture we have to divide it by the size of 
-			//each real texture and not the whole texture (in this case just the half of the whole texture since each
-			//texture occupies a quarter of the whole)
-			//once the calculations are done, we round the position of the camera to make it fit into the grid
+	//in order to find the size of each pixel in world coordinates we need to take the width of the frustum
+	//divided by the texture size. Since the texture is an atlas texture we have to divide it by the size of 
+	//each real texture and not the whole texture (in this case just the half of the whole texture since each
+	//texture occupies a quarter of the whole)
+	//once the calculations are done, we round the position of the camera to make it fit into the grid
+	grid = (w * i) / (texture_width * 0.5f);
 
-			camera->view_matrix.M[3][1] = round(camera->view_matrix.M[3][1] / grid) * grid;
-			camera->view_matrix.M[3][0] = round(camera->view_matrix.M[3][0] / grid) * grid;
-			this->camera->viewprojection_matrix = camera->view_matrix * camera->projection_matrix;
+	camera->view_matrix.M[3][1] = round(camera->view_matrix.M[3][1] / grid) * grid;
+	camera->view_matrix.M[3][0] = round(camera->view_matrix.M[3][0] / grid) * grid;
+	this->camera->viewprojection_matrix = camera->view_matrix * camera->projection_matrix;
+	this->camera->extractFrustum();
 
-			this->shadow_viewprojection[i - 1] = camera->viewprojection_matrix;
+	this->shadow_viewprojection[i - 1] = camera->viewprojection_matrix;
+}
 
-			for (auto& entity : Scene::getInstance()->prefabEntities)
-			{
-				renderer->renderPrefab(entity->model, entity->pPrefab, this->camera);
-			}
-		}
+DecalEntity::DecalEntity(const char* texture_filename)
+{
+	entity_type = eType::DECAL;
+	name = "Decal";
+	visible = true;
+	selected = false;
+	this->texture_filename = texture_filename;
+	atlas_slot = -1;
+	atlas_version = -1;
+	opacity = 1.0f;
+}
+
+void DecalEntity::renderInMenu()
+{
+	ImGui::Text("Name: %s", name.c_str());
+	ImGui::Text("Texture: %s", texture_filename.c_str());
+
+	ImGui::Checkbox("Active", &visible);
+	ImGui::SliderFloat("Opacity", &opacity, 0.0f, 1.0f);
+
+	if (ImGui::Button("Select"))
+		Scene::getInstance()->gizmoEntity = this;
+
+	if (ImGui::TreeNode((void*)this, "Model"))
+	{
+		float matrixTranslation[3], matrixRotation[3], matrixScale[3];
+		ImGuizmo::DecomposeMatrixToComponents(model.m, matrixTranslation, matrixRotation, matrixScale);
+		ImGui::DragFloat3("Position", matrixTranslation, 0.1f);
+		ImGui::DragFloat3("Rotation", matrixRotation, 0.1f);
+		ImGui::DragFloat3("Scale", matrixScale, 0.1f);
+		ImGuizmo::RecomposeMatrixFromComponents(matrixTranslation, matrixRotation, matrixScale, model.m);
+
+		ImGui::TreePop();
 	}
-}
\ No newline at end of file
+}
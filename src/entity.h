@@ -9,6 +9,8 @@
 #include "fbo.h"
 #include <iostream>
 
+#define POINT_SHADOW_NEAR 1.0f	//same in shadow_cube.inc
+
 enum lightType {
 	DIRECTIONAL,
 	POINT_LIGHT,
@@ -19,7 +21,8 @@ enum lightType {
 enum eType {
 	BASE_NODE,
 	PREFAB,
-	LIGHT
+	LIGHT,
+	DECAL
 };
 
 class Entity {
@@ -31,8 +34,12 @@ public:
 	std::string name;
 	eType entity_type;
 
+	virtual ~Entity() {}
 	virtual void render(Camera* camera, GTR::Renderer* renderer) = 0;
 	virtual void renderInMenu() = 0;
+
+	//must be called after changing the model from outside (gizmo, menu...)
+	virtual void markDirty() {}
 };
 
 class PrefabEntity : public Entity {
@@ -43,10 +50,36 @@ public:
 	GTR::Prefab* pPrefab;
 	float factor;	//factor for uv coordinates
 
+	//world matrix and box of a node with mesh, shared by all the passes of the frame
+	struct sWorldNode {
+		GTR::Node* node;
+		Matrix44 model;
+		BoundingBox box;
+		bool visible;	//the node and all its parents are visible
+	};
+
+	int world_version;	//incremented every time world_nodes is recomputed
+	bool is_static;	//its shadows are cached, moving it redraws the static shadowmaps of all the lights
+
+	//matrix products of the world transforms, counted per frame
+	static long s_matrix_products;
+	static long s_matrix_products_saved;
+	static int s_static_version;	//changes when a static entity moves or is created
+
 	void render(Camera* camera, GTR::Renderer* renderer);
 	void renderDeferred(Camera* camera, GTR::Renderer* renderer);
 	void renderInMenu();
-	void setPosition(float x, float y, float z) { this->model.translate(x, y, z); }
+	void setPosition(float x, float y, float z) { this->model.translate(x, y, z); markDirty(); }
+	void setModel(const Matrix44& model) { this->model = model; markDirty(); }
+	void markDirty();
+
+	//world transforms of the nodes with mesh, only recomputed if the entity or any node of the prefab changed
+	std::vector<sWorldNode>& getWorldNodes();
+
+private:
+	std::vector<sWorldNode> world_nodes;
+	bool dirty;
+	int nodes_version;	//Node::version when world_nodes was computed
 };
 
 class Light : public Entity {
@@ -67,7 +100,7 @@ public:
 	Mesh* mesh;
 
 	Matrix44 shadow_viewprojection[4];
-	Matrix44 shadow_cubemap[6];
+	Matrix44 shadow_cubemap[6];	//faces of point lights, stored in a 3x2 grid of the shadowmap
 
 	lightType light_type;
 
@@ -76,8 +109,27 @@ public:
 	float innerAngle;
 	float spotExponent;
 
+	//static casters, reused while the shadow cameras, the tile and the static entities dont change.
+	//Lights in the atlas keep them in the same tile of ShadowAtlas::static_fbo, the rest in their own static_fbo
+	FBO* static_fbo;
+	int static_x;
+	int static_y;
+	int static_size;
+	FBO* static_target;	//where they were drawn
+	Matrix44 static_viewprojections[4];
+	int static_views;
+	int static_version;	//PrefabEntity::s_static_version when it was drawn
+	int static_nodes_version;	//Node::version when it was drawn
+
+	//tile in the shared shadow atlas, written by ShadowAtlas::allocate (atlas_size 0 uses its own fbo)
+	int atlas_x;
+	int atlas_y;
+	int atlas_size;
+	Vector4 shadow_rect;	//offset and scale of the shadowmap inside shadowMap, for the shaders
+
 	bool far_directional_shadowmap_updated;
 	bool is_cascade;	//only for directional lights
+	bool cast_shadows;	//lights without shadows never allocate a shadowmap
 	
 	//debug parameters
 	bool show_shadowMap;	//tell if shadow map is being shown
@@ -86,6 +138,7 @@ public:
 
 	//METHODES
 	Light(lightType type_);
+	~Light();	//release its tile of the shadow atlas first (ShadowAtlas::release)
 
 	void render(Camera* camera, GTR::Renderer* renderer) {};
 	void renderInMenu();
@@ -94,10 +147,38 @@ public:
 	void setColor(float r, float g, float b);
 
 	void renderShadowMap(GTR::Renderer* renderer, Camera* user_camera);
+	bool hasShadowMap();
+	int getShadowColumns() { return light_type == lightType::POINT_LIGHT ? 3 : 1; }	//grid of square maps
+	int getShadowRows() { return light_type == lightType::POINT_LIGHT ? 2 : 1; }
 
 private:
-	void renderDirectionalShadowMap(GTR::Renderer* renderer, bool is_cascade, Camera* user_camera);
-	void renderSpotShadowMap(GTR::Renderer* renderer);
+	int shadow_size;	//size of the shadowmap of the light (of one cube face for point lights)
+	Texture* empty_shadowmap;	//shadowMap until the first render, then it points to the depth of an fbo or the atlas
+
+	//the cube faces are only redrawn when their signature (light, tile and casters inside) changes
+	unsigned int face_signatures[6];
+
+	void renderCachedShadowMap(GTR::Renderer* renderer, Camera* user_camera, FBO* target, int x, int y);
+	void renderCubeShadowMap(GTR::Renderer* renderer, Camera* user_camera, FBO* target, int x, int y);
+	int getNumShadowViews();
+	void setupShadowViews(Camera* user_camera, sShadowViews& views);
+	void renderShadowViews(GTR::Renderer* renderer, Camera* user_camera, int x, int y);
+	void setupShadowView(int view, Camera* user_camera, int* viewport);
+};
+
+//box projected along its local Y over the gbuffers, the model maps the box [-1,1] to the world
+class DecalEntity : public Entity {
+public:
+
+	std::string texture_filename;
+	int atlas_slot;	//slot of the texture in the decal atlas, -1 until it is packed the first time it is drawn
+	int atlas_version;	//DecalSystem::atlas_version when atlas_slot was assigned, the slot is looked up again if it changes
+	float opacity;
+
+	DecalEntity(const char* texture_filename);
+
+	void render(Camera* camera, GTR::Renderer* renderer) {};
+	void renderInMenu();
 };
 
 #endif // !ENTITY_H
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "fbo.h"
 #include <cassert>
 #include "utils.h"
+#include "shader.h"
 
 FBO::FBO()
 {
@@ -66,6 +67,7 @@ bool FBO::create( int width, int height, int num_textures, int format, int type,
 	for (int i = 0; i < num_textures; ++i)
 	{
 		Texture* colortex = textures[i] = new Texture(width, height, format, type, false, NULL, internalFormat );
+		Shader::resetStateCache();	//binds outside the shader invalidate its texture table
 		glBindTexture(colortex->texture_type, colortex->texture_id);	//we activate this id to tell opengl we are going to use this texture
 		glTexParameteri(colortex->texture_type, GL_TEXTURE_MAG_FILTER, GL_NEAREST);	//set the min filter
 		glTexParameteri(colortex->texture_type, GL_TEXTURE_MIN_FILTER, GL_NEAREST);   //set the mag filter
@@ -201,15 +203,11 @@ bool FBO::setDepthOnly(int width, int height)
 	glGenFramebuffersEXT(1, &fbo_id);
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo_id);
 
-	glGenRenderbuffersEXT(1, &renderbuffer_color);
-	glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, renderbuffer_color);
-
-	glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_RGBA, width, height);
-	glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER_EXT, renderbuffer_color);
-
-	//create texture
+	//create texture, no color attachment so nothing but depth is written
 	depth_texture = new Texture(width, height, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, false);
 	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_texture->texture_id, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
 
 	GLenum status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
 	if (status != GL_FRAMEBUFFER_COMPLETE_EXT)
@@ -0,0 +1,144 @@
+#include "froxels.h"
+
+#include "camera.h"
+#include "entity.h"
+#include "mesh.h"
+#include "renderer.h"
+#include "shader.h"
+#include "texture.h"
+#include "profiler.h"
+
+using namespace GTR;
+
+FroxelVolume::FroxelVolume()
+{
+	scattering_texture = NULL;
+	integrated_texture = NULL;
+	near_plane = 1.0f;
+	far_plane = 2000.0f;
+	density = 0.0005f;
+	intensity = 0.05f;
+	num_lights = 0;
+	fbo_id = 0;
+}
+
+FroxelVolume::~FroxelVolume()
+{
+	delete scattering_texture;
+	delete integrated_texture;
+	if (fbo_id)
+		glDeleteFramebuffers(1, &fbo_id);
+}
+
+void FroxelVolume::bindSlice(Texture* texture, int slice)
+{
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture->texture_id, 0, slice);
+}
+
+void FroxelVolume::update(Renderer* renderer, Camera* camera, std::vector<Light*>& lights)
+{
+	if (!scattering_texture)
+	{
+		scattering_texture = new Texture();
+		scattering_texture->create3D(FROXELS_X, FROXELS_Y, FROXELS_Z, GL_RGBA, GL_HALF_FLOAT, false, NULL, GL_RGBA16F);
+		integrated_texture = new Texture();
+		integrated_texture->create3D(FROXELS_X, FROXELS_Y, FROXELS_Z, GL_RGBA, GL_HALF_FLOAT, false, NULL, GL_RGBA16F);
+		glGenFramebuffers(1, &fbo_id);
+	}
+
+	std::vector<Light*> scattered;
+	for (Light* light : lights)
+	{
+		if (!light->visible || !light->hasShadowMap() || !light->shadowMap)
+			continue;
+		if (light->light_type != lightType::DIRECTIONAL &&
+			camera->testSphereInFrustum(light->model.getTranslation(), light->maxDist) == CLIP_OUTSIDE)
+			continue;
+		scattered.push_back(light);
+	}
+	num_lights = (int)scattered.size();
+	Profiler::setCounter("froxel lights", num_lights);
+
+	Matrix44 inverse_viewprojection = camera->viewprojection_matrix;
+	inverse_viewprojection.inverse();
+	Vector3 front = (camera->center - camera->eye).normalize();
+	Mesh* quad = Mesh::getQuad();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_id);
+	glPushAttrib(GL_VIEWPORT_BIT);
+	glViewport(0, 0, FROXELS_X, FROXELS_Y);
+	GLenum buffer = GL_COLOR_ATTACHMENT0;
+	glDrawBuffers(1, &buffer);
+	glDisable(GL_DEPTH_TEST);
+
+	//scatter: the lights are added one over the other in every slice
+	Shader* shader = Shader::Get("froxel_scatter");
+	shader->enable();
+	shader->setUniform("u_inverse_viewprojection", inverse_viewprojection);
+	shader->setUniform("u_camera_pos", camera->eye);
+	shader->setUniform("u_camera_front", front);
+	shader->setUniform("u_froxel_near_far", Vector2(near_plane, far_plane));
+	shader->setUniform("u_froxel_size", Vector3(FROXELS_X, FROXELS_Y, FROXELS_Z));
+	shader->setUniform("u_froxel_intensity", intensity);
+	glBlendFunc(GL_ONE, GL_ONE);
+	for (int slice = 0; slice < FROXELS_Z; ++slice)
+	{
+		bindSlice(scattering_texture, slice);
+		float zero[4] = { 0, 0, 0, 0 };
+		glClearBufferfv(GL_COLOR, 0, zero);
+		glEnable(GL_BLEND);
+		shader->setUniform("u_slice", (float)slice);
+		for (Light* light : scattered)
+		{
+			renderer->setLightUniforms(shader, light);
+			quad->render(GL_TRIANGLES);
+		}
+	}
+	shader->disable();
+	glDisable(GL_BLEND);
+
+	//integrate: every froxel walks its column from the camera, the texture cant be read and written in the same pass
+	shader = Shader::Get("froxel_integrate");
+	shader->enable();
+	shader->setUniform("u_scattering_texture", scattering_texture, 0);
+	shader->setUniform("u_inverse_viewprojection", inverse_viewprojection);
+	shader->setUniform("u_camera_pos", camera->eye);
+	shader->setUniform("u_camera_front", front);
+	shader->setUniform("u_froxel_near_far", Vector2(near_plane, far_plane));
+	shader->setUniform("u_froxel_size", Vector3(FROXELS_X, FROXELS_Y, FROXELS_Z));
+	shader->setUniform("u_froxel_density", density);
+	for (int slice = 0; slice < FROXELS_Z; ++slice)
+	{
+		bindSlice(integrated_texture, slice);
+		shader->setUniform("u_slice", (float)slice);
+		quad->render(GL_TRIANGLES);
+	}
+	shader->disable();
+
+	glPopAttrib();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void FroxelVolume::apply(Camera* camera, Texture* depth_texture, const Matrix44& inverse_viewprojection)
+{
+	if (!integrated_texture)
+		return;
+
+	//scene * transmittance + scattered light
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_SRC_ALPHA);
+
+	Shader* shader = Shader::Get("froxel_apply");
+	shader->enable();
+	shader->setUniform("u_depth_texture", depth_texture, 0);
+	shader->setUniform("u_integrated_texture", integrated_texture, 1);
+	shader->setUniform("u_inverse_viewprojection", inverse_viewprojection);
+	shader->setUniform("u_camera_pos", camera->eye);
+	shader->setUniform("u_camera_front", (camera->center - camera->eye).normalize());
+	shader->setUniform("u_froxel_near_far", Vector2(near_plane, far_plane));
+	Mesh::getQuad()->render(GL_TRIANGLES);
+	shader->disable();
+
+	glDisable(GL_BLEND);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "includes.h"
+#include "framework.h"
+#include <vector>
+
+//forward declarations
+class Camera;
+class Texture;
+class Light;
+
+#define FROXELS_X 160
+#define FROXELS_Y 90
+#define FROXELS_Z 64
+
+namespace GTR {
+
+	class Renderer;
+
+	//Camera aligned grid of volume cells (froxels) with the volumetric light of all the shadowed lights.
+	//The depth slices are exponential like the ones of the light clusters. Every frame:
+	// - scatter: every froxel adds the light that reaches its center from every shadowed light (shadowmap test included)
+	// - integrate: front to back along the columns, rgb is the light scattered towards the camera and a the transmittance
+	//Then applying it is one fetch of the integrated texture per pixel, so the cost depends on the grid and not on the screen.
+	class FroxelVolume
+	{
+	public:
+		Texture* scattering_texture;	//light scattered inside every froxel
+		Texture* integrated_texture;	//accumulated from the camera to the far side of every froxel
+
+		float near_plane;
+		float far_plane;	//the volume ends here, anything farther uses the last slice
+		float density;	//extinction of the air per unit of distance
+		float intensity;	//scale of the scattered light
+
+		int num_lights;	//lights scattered in the last update
+
+		FroxelVolume();
+		~FroxelVolume();
+
+		//fills the volume for this camera with the lights that have a shadowmap
+		void update(Renderer* renderer, Camera* camera, std::vector<Light*>& lights);
+
+		//blends the volume over the scene in the current framebuffer using the depth of the gbuffers
+		void apply(Camera* camera, Texture* depth_texture, const Matrix44& inverse_viewprojection);
+
+	private:
+		GLuint fbo_id;	//renders one slice of the 3d textures at a time
+
+		void bindSlice(Texture* texture, int slice);
+	};
+
+};
@@ -0,0 +1,158 @@
+#include "frustumcull.h"
+
+#include <cstring>
+#include <cmath>
+
+#if FRUSTUMCULL_WIDTH >= 8
+	#include <immintrin.h>
+#elif FRUSTUMCULL_WIDTH == 4
+	#include <emmintrin.h>
+#endif
+
+using namespace GTR;
+
+void sBoxesSoA::resize(int count)
+{
+	center_x.resize(count); center_y.resize(count); center_z.resize(count);
+	halfsize_x.resize(count); halfsize_y.resize(count); halfsize_z.resize(count);
+}
+
+void sBoxesSoA::set(int index, const Vector3& center, const Vector3& halfsize)
+{
+	center_x[index] = center.x; center_y[index] = center.y; center_z[index] = center.z;
+	halfsize_x[index] = halfsize.x; halfsize_y[index] = halfsize.y; halfsize_z[index] = halfsize.z;
+}
+
+//outside if the distance to any plane is below minus the projected radius of the box
+static inline bool testBox(const float planes[6][4], const sBoxesSoA& boxes, int i)
+{
+	for (int p = 0; p < 6; ++p)
+	{
+		const float* plane = planes[p];
+		float radius = fabs(plane[0]) * boxes.halfsize_x[i] + fabs(plane[1]) * boxes.halfsize_y[i] + fabs(plane[2]) * boxes.halfsize_z[i];
+		float distance = plane[0] * boxes.center_x[i] + plane[1] * boxes.center_y[i] + plane[2] * boxes.center_z[i] + plane[3];
+		if (distance <= -radius)
+			return false;
+	}
+	return true;
+}
+
+int GTR::cullBoxesScalar(const float planes[6][4], const sBoxesSoA& boxes, int first, int count, uint32_t* visible)
+{
+	memset(visible, 0, ((count + 31) / 32) * sizeof(uint32_t));
+	int num_visible = 0;
+	for (int i = 0; i < count; ++i)
+		if (testBox(planes, boxes, first + i))
+		{
+			visible[i >> 5] |= 1u << (i & 31);
+			num_visible++;
+		}
+	return num_visible;
+}
+
+int GTR::cullBoxesSIMD(const float planes[6][4], const sBoxesSoA& boxes, int first, int count, uint32_t* visible)
+{
+	memset(visible, 0, ((count + 31) / 32) * sizeof(uint32_t));
+	int num_visible = 0;
+	int i = 0;
+	static const int bit_count[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+#if FRUSTUMCULL_WIDTH == 16
+	__m512 plane_n[6][3], plane_abs[6][3], plane_d[6];
+	for (int p = 0; p < 6; ++p)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			plane_n[p][c] = _mm512_set1_ps(planes[p][c]);
+			plane_abs[p][c] = _mm512_set1_ps(fabs(planes[p][c]));
+		}
+		plane_d[p] = _mm512_set1_ps(planes[p][3]);
+	}
+
+	for (; i + 16 <= count; i += 16)
+	{
+		int index = first + i;
+		__m512 cx = _mm512_loadu_ps(&boxes.center_x[index]), cy = _mm512_loadu_ps(&boxes.center_y[index]), cz = _mm512_loadu_ps(&boxes.center_z[index]);
+		__m512 hx = _mm512_loadu_ps(&boxes.halfsize_x[index]), hy = _mm512_loadu_ps(&boxes.halfsize_y[index]), hz = _mm512_loadu_ps(&boxes.halfsize_z[index]);
+		__mmask16 inside = 0xFFFF;
+		for (int p = 0; p < 6; ++p)
+		{
+			__m512 distance = _mm512_fmadd_ps(plane_n[p][0], cx, _mm512_fmadd_ps(plane_n[p][1], cy, _mm512_fmadd_ps(plane_n[p][2], cz, plane_d[p])));
+			__m512 radius = _mm512_fmadd_ps(plane_abs[p][0], hx, _mm512_fmadd_ps(plane_abs[p][1], hy, _mm512_mul_ps(plane_abs[p][2], hz)));
+			inside = _mm512_mask_cmp_ps_mask(inside, _mm512_add_ps(distance, radius), _mm512_setzero_ps(), _CMP_GT_OQ);
+		}
+		uint32_t bits = (uint32_t)inside;
+		visible[i >> 5] |= bits << (i & 31);
+		num_visible += bit_count[bits & 15] + bit_count[(bits >> 4) & 15] + bit_count[(bits >> 8) & 15] + bit_count[bits >> 12];
+	}
+#elif FRUSTUMCULL_WIDTH == 8
+	__m256 plane_n[6][3], plane_abs[6][3], plane_d[6];
+	for (int p = 0; p < 6; ++p)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			plane_n[p][c] = _mm256_set1_ps(planes[p][c]);
+			plane_abs[p][c] = _mm256_set1_ps(fabs(planes[p][c]));
+		}
+		plane_d[p] = _mm256_set1_ps(planes[p][3]);
+	}
+
+	for (; i + 8 <= count; i += 8)
+	{
+		int index = first + i;
+		__m256 cx = _mm256_loadu_ps(&boxes.center_x[index]), cy = _mm256_loadu_ps(&boxes.center_y[index]), cz = _mm256_loadu_ps(&boxes.center_z[index]);
+		__m256 hx = _mm256_loadu_ps(&boxes.halfsize_x[index]), hy = _mm256_loadu_ps(&boxes.halfsize_y[index]), hz = _mm256_loadu_ps(&boxes.halfsize_z[index]);
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int p = 0; p < 6; ++p)
+		{
+			__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(plane_n[p][0], cx), _mm256_mul_ps(plane_n[p][1], cy)),
+				_mm256_add_ps(_mm256_mul_ps(plane_n[p][2], cz), plane_d[p]));
+			__m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(plane_abs[p][0], hx), _mm256_mul_ps(plane_abs[p][1], hy)),
+				_mm256_mul_ps(plane_abs[p][2], hz));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_GT_OQ));
+		}
+		uint32_t bits = (uint32_t)_mm256_movemask_ps(inside);
+		visible[i >> 5] |= bits << (i & 31);
+		num_visible += bit_count[bits & 15] + bit_count[bits >> 4];
+	}
+#elif FRUSTUMCULL_WIDTH == 4
+	__m128 plane_n[6][3], plane_abs[6][3], plane_d[6];
+	for (int p = 0; p < 6; ++p)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			plane_n[p][c] = _mm_set1_ps(planes[p][c]);
+			plane_abs[p][c] = _mm_set1_ps(fabs(planes[p][c]));
+		}
+		plane_d[p] = _mm_set1_ps(planes[p][3]);
+	}
+
+	for (; i + 4 <= count; i += 4)
+	{
+		int index = first + i;
+		__m128 cx = _mm_loadu_ps(&boxes.center_x[index]), cy = _mm_loadu_ps(&boxes.center_y[index]), cz = _mm_loadu_ps(&boxes.center_z[index]);
+		__m128 hx = _mm_loadu_ps(&boxes.halfsize_x[index]), hy = _mm_loadu_ps(&boxes.halfsize_y[index]), hz = _mm_loadu_ps(&boxes.halfsize_z[index]);
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int p = 0; p < 6; ++p)
+		{
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(plane_n[p][0], cx), _mm_mul_ps(plane_n[p][1], cy)),
+				_mm_add_ps(_mm_mul_ps(plane_n[p][2], cz), plane_d[p]));
+			__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(plane_abs[p][0], hx), _mm_mul_ps(plane_abs[p][1], hy)),
+				_mm_mul_ps(plane_abs[p][2], hz));
+			inside = _mm_and_ps(inside, _mm_cmpgt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+		}
+		uint32_t bits = (uint32_t)_mm_movemask_ps(inside);
+		visible[i >> 5] |= bits << (i & 31);
+		num_visible += bit_count[bits];
+	}
+#endif
+
+	//remaining boxes that dont fill a batch
+	for (; i < count; ++i)
+		if (testBox(planes, boxes, first + i))
+		{
+			visible[i >> 5] |= 1u << (i & 31);
+			num_visible++;
+		}
+	return num_visible;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "framework.h"
+#include <vector>
+#include <cstdint>
+
+#if defined(__AVX512F__)
+	#define FRUSTUMCULL_WIDTH 16	//boxes tested per iteration
+#elif defined(__AVX__)
+	#define FRUSTUMCULL_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define FRUSTUMCULL_WIDTH 4
+#else
+	#define FRUSTUMCULL_WIDTH 1
+#endif
+
+namespace GTR {
+
+	//world space boxes in structure of arrays layout, so a batch of boxes can be loaded in one register per component
+	struct sBoxesSoA {
+		std::vector<float> center_x, center_y, center_z;
+		std::vector<float> halfsize_x, halfsize_y, halfsize_z;
+
+		void resize(int count);
+		void set(int index, const Vector3& center, const Vector3& halfsize);
+		int size() const { return (int)center_x.size(); }
+	};
+
+	//Tests the boxes [first, first + count) against the 6 planes of Camera::frustum (same test as Camera::testBoxInFrustum,
+	//overlapping counts as visible). Bit i of the mask is box first + i, the mask must have room for (count + 31) / 32 words.
+	//Returns the number of visible boxes.
+	int cullBoxesScalar(const float planes[6][4], const sBoxesSoA& boxes, int first, int count, uint32_t* visible);
+	int cullBoxesSIMD(const float planes[6][4], const sBoxesSoA& boxes, int first, int count, uint32_t* visible);
+
+};
@@ -0,0 +1,363 @@
+#include "gpuscene.h"
+
+#include "camera.h"
+#include "mesh.h"
+#include "shader.h"
+#include "texture.h"
+#include "prefab.h"
+#include "material.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace GTR;
+
+GPUScene::GPUScene()
+{
+	num_instances = 0;
+	num_visible = 0;
+	use_hiz = true;
+
+	vertices_vbo = indices_vbo = instances_buffer = commands_buffer = stats_buffer = 0;
+	hiz_texture = NULL;
+	hiz_levels = 0;
+	hiz_fbo = 0;
+	hiz_valid = false;
+}
+
+GPUScene::~GPUScene()
+{
+	clear();
+	if (hiz_fbo)
+		glDeleteFramebuffers(1, &hiz_fbo);
+	delete hiz_texture;
+}
+
+bool GPUScene::isSupported()
+{
+	Shader* shader = Shader::Get("gpu_cull");
+	return Shader::isComputeSupported() && shader && shader->compiled;
+}
+
+void GPUScene::clear()
+{
+	GLuint buffers[5] = { vertices_vbo, indices_vbo, instances_buffer, commands_buffer, stats_buffer };
+	for (int i = 0; i < 5; ++i)
+		if (buffers[i])
+			glDeleteBuffers(1, &buffers[i]);
+	vertices_vbo = indices_vbo = instances_buffer = commands_buffer = stats_buffer = 0;
+
+	batches.clear();
+	mesh_ranges.clear();
+	instance_indices.clear();
+	num_instances = 0;
+	num_visible = 0;
+}
+
+void GPUScene::build(std::vector<Matrix44>& models, std::vector<Node*>& nodes, std::vector<bool>& static_nodes)
+{
+	clear();
+
+	//group the instances by material, so every material is one range of commands
+	std::vector<int> order(nodes.size());
+	for (size_t i = 0; i < order.size(); ++i)
+		order[i] = (int)i;
+	std::stable_sort(order.begin(), order.end(), [&nodes](int a, int b) { return nodes[a]->material < nodes[b]->material; });
+
+	std::vector<Mesh::tInterleaved> vertices;
+	std::vector<GLuint> indices;
+	std::vector<sGPUInstance> instances;
+	std::vector<sDrawCommand> commands;
+	instance_indices.assign(nodes.size(), -1);
+
+	for (int index : order)
+	{
+		Node* node = nodes[index];
+		Mesh* mesh = node->mesh;
+		int num_vertices = mesh->getNumVertices();
+		if (!num_vertices)
+			continue;
+
+		//store every mesh once, non indexed meshes get sequential indices
+		auto it = mesh_ranges.find(mesh);
+		if (it == mesh_ranges.end())
+		{
+			sMeshRange range;
+			range.first_index = (int)indices.size();
+			range.base_vertex = (int)vertices.size();
+
+			for (int i = 0; i < num_vertices; ++i)
+			{
+				Mesh::tInterleaved vertex;
+				if (mesh->interleaved.size())
+					vertex = mesh->interleaved[i];
+				else
+				{
+					vertex.vertex = mesh->vertices[i];
+					vertex.normal = mesh->normals.size() ? mesh->normals[i] : Vector3(0, 1, 0);
+					vertex.uv = mesh->uvs.size() ? mesh->uvs[i] : Vector2(0, 0);
+				}
+				vertices.push_back(vertex);
+			}
+
+			if (mesh->indices.size())
+				for (size_t i = 0; i < mesh->indices.size(); ++i)
+				{
+					indices.push_back(mesh->indices[i].x);
+					indices.push_back(mesh->indices[i].y);
+					indices.push_back(mesh->indices[i].z);
+				}
+			else
+				for (int i = 0; i < num_vertices; ++i)
+					indices.push_back(i);
+
+			range.num_indices = (int)indices.size() - range.first_index;
+			it = mesh_ranges.insert(std::make_pair(mesh, range)).first;
+		}
+
+		if (batches.empty() || batches.back().material != node->material)
+		{
+			sGPUBatch batch;
+			batch.material = node->material;
+			batch.first_command = (int)commands.size();
+			batch.num_commands = 0;
+			batches.push_back(batch);
+		}
+		batches.back().num_commands++;
+
+		BoundingBox box = transformBoundingBox(models[index], mesh->box);
+		sGPUInstance instance;
+		instance.model = models[index];
+		instance.center = Vector4(box.center.x, box.center.y, box.center.z, 1.0f);
+		instance.halfsize = Vector4(box.halfsize.x, box.halfsize.y, box.halfsize.z, static_nodes[index] ? 1.0f : 0.0f);
+
+		//base_instance selects the model of the per instance attribute
+		sDrawCommand command;
+		command.count = it->second.num_indices;
+		command.instance_count = 1;
+		command.first_index = it->second.first_index;
+		command.base_vertex = it->second.base_vertex;
+		command.base_instance = (GLuint)instances.size();
+
+		instance_indices[index] = (int)instances.size();
+		instances.push_back(instance);
+		commands.push_back(command);
+	}
+
+	num_instances = (int)instances.size();
+	if (!num_instances)
+		return;
+
+	glGenBuffers(1, &vertices_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vertices_vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Mesh::tInterleaved), &vertices[0], GL_STATIC_DRAW);
+
+	//the instances are read by the compute shader and used as vertex attribute
+	glGenBuffers(1, &instances_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, instances_buffer);
+	glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(sGPUInstance), &instances[0], GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glGenBuffers(1, &indices_vbo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	glGenBuffers(1, &commands_buffer);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands_buffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(sDrawCommand), &commands[0], GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	GLuint zero = 0;
+	glGenBuffers(1, &stats_buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, stats_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), &zero, GL_DYNAMIC_READ);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	std::cout << " + GPU scene: " << num_instances << " instances, " << mesh_ranges.size() << " meshes, " << batches.size() << " batches" << std::endl;
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+void GPUScene::cull(Camera* camera, bool test_hiz, int caster_filter)
+{
+	Shader* shader = Shader::Get("gpu_cull");
+	if (!num_instances || !shader || !shader->compiled)
+		return;
+
+	//result of the previous cull, it is finished by now so it doesnt stall
+	GLuint visible = 0;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, stats_buffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &visible);
+	num_visible = (int)visible;
+	visible = 0;
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &visible);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instances_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commands_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, stats_buffer);
+
+	shader->enable();
+	shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
+	shader->setUniform("u_num_instances", num_instances);
+	shader->setUniform("u_caster_filter", caster_filter);
+	bool hiz = use_hiz && test_hiz && hiz_valid;
+	shader->setUniform("u_use_hiz", hiz);
+	if (hiz)
+	{
+		shader->setUniform("u_hiz_viewprojection", hiz_viewprojection);
+		shader->setUniform("u_hiz_texture", hiz_texture, 0);
+		shader->setUniform("u_hiz_size", Vector2((float)hiz_texture->width, (float)hiz_texture->height));
+		shader->setUniform("u_hiz_levels", hiz_levels);
+	}
+
+	glDispatchCompute((num_instances + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+	shader->disable();
+
+	for (int i = 0; i < 3; ++i)
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, 0);
+}
+
+void GPUScene::updateInstance(int index, const Matrix44& model, const BoundingBox& box, bool is_static)
+{
+	int instance_index = instance_indices[index];
+	if (instance_index == -1)
+		return;
+
+	sGPUInstance instance;
+	instance.model = model;
+	instance.center = Vector4(box.center.x, box.center.y, box.center.z, 1.0f);
+	instance.halfsize = Vector4(box.halfsize.x, box.halfsize.y, box.halfsize.z, is_static ? 1.0f : 0.0f);
+	glBindBuffer(GL_ARRAY_BUFFER, instances_buffer);
+	glBufferSubData(GL_ARRAY_BUFFER, instance_index * sizeof(sGPUInstance), sizeof(sGPUInstance), &instance);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void GPUScene::buildHiZ(Texture* depth_texture, const Matrix44& viewprojection)
+{
+	Shader* shader = Shader::Get("hiz");
+	if (!shader || !depth_texture)
+		return;
+
+	int width = depth_texture->width;
+	int height = depth_texture->height;
+
+	//full chain down to 1x1, level 0 is a copy of the depth so every level can be read with the same sampler
+	if (!hiz_texture || hiz_texture->width != width || hiz_texture->height != height)
+	{
+		delete hiz_texture;
+		hiz_texture = new Texture(width, height, GL_RED, GL_FLOAT, false, NULL, GL_R32F);
+		hiz_levels = 1 + (int)floor(log2((float)std::max(width, height)));
+
+		hiz_texture->bind();
+		for (int level = 1; level < hiz_levels; ++level)
+			glTexImage2D(GL_TEXTURE_2D, level, GL_R32F, std::max(1, width >> level), std::max(1, height >> level), 0, GL_RED, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		hiz_texture->unbind();
+
+		if (!hiz_fbo)
+			glGenFramebuffers(1, &hiz_fbo);
+	}
+
+	GLint previous_fbo = 0;
+	GLint previous_viewport[4];
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous_fbo);
+	glGetIntegerv(GL_VIEWPORT, previous_viewport);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, hiz_fbo);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+	glDisable(GL_CULL_FACE);
+
+	Mesh* quad = Mesh::getQuad();
+	shader->enable();
+	for (int level = 0; level < hiz_levels; ++level)
+	{
+		int level_width = std::max(1, width >> level);
+		int level_height = std::max(1, height >> level);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, hiz_texture->texture_id, level);
+		glViewport(0, 0, level_width, level_height);
+
+		//only the source level can be sampled, the destination level is attached to the fbo
+		Texture* source = level ? hiz_texture : depth_texture;
+		if (level)
+		{
+			hiz_texture->bind();
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+		}
+		shader->setUniform("u_texture", source, 0);
+		shader->setUniform("u_level", level ? level - 1 : 0);
+		shader->setUniform("u_reduce", level > 0);
+		quad->render(GL_TRIANGLES);
+	}
+	shader->disable();
+
+	hiz_texture->bind();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, hiz_levels - 1);
+	hiz_texture->unbind();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, previous_fbo);
+	glViewport(previous_viewport[0], previous_viewport[1], previous_viewport[2], previous_viewport[3]);
+
+	hiz_viewprojection = viewprojection;
+	hiz_valid = true;
+}
+
+void GPUScene::enableBuffers(Shader* shader)
+{
+	attrib_locations.clear();
+
+	glBindBuffer(GL_ARRAY_BUFFER, vertices_vbo);
+	int stride = sizeof(Mesh::tInterleaved);
+	const char* names[3] = { "a_vertex", "a_normal", "a_uv" };
+	int sizes[3] = { 3, 3, 2 };
+	int offsets[3] = { 0, sizeof(Vector3), sizeof(Vector3) * 2 };
+	for (int i = 0; i < 3; ++i)
+	{
+		int location = shader->getAttribLocation(names[i]);
+		if (location == -1)
+			continue;
+		glEnableVertexAttribArray(location);
+		glVertexAttribPointer(location, sizes[i], GL_FLOAT, GL_FALSE, stride, (void*)(size_t)offsets[i]);
+		attrib_locations.push_back(location);
+	}
+
+	//mat4 are 4 vec4 attributes, base_instance of every command picks the model
+	int model_location = shader->getAttribLocation("u_model");
+	assert(model_location != -1 && "shader must have attribute mat4 u_model (not a uniform)");
+	glBindBuffer(GL_ARRAY_BUFFER, instances_buffer);
+	for (int k = 0; model_location != -1 && k < 4; ++k)
+	{
+		glEnableVertexAttribArray(model_location + k);
+		glVertexAttribPointer(model_location + k, 4, GL_FLOAT, GL_FALSE, sizeof(sGPUInstance), (void*)(sizeof(float) * 4 * k));
+		glVertexAttribDivisor(model_location + k, 1);
+		attrib_locations.push_back(model_location + k);
+	}
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands_buffer);
+}
+
+void GPUScene::drawBatch(int index)
+{
+	sGPUBatch& batch = batches[index];
+	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(batch.first_command * sizeof(sDrawCommand)), batch.num_commands, 0);
+}
+
+void GPUScene::disableBuffers()
+{
+	for (int location : attrib_locations)
+	{
+		glVertexAttribDivisor(location, 0);
+		glDisableVertexAttribArray(location);
+	}
+	attrib_locations.clear();
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "framework.h"
+#include "includes.h"
+#include <vector>
+#include <map>
+
+//forward declarations
+class Camera;
+class Mesh;
+class Shader;
+class Texture;
+
+#define GPU_CULL_GROUP_SIZE 64	//must match local_size_x of gpu_cull.cs
+
+namespace GTR {
+
+	class Material;
+	class Node;
+
+	//instance data read by the culling shader, the model is also the per instance attribute of the draw (std430 layout)
+	struct sGPUInstance {
+		Matrix44 model;
+		Vector4 center;	//world space bounding box
+		Vector4 halfsize;	//w is 1 for the static casters, read by the caster filter of the cull
+	};
+
+	//same layout as the DrawElementsIndirectCommand of GL
+	struct sDrawCommand {
+		GLuint count;
+		GLuint instance_count;	//written by the culling shader: 1 visible, 0 culled
+		GLuint first_index;
+		GLint base_vertex;
+		GLuint base_instance;
+	};
+
+	//commands that share material, submitted with one glMultiDrawElementsIndirect
+	struct sGPUBatch {
+		Material* material;
+		int first_command;
+		int num_commands;
+	};
+
+	//GPU driven path: the meshes of all the prefabs are stored in a shared vertex and index buffer,
+	//a compute shader culls every instance (frustum + Hi-Z occlusion with the depth of the previous frame)
+	//writing the indirect commands, and each material is drawn with a single multi draw call.
+	//The shadow views use the same buffers, culled with the frustum of the light and drawn with a depth only shader.
+	//The meshes and materials are fixed when it is built, moving a node only rewrites its instance (updateInstance).
+	class GPUScene
+	{
+	public:
+		std::vector<sGPUBatch> batches;
+		int num_instances;
+		std::vector<int> instance_indices;	//instance of every node passed to build, -1 if its mesh was empty
+		int num_visible;	//read back from the previous cull, only for stats
+		bool use_hiz;
+
+		GPUScene();
+		~GPUScene();
+
+		static bool isSupported();
+
+		void build(std::vector<Matrix44>& models, std::vector<Node*>& nodes, std::vector<bool>& static_nodes);
+		bool isBuilt() { return num_instances > 0; }
+		void clear();
+
+		//new transform of the node passed to build at position index, box in world space
+		void updateInstance(int index, const Matrix44& model, const BoundingBox& box, bool is_static);
+
+		//writes the indirect commands for this camera, hiz only if the pyramid was built from a camera close to this one.
+		//caster_filter is an eCasterFilter of the renderer, the instances that dont pass it are culled
+		void cull(Camera* camera, bool test_hiz, int caster_filter = 0);
+
+		//builds the max depth pyramid used by the occlusion test of the next frame
+		void buildHiZ(Texture* depth_texture, const Matrix44& viewprojection);
+
+		void enableBuffers(Shader* shader);
+		void drawBatch(int index);
+		void disableBuffers();
+
+	private:
+		GLuint vertices_vbo;
+		GLuint indices_vbo;
+		GLuint instances_buffer;
+		GLuint commands_buffer;
+		GLuint stats_buffer;
+		std::vector<int> attrib_locations;	//enabled by enableBuffers
+
+		Texture* hiz_texture;
+		int hiz_levels;
+		GLuint hiz_fbo;
+		Matrix44 hiz_viewprojection;
+		bool hiz_valid;
+
+		//where every mesh is stored inside the shared buffers
+		struct sMeshRange {
+			int first_index;
+			int num_indices;
+			int base_vertex;
+		};
+		std::map<Mesh*, sMeshRange> mesh_ranges;
+	};
+
+};
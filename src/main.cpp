@@ -39,9 +39,10 @@ SDL_Window* createWindow(const char* caption, int width, int height, bool fullsc
 	SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 8);
 
 #ifndef __APPLE__
-	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
-	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
-	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+	//4.3 enables compute shaders (gpu culling), compatibility because the framework still uses fixed pipeline calls
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_COMPATIBILITY);
 #endif
     
 	//antialiasing (disable this lines if it goes too slow)
@@ -63,6 +64,15 @@ SDL_Window* createWindow(const char* caption, int width, int height, bool fullsc
   
 	// Create an OpenGL context associated with the window.
 	glcontext = SDL_GL_CreateContext(sdl_window);
+#ifndef __APPLE__
+	if (!glcontext) //old drivers, the features that need 4.3 will be disabled
+	{
+		SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+		SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
+		SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+		glcontext = SDL_GL_CreateContext(sdl_window);
+	}
+#endif
 
 	//in case of exit, call SDL_Quit()
 	atexit(SDL_Quit);
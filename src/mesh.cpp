@@ -32,6 +32,7 @@ Mesh::Mesh()
 {
 	radius = 0;
 	vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = bones_vbo_id = weights_vbo_id = 0;
+	uvs1_vbo_id = positions_vbo_id = 0;
 	collision_model = NULL;
 	clear();
 }
@@ -63,9 +64,11 @@ void Mesh::clear()
 		glDeleteBuffersARB(1, &weights_vbo_id);
 	if (uvs1_vbo_id)
 		glDeleteBuffersARB(1, &uvs1_vbo_id);
+	if (positions_vbo_id)
+		glDeleteBuffersARB(1, &positions_vbo_id);
 
 	//VBOs ids
-	vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = weights_vbo_id = bones_vbo_id = uvs1_vbo_id = 0;
+	vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = weights_vbo_id = bones_vbo_id = uvs1_vbo_id = positions_vbo_id = 0;
 
 	//buffers
 	vertices.clear();
@@ -242,6 +245,35 @@ void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 	disableBuffers(shader);
 }
 
+//depth only passes: the positions come from a tightly packed buffer and no other attribute is bound
+void Mesh::renderPositions(unsigned int primitive, int num_instances)
+{
+	Shader* shader = Shader::current;
+	if (!shader || !shader->compiled)
+	{
+		assert(0 && "no shader or shader not compiled or enabled");
+		return;
+	}
+
+	GLuint vbo_id = interleaved.size() ? positions_vbo_id : vertices_vbo_id;
+	if (!vbo_id)	//not uploaded yet
+	{
+		render(primitive, -1, num_instances);
+		return;
+	}
+
+	vertex_location = shader->getAttribLocation("a_vertex");
+	assert(vertex_location != -1 && "No a_vertex found in shader");
+	glEnableVertexAttribArray(vertex_location);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_id);
+	glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+	drawCall(primitive, -1, num_instances);
+
+	glDisableVertexAttribArray(vertex_location);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
 void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
 {
 	int start = 0; //in primitives
@@ -266,7 +298,7 @@ void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
 		{
 			assert(indices_vbo_id && "indices must be uploaded to the GPU");
 			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-			glDrawElementsInstanced(primitive, size * 3, GL_UNSIGNED_INT, (void*)(start + sizeof(Vector3)), num_instances);
+			glDrawElementsInstanced(primitive, size * 3, GL_UNSIGNED_INT, (void*)(start * sizeof(Vector3)), num_instances);
 			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 		}
 		else
@@ -307,7 +339,7 @@ void Mesh::disableBuffers(Shader* shader)
 GLuint instances_buffer_id = 0;
 
 //should be faster but in some system it is slower
-void Mesh::renderInstanced(unsigned int primitive, const Matrix44* instanced_models, int num_instances)
+void Mesh::renderInstanced(unsigned int primitive, const Matrix44* instanced_models, int num_instances, bool positions_only)
 {
 	if (!num_instances)
 		return;
@@ -335,8 +367,11 @@ void Mesh::renderInstanced(unsigned int primitive, const Matrix44* instanced_mod
 		glVertexAttribDivisor(attribLocation + k, 1); // This makes it instanced!
 	}
 
-	//regular render
-	render(primitive, 0, num_instances);
+	//regular render, or only a_vertex for depth passes
+	if (positions_only)
+		renderPositions(primitive, num_instances);
+	else
+		render(primitive, -1, num_instances);
 
 	//disable instanced attribs
 	for (int k = 0; k < 4; ++k)
@@ -450,6 +485,15 @@ void Mesh::uploadToVRAM()
 			glGenBuffersARB(1, &interleaved_vbo_id);
 		glBindBufferARB(GL_ARRAY_BUFFER_ARB, interleaved_vbo_id);
 		glBufferDataARB(GL_ARRAY_BUFFER_ARB, interleaved.size() * sizeof(tInterleaved), &interleaved[0], GL_STATIC_DRAW_ARB);
+
+		// Positions alone, the shadow passes dont need to fetch normals and uvs
+		std::vector<Vector3> positions(interleaved.size());
+		for (int i = 0; i < interleaved.size(); ++i)
+			positions[i] = interleaved[i].vertex;
+		if (positions_vbo_id == 0)
+			glGenBuffersARB(1, &positions_vbo_id);
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB, positions_vbo_id);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, positions.size() * sizeof(Vector3), &positions[0], GL_STATIC_DRAW_ARB);
 	}
 	else
 	{
@@ -1262,6 +1306,80 @@ void Mesh::createCube()
 	radius = (float)box.halfsize.length();
 }
 
+void Mesh::createSphere(float radius, int slices, int stacks)
+{
+	vertices.clear();
+	normals.clear();
+	uvs.clear();
+	colors.clear();
+
+	for (int i = 0; i < stacks; ++i)
+		for (int j = 0; j < slices; ++j)
+		{
+			float theta0 = PI * i / (float)stacks;
+			float theta1 = PI * (i + 1) / (float)stacks;
+			float phi0 = 2.0f * PI * j / (float)slices;
+			float phi1 = 2.0f * PI * (j + 1) / (float)slices;
+
+			Vector3 a(sin(theta0) * cos(phi0), cos(theta0), sin(theta0) * sin(phi0));
+			Vector3 b(sin(theta1) * cos(phi0), cos(theta1), sin(theta1) * sin(phi0));
+			Vector3 c(sin(theta1) * cos(phi1), cos(theta1), sin(theta1) * sin(phi1));
+			Vector3 d(sin(theta0) * cos(phi1), cos(theta0), sin(theta0) * sin(phi1));
+
+			//counter clockwise seen from outside
+			Vector3 quad[6] = { a, c, b, a, d, c };
+			for (int k = 0; k < 6; ++k)
+			{
+				vertices.push_back(quad[k] * radius);
+				normals.push_back(quad[k]);
+			}
+		}
+
+	box.center.set(0, 0, 0);
+	box.halfsize.set(radius, radius, radius);
+	this->radius = radius;
+}
+
+void Mesh::createCone(int slices)
+{
+	vertices.clear();
+	normals.clear();
+	uvs.clear();
+	colors.clear();
+
+	Vector3 apex(0, 0, 0);
+	Vector3 center(0, 0, 1);
+
+	for (int j = 0; j < slices; ++j)
+	{
+		float phi0 = 2.0f * PI * j / (float)slices;
+		float phi1 = 2.0f * PI * (j + 1) / (float)slices;
+		Vector3 p0(cos(phi0), sin(phi0), 1);
+		Vector3 p1(cos(phi1), sin(phi1), 1);
+
+		//side
+		vertices.push_back(apex);
+		vertices.push_back(p1);
+		vertices.push_back(p0);
+		Vector3 n = Vector3(p0.x + p1.x, p0.y + p1.y, -2.0f).normalize();
+		normals.push_back(n);
+		normals.push_back(n);
+		normals.push_back(n);
+
+		//cap
+		vertices.push_back(center);
+		vertices.push_back(p0);
+		vertices.push_back(p1);
+		normals.push_back(Vector3(0, 0, 1));
+		normals.push_back(Vector3(0, 0, 1));
+		normals.push_back(Vector3(0, 0, 1));
+	}
+
+	box.center.set(0, 0, 0.5);
+	box.halfsize.set(1, 1, 0.5);
+	radius = (float)box.halfsize.length();
+}
+
 void Mesh::createWireBox()
 {
 	const float _verts[] = { -1,-1,-1,  1,-1,-1,  -1,1,-1,  1,1,-1, -1,-1,1,  1,-1,1, -1,1,1,  1,1,1,    -1,-1,-1, -1,1,-1, 1,-1,-1, 1,1,-1, -1,-1,1, -1,1,1, 1,-1,1, 1,1,1,   -1,-1,-1, -1,-1,1, 1,-1,-1, 1,-1,1, -1,1,-1, -1,1,1, 1,1,-1, 1,1,1 };
@@ -79,6 +79,7 @@ public:
 	unsigned int bones_vbo_id;
 	unsigned int weights_vbo_id;
 	unsigned int uvs1_vbo_id;
+	unsigned int positions_vbo_id;	//only the positions of the interleaved vertices, for depth only passes
 
 	Mesh();
 	~Mesh();
@@ -86,7 +87,8 @@ public:
 	void clear();
 
 	void render( unsigned int primitive, int submesh_id = -1, int num_instances = 0 );
-	void renderInstanced(unsigned int primitive, const Matrix44* instanced_models, int number);
+	void renderInstanced(unsigned int primitive, const Matrix44* instanced_models, int number, bool positions_only = false);
+	void renderPositions(unsigned int primitive, int num_instances = 0);	//binds only a_vertex
 	void renderBounding( const Matrix44& model, bool world_bounding = true );
 	void renderFixedPipeline(int primitive); //sloooooooow
 	//void renderAnimated(unsigned int primitive, Skeleton *sk);
@@ -117,6 +119,8 @@ public:
 	void createPlane(float size);
 	void createSubdividedPlane(float size = 1, int subdivisions = 256, bool centered = false);
 	void createCube();
+	void createSphere(float radius, int slices = 16, int stacks = 12);
+	void createCone(int slices = 16); //apex at the origin, base of radius 1 at z = 1
 	void createWireBox();
 	void createGrid(float dist);
 	void displace(Image* heightmap, float altitude);
@@ -0,0 +1,301 @@
+#include "occlusion.h"
+
+#include <algorithm>
+#include <thread>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define OCCLUSION_SSE
+	#include <emmintrin.h>
+#endif
+
+using namespace GTR;
+
+#define OCCLUSION_NEAR_W 0.0001f	//triangles with a vertex closer than this are not rasterized (no clipping)
+
+//a * b with the same convention as Matrix44::operator*, done here so this file doesnt need the framework.cpp
+static void multiplyMatrices(const float* a, const float* b, float* result)
+{
+	for (int i = 0; i < 4; ++i)
+		for (int j = 0; j < 4; ++j)
+			result[i * 4 + j] = a[i * 4] * b[j] + a[i * 4 + 1] * b[4 + j] + a[i * 4 + 2] * b[8 + j] + a[i * 4 + 3] * b[12 + j];
+}
+
+static inline void transformPoint(const float* m, float x, float y, float z, float* clip)
+{
+	clip[0] = m[0] * x + m[4] * y + m[8] * z + m[12];
+	clip[1] = m[1] * x + m[5] * y + m[9] * z + m[13];
+	clip[2] = m[2] * x + m[6] * y + m[10] * z + m[14];
+	clip[3] = m[3] * x + m[7] * y + m[11] * z + m[15];
+}
+
+void OcclusionCuller::sTriangleList::clear()
+{
+	for (int i = 0; i < 3; ++i)
+	{
+		x[i].clear();
+		y[i].clear();
+		z[i].clear();
+	}
+}
+
+void OcclusionCuller::sTriangleList::add(const float* v0, const float* v1, const float* v2)
+{
+	const float* v[3] = { v0, v1, v2 };
+	for (int i = 0; i < 3; ++i)
+	{
+		x[i].push_back(v[i][0]);
+		y[i].push_back(v[i][1]);
+		z[i].push_back(v[i][2]);
+	}
+}
+
+OcclusionCuller::OcclusionCuller(int width, int height)
+{
+	this->width = width;
+	this->height = height;
+	pitch = (width + 3) & ~3;
+	depth.resize(pitch * height, 1.0f);
+
+	num_threads = std::max(1, std::min((int)std::thread::hardware_concurrency(), OCCLUSION_MAX_THREADS));
+	num_triangles = num_tested = num_culled = 0;
+}
+
+void OcclusionCuller::setViewProjection(const Matrix44& viewprojection)
+{
+	this->viewprojection = viewprojection;
+}
+
+void OcclusionCuller::addOccluder(const Matrix44& model, const float* positions, int stride, int num_vertices, const unsigned int* indices, int num_indices)
+{
+	sOccluder occluder;
+	occluder.model = model;
+	occluder.positions = positions;
+	occluder.stride = stride;
+	occluder.num_vertices = num_vertices;
+	occluder.indices = indices;
+	occluder.num_indices = indices ? num_indices : num_vertices;
+	occluders.push_back(occluder);
+}
+
+//transforms the triangles of some occluders to screen space
+void OcclusionCuller::setupOccluders(int first, int last, sTriangleList& list)
+{
+	list.clear();
+	std::vector<float> screen;	//x, y, z, w per vertex (w < 0 means behind the near plane)
+
+	for (int i = first; i < last; ++i)
+	{
+		sOccluder& occluder = occluders[i];
+		float mvp[16];
+		multiplyMatrices(occluder.model.m, viewprojection.m, mvp);
+
+		screen.resize(occluder.num_vertices * 4);
+		const unsigned char* data = (const unsigned char*)occluder.positions;
+		for (int j = 0; j < occluder.num_vertices; ++j)
+		{
+			const float* pos = (const float*)(data + j * occluder.stride);
+			float* v = &screen[j * 4];
+			float clip[4];
+			transformPoint(mvp, pos[0], pos[1], pos[2], clip);
+			if (clip[3] < OCCLUSION_NEAR_W || clip[2] < -clip[3])
+			{
+				v[3] = -1.0f;
+				continue;
+			}
+			float inv_w = 1.0f / clip[3];
+			v[0] = (clip[0] * inv_w * 0.5f + 0.5f) * width;
+			v[1] = (clip[1] * inv_w * 0.5f + 0.5f) * height;
+			v[2] = clip[2] * inv_w * 0.5f + 0.5f;
+			v[3] = 1.0f;
+		}
+
+		for (int j = 0; j + 2 < occluder.num_indices; j += 3)
+		{
+			const float* v[3];
+			bool valid = true;
+			for (int k = 0; k < 3; ++k)
+			{
+				int index = occluder.indices ? occluder.indices[j + k] : j + k;
+				v[k] = &screen[index * 4];
+				valid = valid && v[k][3] > 0.0f;
+			}
+			if (!valid)
+				continue;	//crosses the near plane, skipping it is conservative
+
+			//completely outside of the screen
+			if ((v[0][0] < 0 && v[1][0] < 0 && v[2][0] < 0) || (v[0][0] > width && v[1][0] > width && v[2][0] > width) ||
+				(v[0][1] < 0 && v[1][1] < 0 && v[2][1] < 0) || (v[0][1] > height && v[1][1] > height && v[2][1] > height))
+				continue;
+
+			list.add(v[0], v[1], v[2]);
+		}
+	}
+}
+
+//every thread owns a band of rows, so they never write the same pixels
+void OcclusionCuller::rasterizeBand(int min_y, int max_y)
+{
+	for (int t = 0; t < num_threads; ++t)
+	{
+		sTriangleList& list = triangle_lists[t];
+		for (int i = 0; i < list.size(); ++i)
+		{
+			float x0 = list.x[0][i], y0 = list.y[0][i], z0 = list.z[0][i];
+			float x1 = list.x[1][i], y1 = list.y[1][i], z1 = list.z[1][i];
+			float x2 = list.x[2][i], y2 = list.y[2][i], z2 = list.z[2][i];
+
+			float area = (x1 - x0) * (y2 - y0) - (y1 - y0) * (x2 - x0);
+			if (fabs(area) < 1e-6f)
+				continue;
+			if (area < 0.0f)	//occluders are two sided
+			{
+				std::swap(x1, x2); std::swap(y1, y2); std::swap(z1, z2);
+				area = -area;
+			}
+
+			int start_y = std::max(min_y, (int)floor(std::min(y0, std::min(y1, y2))));
+			int end_y = std::min(max_y - 1, (int)ceil(std::max(y0, std::max(y1, y2))));
+			int start_x = std::max(0, (int)floor(std::min(x0, std::min(x1, x2)))) & ~3;
+			int end_x = std::min(width - 1, (int)ceil(std::max(x0, std::max(x1, x2))));
+			if (start_y > end_y || start_x > end_x)
+				continue;
+
+			//edge functions E(p) = A * x + B * y + C, positive inside
+			float A0 = y0 - y1, B0 = x1 - x0, C0 = (y1 - y0) * x0 - (x1 - x0) * y0;
+			float A1 = y1 - y2, B1 = x2 - x1, C1 = (y2 - y1) * x1 - (x2 - x1) * y1;
+			float A2 = y2 - y0, B2 = x0 - x2, C2 = (y0 - y2) * x2 - (x0 - x2) * y2;
+
+			//depth plane
+			float inv_area = 1.0f / area;
+			float dzdx = ((z1 - z0) * (y2 - y0) - (z2 - z0) * (y1 - y0)) * inv_area;
+			float dzdy = ((z2 - z0) * (x1 - x0) - (z1 - z0) * (x2 - x0)) * inv_area;
+			float zC = z0 - dzdx * x0 - dzdy * y0;
+
+#ifdef OCCLUSION_SSE
+			__m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+			__m128 zero = _mm_setzero_ps();
+			__m128 a0 = _mm_set1_ps(A0), a1 = _mm_set1_ps(A1), a2 = _mm_set1_ps(A2), za = _mm_set1_ps(dzdx);
+			for (int y = start_y; y <= end_y; ++y)
+			{
+				float py = y + 0.5f;
+				__m128 row0 = _mm_set1_ps(B0 * py + C0);
+				__m128 row1 = _mm_set1_ps(B1 * py + C1);
+				__m128 row2 = _mm_set1_ps(B2 * py + C2);
+				__m128 rowz = _mm_set1_ps(dzdy * py + zC);
+				float* row = &depth[y * pitch];
+				for (int x = start_x; x <= end_x; x += 4)
+				{
+					__m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+					__m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), row0);
+					__m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), row1);
+					__m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), row2);
+					__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+					if (!_mm_movemask_ps(inside))
+						continue;
+					__m128 z = _mm_add_ps(_mm_mul_ps(za, px), rowz);
+					__m128 old = _mm_loadu_ps(row + x);
+					__m128 nearest = _mm_min_ps(old, z);
+					_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+				}
+			}
+#else
+			for (int y = start_y; y <= end_y; ++y)
+			{
+				float py = y + 0.5f;
+				float* row = &depth[y * pitch];
+				for (int x = start_x; x <= end_x; ++x)
+				{
+					float px = x + 0.5f;
+					if (A0 * px + B0 * py + C0 < 0.0f || A1 * px + B1 * py + C1 < 0.0f || A2 * px + B2 * py + C2 < 0.0f)
+						continue;
+					row[x] = std::min(row[x], dzdx * px + dzdy * py + zC);
+				}
+			}
+#endif
+		}
+	}
+}
+
+void OcclusionCuller::render()
+{
+	std::fill(depth.begin(), depth.end(), 1.0f);
+	num_tested = num_culled = 0;
+
+	//setup: the occluders are split between the threads
+	int chunk = ((int)occluders.size() + num_threads - 1) / num_threads;
+	std::vector<std::thread> workers;
+	for (int t = 1; t < num_threads; ++t)
+		workers.push_back(std::thread(&OcclusionCuller::setupOccluders, this, std::min(t * chunk, (int)occluders.size()),
+			std::min((t + 1) * chunk, (int)occluders.size()), std::ref(triangle_lists[t])));
+	setupOccluders(0, std::min(chunk, (int)occluders.size()), triangle_lists[0]);
+	for (std::thread& worker : workers)
+		worker.join();
+	workers.clear();
+
+	num_triangles = 0;
+	for (int t = 0; t < num_threads; ++t)
+		num_triangles += triangle_lists[t].size();
+
+	//raster: every thread fills a band of rows
+	int band = (height + num_threads - 1) / num_threads;
+	for (int t = 1; t < num_threads; ++t)
+		workers.push_back(std::thread(&OcclusionCuller::rasterizeBand, this, std::min(t * band, height), std::min((t + 1) * band, height)));
+	rasterizeBand(0, std::min(band, height));
+	for (std::thread& worker : workers)
+		worker.join();
+
+	occluders.clear();
+}
+
+bool OcclusionCuller::isVisible(const BoundingBox& box)
+{
+	num_tested++;
+
+	//screen rect and nearest depth of the box
+	float min_x = 1e10f, min_y = 1e10f, min_z = 1e10f;
+	float max_x = -1e10f, max_y = -1e10f;
+	for (int i = 0; i < 8; ++i)
+	{
+		float clip[4];
+		transformPoint(viewprojection.m,
+			box.center.x + (i & 1 ? box.halfsize.x : -box.halfsize.x),
+			box.center.y + (i & 2 ? box.halfsize.y : -box.halfsize.y),
+			box.center.z + (i & 4 ? box.halfsize.z : -box.halfsize.z), clip);
+		if (clip[3] < OCCLUSION_NEAR_W)
+			return true;	//crosses the near plane
+		float inv_w = 1.0f / clip[3];
+		float x = (clip[0] * inv_w * 0.5f + 0.5f) * width;
+		float y = (clip[1] * inv_w * 0.5f + 0.5f) * height;
+		min_x = std::min(min_x, x); max_x = std::max(max_x, x);
+		min_y = std::min(min_y, y); max_y = std::max(max_y, y);
+		min_z = std::min(min_z, clip[2] * inv_w * 0.5f + 0.5f);
+	}
+
+	if (min_z <= 0.0f || max_x < 0.0f || max_y < 0.0f || min_x > width || min_y > height)
+		return true;
+
+	//one extra pixel around, the occluders were only sampled at the pixel centers
+	int start_x = std::max(0, (int)floor(min_x) - 1) & ~3;
+	int end_x = std::min(width - 1, (int)ceil(max_x) + 1);
+	int start_y = std::max(0, (int)floor(min_y) - 1);
+	int end_y = std::min(height - 1, (int)ceil(max_y) + 1);
+
+	for (int y = start_y; y <= end_y; ++y)
+	{
+		const float* row = &depth[y * pitch];
+#ifdef OCCLUSION_SSE
+		__m128 box_depth = _mm_set1_ps(min_z);
+		for (int x = start_x; x <= end_x; x += 4)
+			if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), box_depth)))
+				return true;
+#else
+		for (int x = start_x; x <= end_x; ++x)
+			if (row[x] >= min_z)
+				return true;
+#endif
+	}
+
+	num_culled++;
+	return false;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "framework.h"
+#include <vector>
+
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+#define OCCLUSION_MAX_THREADS 8
+
+namespace GTR {
+
+	//triangles of one occluder, the data is not copied so it must be alive until render() is done
+	struct sOccluder {
+		Matrix44 model;
+		const float* positions;	//xyz of the first vertex
+		int stride;	//bytes between vertices
+		int num_vertices;
+		const unsigned int* indices;	//NULL if not indexed
+		int num_indices;
+	};
+
+	//Software occlusion culling: the big meshes of the scene are rasterized on the CPU (SSE, 4 pixels per step)
+	//into a small depth buffer, then the bounding boxes are tested against it before drawing.
+	//It only depends on the math of the framework so it can run without GL (see benchmarks/occlusion_benchmark.cpp).
+	class OcclusionCuller
+	{
+	public:
+		int width;
+		int height;
+		int pitch;	//floats per row, multiple of 4
+		int num_threads;
+		std::vector<float> depth;	//ndc depth in [0,1], 1 is empty
+
+		std::vector<sOccluder> occluders;
+
+		//stats
+		int num_triangles;	//rasterized in the last render
+		int num_tested;
+		int num_culled;
+
+		OcclusionCuller(int width = OCCLUSION_WIDTH, int height = OCCLUSION_HEIGHT);
+
+		void setViewProjection(const Matrix44& viewprojection);
+		void addOccluder(const Matrix44& model, const float* positions, int stride, int num_vertices, const unsigned int* indices = NULL, int num_indices = 0);
+
+		//clears the buffer and rasterizes all the occluders added since the last render
+		void render();
+
+		//false if the box (world space) is completely behind the occluders
+		bool isVisible(const BoundingBox& box);
+
+	private:
+		Matrix44 viewprojection;
+
+		//screen space triangles in SoA, one list per thread of the setup stage
+		struct sTriangleList {
+			std::vector<float> x[3];
+			std::vector<float> y[3];
+			std::vector<float> z[3];
+			void clear();
+			void add(const float* v0, const float* v1, const float* v2);
+			int size() const { return (int)x[0].size(); }
+		};
+		sTriangleList triangle_lists[OCCLUSION_MAX_THREADS];
+
+		void setupOccluders(int first, int last, sTriangleList& list);
+		void rasterizeBand(int min_y, int max_y);
+	};
+
+};
@@ -15,6 +15,8 @@
 
 using namespace GTR;
 
+int Node::version = 0;
+
 Node::Node() : parent(NULL), mesh(NULL), material(NULL), visible(true), layers(0xFF)
 {
 
@@ -32,6 +34,11 @@ Node::~Node()
 	}
 }
 
+void Node::markDirty()
+{
+	version++;
+}
+
 BoundingBox Node::getBoundingBox()
 {
 	aabb.center.set(0, 0, 0);
@@ -50,7 +57,10 @@ void Node::renderInMenu()
 	ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(0.75f, 0.75f, 0.75f, 1.0f));
 
 	//Model edit
+	Matrix44 old_model = model;
 	ImGuiMatrix44(model, "Model");
+	if (memcmp(old_model.m, model.m, sizeof(model.m)))
+		markDirty();
 
 	//Material
 	if (material && ImGui::TreeNode(material, "Material"))
@@ -125,6 +135,69 @@ Node* Prefab::getNodeByName(const char* name)
 	return NULL;
 }
 
+sFlatPrefab& Prefab::getFlat()
+{
+	if (flat_version != Node::version)
+		compile();
+	return flat;
+}
+
+static void flattenNode(sFlatPrefab& flat, Node* node, int parent, std::map<Mesh*, int>& mesh_ids, std::map<Material*, int>& material_ids)
+{
+	int index = flat.size();
+	flat.parent.push_back(parent);
+	flat.local.push_back(node->model);
+	flat.nodes.push_back(node);
+	flat.visible.push_back(node->visible && (parent == -1 || flat.visible[parent]));
+
+	int mesh = -1;
+	if (node->mesh)
+	{
+		auto it = mesh_ids.find(node->mesh);
+		if (it == mesh_ids.end())
+		{
+			mesh = mesh_ids[node->mesh] = (int)flat.meshes.size();
+			flat.meshes.push_back(node->mesh);
+		}
+		else
+			mesh = it->second;
+	}
+	flat.mesh.push_back(mesh);
+	flat.bounds.push_back(node->mesh ? node->mesh->box : BoundingBox());
+
+	int material = -1;
+	if (node->material)
+	{
+		auto it = material_ids.find(node->material);
+		if (it == material_ids.end())
+		{
+			material = material_ids[node->material] = (int)flat.materials.size();
+			flat.materials.push_back(node->material);
+		}
+		else
+			material = it->second;
+	}
+	flat.material.push_back(material);
+
+	for (int i = 0; i < node->children.size(); ++i)
+		flattenNode(flat, node->children[i], index, mesh_ids, material_ids);
+}
+
+void Prefab::compile()
+{
+	flat = sFlatPrefab();
+	std::map<Mesh*, int> mesh_ids;
+	std::map<Material*, int> material_ids;
+	flattenNode(flat, &root, -1, mesh_ids, material_ids);
+
+	//parents go first, so the global matrices are computed in one pass
+	flat.global.resize(flat.size());
+	for (int i = 0; i < flat.size(); ++i)
+		flat.global[i] = flat.parent[i] == -1 ? flat.local[i] : flat.local[i] * flat.global[flat.parent[i]];
+
+	flat_version = Node::version;
+}
+
 void updateInDepth(std::map<std::string, GTR::Node*>& container, GTR::Node* node)
 {
 	if (node->name.size())
@@ -29,6 +29,8 @@ namespace GTR {
 
 		BoundingBox aabb; //node bounding box in world space
 
+		static int version;	//incremented every time a node is marked dirty, entities use it to refresh their cache
+
 		//info to create the tree
 		Node* parent;
 		std::vector<Node*> children;
@@ -45,7 +47,11 @@ namespace GTR {
 		void renderInMenu();
 
 		//add node to children list
-		void addChild(Node* child) { assert(child->parent == NULL);  children.push_back(child); child->parent = this; }
+		void addChild(Node* child) { assert(child->parent == NULL);  children.push_back(child); child->parent = this; child->markDirty(); }
+
+		//changes the local matrix, the entities using the prefab will recompute their world transforms
+		void setModel(const Matrix44& model) { this->model = model; markDirty(); }
+		void markDirty();
 
 		//compute the global matrix taking into account its parent
 		Matrix44 getGlobalMatrix(bool fast = false) { 
@@ -57,6 +63,24 @@ namespace GTR {
 		}
 	};
 
+	//compiled form of a prefab to traverse it without chasing pointers:
+	//one entry per node in arrays, in depth first order so the parents are always before their children
+	struct sFlatPrefab {
+		std::vector<int> parent;	//-1 for the root
+		std::vector<Matrix44> local;
+		std::vector<Matrix44> global;	//relative to the prefab
+		std::vector<int> mesh;	//index in meshes, -1 if the node has no mesh
+		std::vector<int> material;	//index in materials, -1 if the node has no material
+		std::vector<BoundingBox> bounds;	//of the mesh, in node space
+		std::vector<char> visible;	//the node and all its parents are visible
+		std::vector<Node*> nodes;	//source node in the tree
+
+		std::vector<Mesh*> meshes;
+		std::vector<Material*> materials;
+
+		int size() const { return (int)parent.size(); }
+	};
+
 	//a Prefab represent a set of objects in a tree structure
 	//used to load info from GLTF files
 	class Prefab
@@ -69,6 +93,13 @@ namespace GTR {
 		Node root;
 		BoundingBox bounding;
 
+		//the tree is the editable source, the flat version is recompiled when any node changes
+		sFlatPrefab flat;
+		int flat_version = -1;	//Node::version when it was compiled
+
+		sFlatPrefab& getFlat();
+		void compile();
+
 		//dtor
 		virtual ~Prefab();
 
@@ -0,0 +1,190 @@
+#include "prefilter.h"
+
+#include "mesh.h"
+#include "renderer.h"
+#include "shader.h"
+#include "texture.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#define PREFILTER_CACHE_VERSION 2	//2: the environment is filtered from its first level only
+
+//header of the cache files, the cache is computed again if any value doesnt match
+struct sPrefilterHeader {
+	char type[4];	//"GGX" or "LUT"
+	int size;
+	int levels;
+	int samples;
+	int version;	//PREFILTER_CACHE_VERSION, changes when the way it is computed changes
+};
+
+static bool readCache(const char* filename, const sPrefilterHeader& expected, std::vector<float>& data)
+{
+	FILE* f = fopen(filename, "rb");
+	if (!f)
+		return false;
+
+	sPrefilterHeader header;
+	bool valid = fread(&header, sizeof(header), 1, f) == 1 && memcmp(&header, &expected, sizeof(header)) == 0 &&
+		fread(&data[0], sizeof(float), data.size(), f) == data.size();
+	fclose(f);
+	return valid;
+}
+
+static void writeCache(const char* filename, const sPrefilterHeader& header, std::vector<float>& data)
+{
+	FILE* f = fopen(filename, "wb");
+	if (!f)
+	{
+		std::cout << " * Cannot write cache file: " << filename << std::endl;
+		return;
+	}
+	fwrite(&header, sizeof(header), 1, f);
+	fwrite(&data[0], sizeof(float), data.size(), f);
+	fclose(f);
+}
+
+//floats of all the faces of all the levels of the prefiltered environment (RGBA)
+static int getPrefilteredFloats()
+{
+	int total = 0;
+	for (int level = 0; level < PREFILTER_LEVELS; ++level)
+		total += (PREFILTER_SIZE >> level) * (PREFILTER_SIZE >> level) * 4 * 6;
+	return total;
+}
+
+void GTR::prefilterCubemap(Texture* source, Texture* destination, int layer, int samples)
+{
+	Shader* shader = Shader::Get("prefilter");
+	if (!shader)
+		return;
+
+	GLuint fbo_id;
+	glGenFramebuffers(1, &fbo_id);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_id);
+	GLenum buffer = GL_COLOR_ATTACHMENT0;
+	glDrawBuffers(1, &buffer);
+	glPushAttrib(GL_VIEWPORT_BIT);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+
+	Mesh* quad = Mesh::getQuad();
+	shader->enable();
+	shader->setUniform("u_texture", source, 0);
+	shader->setUniform("u_source_size", source->width);
+	shader->setUniform("u_samples", samples);
+
+	for (int level = 0; level < PREFILTER_LEVELS; ++level)
+	{
+		int size = ((int)destination->width) >> level;
+		glViewport(0, 0, size, size);
+		shader->setUniform("u_roughness", level / (float)(PREFILTER_LEVELS - 1));
+		for (int face = 0; face < 6; ++face)
+		{
+			if (destination->texture_type == GL_TEXTURE_CUBE_MAP_ARRAY)
+				glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, destination->texture_id, level, layer * 6 + face);
+			else
+				glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, destination->texture_id, level);
+			shader->setUniform("u_face", face);
+			quad->render(GL_TRIANGLES);
+		}
+	}
+	shader->disable();
+
+	glPopAttrib();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &fbo_id);
+}
+
+Texture* GTR::loadPrefilteredEnvironment(const char* hdre_filename, const char* cache_filename)
+{
+	sPrefilterHeader header = { "GGX", PREFILTER_SIZE, PREFILTER_LEVELS, PREFILTER_SAMPLES, PREFILTER_CACHE_VERSION };
+	std::vector<float> data(getPrefilteredFloats());
+	bool cached = readCache(cache_filename, header, data);
+
+	//only the levels of the convolution, the sampler never reads further
+	Texture* texture = new Texture();
+	texture->createCubemap(PREFILTER_SIZE, PREFILTER_SIZE, NULL, GL_RGBA, GL_FLOAT, true, GL_RGBA16F);
+	float* level_data = &data[0];
+	for (int level = 0; level < PREFILTER_LEVELS; ++level)
+	{
+		int size = PREFILTER_SIZE >> level;
+		float* faces[6];
+		for (int face = 0; face < 6; ++face)
+			faces[face] = level_data + size * size * 4 * face;
+		texture->uploadCubemap(GL_RGBA, GL_FLOAT, false, cached ? (Uint8**)faces : NULL, GL_RGBA16F, level);
+		level_data += size * size * 4 * 6;
+	}
+	texture->bind();
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, PREFILTER_LEVELS - 1);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+	if (cached)
+		return texture;
+
+	Texture* source = CubemapFromHDRE(hdre_filename, false);
+	if (!source)
+		return texture;
+	std::cout << " + Prefiltering environment: " << cache_filename << std::endl;
+	prefilterCubemap(source, texture);
+	delete source;
+
+	//read it back to save it next to the environment
+	level_data = &data[0];
+	texture->bind();
+	for (int level = 0; level < PREFILTER_LEVELS; ++level)
+	{
+		int size = PREFILTER_SIZE >> level;
+		for (int face = 0; face < 6; ++face)
+		{
+			glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGBA, GL_FLOAT, level_data);
+			level_data += size * size * 4;
+		}
+	}
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	writeCache(cache_filename, header, data);
+	return texture;
+}
+
+Texture* GTR::loadBRDFLUT(const char* cache_filename)
+{
+	sPrefilterHeader header = { "LUT", BRDF_LUT_SIZE, 1, PREFILTER_SAMPLES, PREFILTER_CACHE_VERSION };
+	std::vector<float> data(BRDF_LUT_SIZE * BRDF_LUT_SIZE * 2);
+	if (readCache(cache_filename, header, data))
+		return new Texture(BRDF_LUT_SIZE, BRDF_LUT_SIZE, GL_RG, GL_FLOAT, false, (Uint8*)&data[0], GL_RG16F);
+
+	Texture* texture = new Texture(BRDF_LUT_SIZE, BRDF_LUT_SIZE, GL_RG, GL_FLOAT, false, NULL, GL_RG16F);
+	Shader* shader = Shader::Get("brdf_lut");
+	if (!shader)
+		return texture;
+
+	std::cout << " + Baking BRDF table: " << cache_filename << std::endl;
+	GLuint fbo_id;
+	glGenFramebuffers(1, &fbo_id);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_id);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture->texture_id, 0);
+	GLenum buffer = GL_COLOR_ATTACHMENT0;
+	glDrawBuffers(1, &buffer);
+	glPushAttrib(GL_VIEWPORT_BIT);
+	glViewport(0, 0, BRDF_LUT_SIZE, BRDF_LUT_SIZE);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+
+	shader->enable();
+	shader->setUniform("u_samples", PREFILTER_SAMPLES);
+	Mesh::getQuad()->render(GL_TRIANGLES);
+	shader->disable();
+
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glReadPixels(0, 0, BRDF_LUT_SIZE, BRDF_LUT_SIZE, GL_RG, GL_FLOAT, &data[0]);
+	glPopAttrib();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &fbo_id);
+
+	writeCache(cache_filename, header, data);
+	return texture;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "includes.h"
+#include "framework.h"
+
+//forward declarations
+class Texture;
+
+#define PREFILTER_SIZE 256	//size of the faces of level 0 of the prefiltered environment
+#define PREFILTER_LEVELS 6	//level i is convolved with roughness i / (PREFILTER_LEVELS - 1), same in reflection.fs
+#define PREFILTER_SAMPLES 256	//ggx samples per texel, the environment is only filtered once
+#define BRDF_LUT_SIZE 128
+
+namespace GTR {
+
+	//Specular image based lighting with the split sum approximation:
+	// - the cubemaps are convolved with the GGX lobe of a different roughness in every mip level
+	// - a 2D table (NdotV, roughness) stores the scale and bias that the BRDF applies to F0
+	//so a glossy reflection is one fetch of the right level plus one lookup of the table.
+
+	//GGX convolution of source (a cubemap with mipmaps, they are read to remove the noise of the samples)
+	//into the first PREFILTER_LEVELS levels of destination, a cubemap or the cubemap layer of a cubemap array
+	void prefilterCubemap(Texture* source, Texture* destination, int layer = 0, int samples = PREFILTER_SAMPLES);
+
+	//prefiltered version of an HDRE environment, loaded from cache_filename or computed and saved there.
+	//The source is only its first level with box filtered mipmaps, the other levels of the file are already blurred
+	Texture* loadPrefilteredEnvironment(const char* hdre_filename, const char* cache_filename);
+
+	//split sum table (RG16F), loaded from cache_filename or baked and saved there
+	Texture* loadBRDFLUT(const char* cache_filename);
+
+};
@@ -0,0 +1,191 @@
+#include "probes.h"
+
+#include "camera.h"
+#include "renderer.h"
+#include "scene.h"
+#include "shader.h"
+#include "texture.h"
+#include "sphericalharmonics.h"
+#include "prefilter.h"
+
+using namespace GTR;
+
+ReflectionProbes::ReflectionProbes()
+{
+	cubemap_array = NULL;
+	capture_cubemap = NULL;
+	faces_per_frame = 1;
+	faces_rendered = 0;
+	frame = 0;
+	fbo_id = 0;
+	depth_renderbuffer = 0;
+	current = NULL;
+}
+
+ReflectionProbes::~ReflectionProbes()
+{
+	for (sReflectionProbe* probe : probes)
+		delete probe;
+	delete cubemap_array;
+	delete capture_cubemap;
+	if (fbo_id)
+		glDeleteFramebuffers(1, &fbo_id);
+	if (depth_renderbuffer)
+		glDeleteRenderbuffers(1, &depth_renderbuffer);
+}
+
+bool ReflectionProbes::isSupported()
+{
+	static int supported = -1;	//the version of the context doesnt change
+	if (supported == -1)
+	{
+		GLint major = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		supported = major >= 4 ? 1 : 0;
+	}
+	return supported == 1;
+}
+
+sReflectionProbe* ReflectionProbes::addProbe(const Vector3& pos, const Vector3& extents)
+{
+	if (probes.size() >= MAX_REFLECTION_PROBES || !isSupported())
+		return NULL;
+
+	if (!cubemap_array)
+	{
+		cubemap_array = new Texture();
+		cubemap_array->createCubemapArray(REFLECTION_PROBE_SIZE, REFLECTION_PROBE_SIZE, MAX_REFLECTION_PROBES, GL_RGBA, GL_UNSIGNED_BYTE, true, GL_RGBA8);
+		cubemap_array->bind();
+		glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAX_LEVEL, PREFILTER_LEVELS - 1);
+		glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, 0);
+		capture_cubemap = new Texture();
+		capture_cubemap->createCubemap(REFLECTION_PROBE_SIZE, REFLECTION_PROBE_SIZE, NULL, GL_RGBA, GL_UNSIGNED_BYTE, true, GL_RGBA8);
+
+		glGenFramebuffers(1, &fbo_id);
+		glGenRenderbuffers(1, &depth_renderbuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, depth_renderbuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, REFLECTION_PROBE_SIZE, REFLECTION_PROBE_SIZE);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo_id);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_renderbuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	sReflectionProbe* probe = new sReflectionProbe;
+	probe->pos = pos;
+	probe->extents = extents;
+	probe->index = (int)probes.size();
+	probes.push_back(probe);
+	return probe;
+}
+
+void ReflectionProbes::renderFace(Renderer* renderer, sReflectionProbe* probe, int face)
+{
+	Camera cam;
+	cam.setPerspective(90, 1, 0.1f, REFLECTION_PROBE_FAR);
+	cam.lookAt(probe->pos, probe->pos + cubemapFaceNormals[face][2], cubemapFaceNormals[face][1]);
+	cam.enable();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_id);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, capture_cubemap->texture_id, 0);
+	GLenum buffer = GL_COLOR_ATTACHMENT0;
+	glDrawBuffers(1, &buffer);
+	glPushAttrib(GL_VIEWPORT_BIT);
+	glViewport(0, 0, REFLECTION_PROBE_SIZE, REFLECTION_PROBE_SIZE);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	Scene::getInstance()->render(&cam, renderer);
+
+	glPopAttrib();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+//the array keeps the previous capture of the probe until the six new faces are ready
+void ReflectionProbes::finishCapture(sReflectionProbe* probe)
+{
+	capture_cubemap->generateMipmaps();	//read by the prefilter to remove the noise of the samples
+	prefilterCubemap(capture_cubemap, cubemap_array, probe->index, REFLECTION_PROBE_SAMPLES);
+	probe->next_face = 0;
+	probe->last_capture = frame;
+}
+
+sReflectionProbe* ReflectionProbes::pickProbe(Camera* camera)
+{
+	sReflectionProbe* best = NULL;
+	float best_priority = 0.0f;
+	for (sReflectionProbe* probe : probes)
+	{
+		float age = probe->last_capture == -1 ? 1e10f : (float)(frame - probe->last_capture);
+		float priority = age / (1.0f + camera->eye.distance(probe->pos) / REFLECTION_PROBE_DISTANCE_SCALE);
+		if (priority > best_priority)
+		{
+			best = probe;
+			best_priority = priority;
+		}
+	}
+	return best;
+}
+
+void ReflectionProbes::update(Renderer* renderer, Camera* camera)
+{
+	frame++;
+	faces_rendered = 0;
+	if (!cubemap_array)
+		return;
+
+	while (faces_rendered < faces_per_frame)
+	{
+		if (!current)
+			current = pickProbe(camera);
+		if (!current)
+			break;
+
+		renderFace(renderer, current, current->next_face++);
+		faces_rendered++;
+
+		if (current->next_face == 6)
+		{
+			finishCapture(current);
+			current = NULL;
+		}
+	}
+
+	if (faces_rendered)
+		camera->enable();
+}
+
+void ReflectionProbes::captureAll(Renderer* renderer)
+{
+	if (!cubemap_array)
+		return;
+
+	Camera* camera = Camera::current;
+	for (sReflectionProbe* probe : probes)
+	{
+		for (int face = 0; face < 6; ++face)
+			renderFace(renderer, probe, face);
+		finishCapture(probe);
+	}
+	current = NULL;
+	if (camera)
+		camera->enable();
+}
+
+void ReflectionProbes::setUniforms(Shader* shader, int first_slot)
+{
+	Vector3 positions[MAX_REFLECTION_PROBES];
+	Vector3 extents[MAX_REFLECTION_PROBES];
+	int num_probes = (int)probes.size();
+	for (sReflectionProbe* probe : probes)
+	{
+		positions[probe->index] = probe->pos;
+		extents[probe->index] = probe->last_capture == -1 ? Vector3() : probe->extents;	//an empty box until it is captured
+	}
+
+	shader->setUniform("u_probes_texture", cubemap_array ? cubemap_array : Texture::getBlackTexture(), first_slot);
+	shader->setUniform("u_num_probes", num_probes);
+	if (num_probes)
+	{
+		shader->setUniform3Array("u_probe_pos", (float*)positions, num_probes);
+		shader->setUniform3Array("u_probe_extents", (float*)extents, num_probes);
+	}
+}
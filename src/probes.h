@@ -0,0 +1,69 @@
+#pragma once
+
+#include "includes.h"
+#include "framework.h"
+#include <vector>
+
+//forward declarations
+class Camera;
+class Texture;
+class Shader;
+struct sReflectionProbe;
+
+#define MAX_REFLECTION_PROBES 16	//same in reflection.fs
+#define REFLECTION_PROBE_SIZE 256	//size of every cube face
+#define REFLECTION_PROBE_FAR 1000.0f
+#define REFLECTION_PROBE_DISTANCE_SCALE 200.0f	//a probe this far from the camera is refreshed half as often as one next to it
+#define REFLECTION_PROBE_SAMPLES 32	//ggx samples per texel when prefiltering a capture, it happens at runtime
+
+namespace GTR {
+
+	class Renderer;
+
+	//Reflection probes stored in one cubemap array (a cubemap per probe), so the reflection pass can choose per pixel
+	//between all of them using their influence boxes.
+	//The captures are amortized: every frame the scheduler renders at most faces_per_frame faces, finishing the probe in
+	//progress before starting the one with the highest priority (frames since its last capture weighted by its distance
+	//to the camera). Probes never captured go first.
+	//The faces are rendered to a capture cubemap and, once the six are done, prefiltered with GGX into the levels of the
+	//array, so the reflection pass reads the roughness of every pixel from one mip (see prefilter.h).
+	class ReflectionProbes
+	{
+	public:
+		std::vector<sReflectionProbe*> probes;	//probes[i] uses the cubemap i of the array
+		Texture* cubemap_array;	//prefiltered, level i has roughness i / (PREFILTER_LEVELS - 1)
+		Texture* capture_cubemap;	//faces of the probe in progress
+
+		int faces_per_frame;	//budget of the scheduler, 0 stops the updates
+		int faces_rendered;	//in the last update
+		long frame;	//updates done, used to know how outdated a probe is
+
+		ReflectionProbes();
+		~ReflectionProbes();
+
+		//cubemap arrays need GL 4.0, without them there are no probes and the reflections only use the environment
+		static bool isSupported();
+
+		//probe with its influence box (half size), NULL when all the cubemaps of the array are in use or not supported
+		sReflectionProbe* addProbe(const Vector3& pos, const Vector3& extents);
+
+		//renders the faces of this frame and enables the camera again
+		void update(Renderer* renderer, Camera* camera);
+
+		//renders all the faces of all the probes now
+		void captureAll(Renderer* renderer);
+
+		//array, positions and boxes of the probes for the reflection pass (uses first_slot)
+		void setUniforms(Shader* shader, int first_slot);
+
+	private:
+		GLuint fbo_id;	//one face of the capture cubemap at a time
+		GLuint depth_renderbuffer;
+		sReflectionProbe* current;	//probe whose capture is in progress
+
+		sReflectionProbe* pickProbe(Camera* camera);
+		void renderFace(Renderer* renderer, sReflectionProbe* probe, int face);
+		void finishCapture(sReflectionProbe* probe);
+	};
+
+};
@@ -0,0 +1,130 @@
+#include "profiler.h"
+
+#include <cassert>
+
+using namespace GTR;
+
+bool Profiler::enabled = true;
+std::map<std::string, sProfilerSection*> Profiler::sections;
+std::vector<std::string> Profiler::order;
+std::vector<sProfilerSection*> Profiler::stack;
+std::map<std::string, long> Profiler::counters;
+
+void Profiler::begin(const char* name)
+{
+	if (!enabled)
+		return;
+
+	sProfilerSection* section = NULL;
+	auto it = sections.find(name);
+	if (it == sections.end())
+	{
+		section = new sProfilerSection();
+		section->name = name;
+		section->pending = false;
+		section->gpu_ms = section->cpu_ms = 0.0;
+		glGenQueries(2, section->queries);
+		sections[name] = section;
+		order.push_back(name);
+	}
+	else
+		section = it->second;
+
+	//read the result of the previous frame if it is ready
+	if (section->pending)
+	{
+		GLint available = 0;
+		glGetQueryObjectiv(section->queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available)
+		{
+			GLuint64 start_time = 0, end_time = 0;
+			glGetQueryObjectui64v(section->queries[0], GL_QUERY_RESULT, &start_time);
+			glGetQueryObjectui64v(section->queries[1], GL_QUERY_RESULT, &end_time);
+			double ms = (end_time - start_time) * 0.000001;
+			section->gpu_ms = section->gpu_ms * 0.9 + ms * 0.1; //smooth it a little
+			section->pending = false;
+		}
+	}
+
+	//only issue new queries when the old ones have been consumed
+	if (!section->pending)
+		glQueryCounter(section->queries[0], GL_TIMESTAMP);
+
+	section->cpu_start = std::chrono::high_resolution_clock::now();
+	stack.push_back(section);
+}
+
+void Profiler::end()
+{
+	if (!enabled || stack.empty())
+		return;
+
+	sProfilerSection* section = stack.back();
+	stack.pop_back();
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - section->cpu_start;
+	section->cpu_ms = section->cpu_ms * 0.9 + elapsed.count() * 0.1;
+
+	if (!section->pending)
+	{
+		glQueryCounter(section->queries[1], GL_TIMESTAMP);
+		section->pending = true;
+	}
+}
+
+void Profiler::setCounter(const char* name, long value)
+{
+	counters[name] = value;
+}
+
+void Profiler::addCounter(const char* name, long value)
+{
+	counters[name] += value;
+}
+
+long Profiler::getCounter(const char* name)
+{
+	auto it = counters.find(name);
+	return it != counters.end() ? it->second : 0;
+}
+
+void Profiler::resetCounters()
+{
+	for (auto& it : counters)
+		it.second = 0;
+}
+
+double Profiler::getGPUTime(const char* name)
+{
+	auto it = sections.find(name);
+	return it != sections.end() ? it->second->gpu_ms : 0.0;
+}
+
+double Profiler::getCPUTime(const char* name)
+{
+	auto it = sections.find(name);
+	return it != sections.end() ? it->second->cpu_ms : 0.0;
+}
+
+void Profiler::renderInMenu()
+{
+#ifndef SKIP_IMGUI
+	ImGui::Checkbox("Enabled", &enabled);
+
+	ImGui::Columns(3, "profiler_sections");
+	ImGui::Text("Section"); ImGui::NextColumn();
+	ImGui::Text("GPU ms"); ImGui::NextColumn();
+	ImGui::Text("CPU ms"); ImGui::NextColumn();
+	for (auto& name : order)
+	{
+		sProfilerSection* section = sections[name];
+		ImGui::Text("%s", name.c_str()); ImGui::NextColumn();
+		ImGui::Text("%.3f", section->gpu_ms); ImGui::NextColumn();
+		ImGui::Text("%.3f", section->cpu_ms); ImGui::NextColumn();
+	}
+	ImGui::Columns(1);
+
+	for (auto& it : counters)
+		ImGui::Text("%s: %ld", it.first.c_str(), it.second);
+#endif
+}
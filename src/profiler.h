@@ -0,0 +1,49 @@
+#pragma once
+
+#include "includes.h"
+#include <map>
+#include <string>
+#include <vector>
+#include <chrono>
+
+namespace GTR {
+
+	//a named block of commands whose CPU and GPU cost is measured every frame
+	struct sProfilerSection {
+		std::string name;
+		GLuint queries[2];	//GPU timestamps at the begin and the end of the block
+		bool pending;		//queries issued but result not read yet
+		double gpu_ms;
+		double cpu_ms;
+		std::chrono::high_resolution_clock::time_point cpu_start;
+	};
+
+	//Simple profiler to compare different techniques in the same frame.
+	//GPU times are read with timestamp queries one frame later so the pipeline never stalls
+	class Profiler
+	{
+	public:
+		static bool enabled;
+
+		//measure the commands issued between begin and end (sections can be nested)
+		static void begin(const char* name);
+		static void end();
+
+		//counters are shown next to the timings (draw calls saved, lights assigned...)
+		static void setCounter(const char* name, long value);
+		static void addCounter(const char* name, long value);
+		static long getCounter(const char* name);
+		static void resetCounters();
+
+		static double getGPUTime(const char* name);
+		static double getCPUTime(const char* name);
+
+		static void renderInMenu();
+
+	private:
+		static std::map<std::string, sProfilerSection*> sections;
+		static std::vector<std::string> order;	//sections in the order they were created
+		static std::vector<sProfilerSection*> stack;
+		static std::map<std::string, long> counters;
+	};
+};
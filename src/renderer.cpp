@@ -12,6 +12,18 @@
 #include "scene.h"
 #include "sphericalharmonics.h"
 #include "extra/hdre.h"
+#include "profiler.h"
+#include "clusters.h"
+#include "renderqueue.h"
+#include "gpuscene.h"
+#include "occlusion.h"
+#include "bvh.h"
+#include "shadowatlas.h"
+#include "temporal.h"
+#include "froxels.h"
+#include "decals.h"
+#include "probes.h"
+#include "prefilter.h"
 
 using namespace GTR;
 
@@ -46,7 +58,8 @@ Renderer::Renderer()
 	probes_texture = nullptr;
 	blur_texture = new Texture();
 	environment = CubemapFromHDRE("data/panorama.hdre");
-	aux_texture = NULL;
+	specular_environment = environment ? loadPrefilteredEnvironment("data/panorama.hdre", "data/panorama.hdre.ggx") : NULL;
+	brdf_lut = loadBRDFLUT("data/brdf_lut.bin");
 
 	points.resize(64);
 	points = GTR::generateSpherePoints(64, 1.0f, true);
@@ -65,65 +78,120 @@ Renderer::Renderer()
 	irr_fbo = new FBO();
 	irr_fbo->create(64, 64, 1, GL_RGB, GL_FLOAT);
 
-	reflections_fbo = new FBO();
-
-	//create reflexion probes
-	sReflectionProbe* reflection_probe_1 = new sReflectionProbe;
-
-	reflection_probe_1->pos.set(180, 100, -225);
-	reflection_probe_1->cubemap = new Texture();
-	reflection_probe_1->cubemap->createCubemap(512, 512, NULL, GL_RGB, GL_UNSIGNED_INT, false);
-	reflection_probes.push_back(reflection_probe_1);
-
-	sReflectionProbe* reflection_probe_2 = new sReflectionProbe;
-
-	reflection_probe_2->pos.set(180, 85, 5);
-	reflection_probe_2->cubemap = new Texture();
-	reflection_probe_2->cubemap->createCubemap(512, 512, NULL, GL_RGB, GL_UNSIGNED_INT, false);
-	reflection_probes.push_back(reflection_probe_2);
+	gbuffer_format = GBUFFER_PACKED;
+	fbo_format = -1;
+
+	light_pass_mode = LIGHTPASS_MULTIPASS;
+	light_clusters = NULL;
+	benchmark_lights = 6;
+	light_volumes_split = false;
+	illumination_fbo = NULL;
+	lights_ubo = 0;
+	lights_ubo_batches = 0;
+
+	use_render_queue = true;
+	render_queue = new RenderQueue();
+	use_instancing = true;
+	min_instances = 2;
+	use_gpu_culling = false;
+	gpu_scene = new GPUScene();
+	use_occlusion_culling = false;
+	occlusion_culler = new OcclusionCuller();
+	occluder_min_size = 50.0f;
+	occlusion_camera = NULL;
+	use_bvh = true;
+	bvh = new SceneBVH();
+	use_shadow_cache = true;
+	caster_filter = CASTERS_ALL;
+	use_shadow_atlas = true;
+	shadow_atlas = new ShadowAtlas();
+	use_single_pass_shadows = true;
+	use_depth_only_shadows = true;
+	ao_mode = AO_HALF;
+	ao_half_gbuffer = NULL;
+	ao_half_textures[0] = ao_half_textures[1] = NULL;
+	ao_texture = blur_texture;
+	use_temporal = true;
+	ao_temporal = new TemporalAccumulator();
+	volumetric_temporal = new TemporalAccumulator();
+	volumetric_fbo = NULL;
+	volumetric_mode = VOLUMETRIC_FROXELS;
+	froxels = new FroxelVolume();
+	decals = new DecalSystem();
+	benchmark_decals = 1000;
+
+	//reflection probes, captured a few faces per frame
+	reflection_probes = new ReflectionProbes();
+	reflection_probes->addProbe(Vector3(180, 100, -225), Vector3(250, 250, 250));
+	reflection_probes->addProbe(Vector3(180, 85, 5), Vector3(250, 250, 250));
 
 	cube = new Mesh();
 	cube->createCube();
+
+	sphere = new Mesh();
+	sphere->createSphere(1.0f);
+	cone = new Mesh();
+	cone->createCone();
 }
 
 //renders all the prefab
 void Renderer::renderPrefab(const Matrix44& model, GTR::Prefab* prefab, Camera* camera)
 {
-	//assign the model to the root node
-	renderNode(model, &prefab->root, camera);
+	//iterates the compiled nodes instead of walking the tree
+	GTR::sFlatPrefab& flat = prefab->getFlat();
+	for (int i = 0; i < flat.size(); ++i)
+	{
+		if (!flat.visible[i] || flat.mesh[i] == -1 || flat.material[i] == -1)
+			continue;
+		Matrix44 node_model = flat.global[i] * model;
+		BoundingBox world_bounding = transformBoundingBox(node_model, flat.bounds[i]);
+		if (camera->testBoxInFrustum(world_bounding.center, world_bounding.halfsize))
+			renderVisibleNode(node_model, flat.nodes[i], world_bounding, camera);
+	}
 }
 
-//renders a node of the prefab and its children
-void Renderer::renderNode(const Matrix44& prefab_model, GTR::Node* node, Camera* camera)
+bool Renderer::passesCasterFilter(PrefabEntity* entity)
 {
-	if (!node->visible)
-		return;
+	return caster_filter == CASTERS_ALL || entity->is_static == (caster_filter == CASTERS_STATIC);
+}
+
+bool Renderer::hasDynamicCasters()
+{
+	for (PrefabEntity* e : Scene::getInstance()->prefabEntities)
+		if (!e->is_static)
+			return true;
+	return false;
+}
 
-	//compute global matrix
-	Matrix44 node_model = node->getGlobalMatrix(true) * prefab_model;
+//renders the nodes of an entity with the world transforms cached in the entity
+void Renderer::renderPrefabEntity(PrefabEntity* entity, Camera* camera)
+{
+	if (!passesCasterFilter(entity))
+		return;
 
-	//does this node have a mesh? then we must render it
-	if (node->mesh && node->material)
+	std::vector<PrefabEntity::sWorldNode>& nodes = entity->getWorldNodes();
+	for (int i = 0; i < nodes.size(); ++i)
 	{
-		//compute the bounding box of the object in world space (by using the mesh bounding box transformed to world space)
-		BoundingBox world_bounding = transformBoundingBox(node_model,node->mesh->box);
-		
-		//if bounding box is inside the camera frustum then the object is probably visible
-		if (camera->testBoxInFrustum(world_bounding.center, world_bounding.halfsize) )
-		{
-			//if (shadow)
-			//	renderPrefabShadowMap(node_model, node->mesh, node->material, camera);
-			if (deferred)
-				renderMeshInDeferred(node_model, node->mesh, node->material, camera);
-			else
-				renderMeshWithMaterial(node_model, node->mesh, node->material, camera);
-			//node->mesh->renderBounding(node_model, true);
-		}
+		PrefabEntity::sWorldNode& world_node = nodes[i];
+		if (world_node.visible && camera->testBoxInFrustum(world_node.box.center, world_node.box.halfsize))
+			renderVisibleNode(world_node.model, world_node.node, world_node.box, camera);
 	}
+}
 
-	//iterate recursively with children
-	for (int i = 0; i < node->children.size(); ++i)
-		renderNode(prefab_model, node->children[i], camera);
+//draws (or queues) a node already inside the frustum, unless it is behind the occluders of this camera
+void Renderer::renderVisibleNode(const Matrix44& model, GTR::Node* node, const BoundingBox& world_bounding, Camera* camera)
+{
+	if (occlusion_camera == camera && !occlusion_culler->isVisible(world_bounding))
+		return;
+
+	if (render_queue->collecting)
+		render_queue->add(model, node->mesh, node->material, camera);
+	else if (shadow && use_depth_only_shadows)
+		renderMeshShadow(model, node->mesh, node->material, camera);
+	else if (deferred)
+		renderMeshInDeferred(model, node->mesh, node->material, camera);
+	else
+		renderMeshWithMaterial(model, node->mesh, node->material, camera);
 }
 
 //renders a mesh given its transform and material
@@ -237,6 +305,7 @@ void Renderer::renderMeshWithMaterial(const Matrix44 model, Mesh* mesh, GTR::Mat
 			shader->setUniform("u_light_spot_cosine", (float)cos(DEG2RAD * light->angleCutoff));
 			shader->setUniform("u_light_spot_exponent", light->spotExponent);
 			shader->setUniform("u_shadow_map", (light->shadowMap) ? light->shadowMap : Texture::getWhiteTexture(), 3);
+			shader->setUniform("u_shadow_rect", light->shadow_rect);
 
 			//do the draw call that renders the mesh into the screen
 			mesh->render(GL_TRIANGLES);
@@ -251,54 +320,148 @@ void Renderer::renderMeshWithMaterial(const Matrix44 model, Mesh* mesh, GTR::Mat
 	glDisable(GL_BLEND);
 }
 
-void Renderer::renderPrefabShadowMap(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera)
+//the occlusion of this frame (few samples with temporal) is blended with the previous ones
+void Renderer::accumulateAO(Camera* camera, const Matrix44& inverse_matrix)
 {
-	if (!mesh || !mesh->getNumVertices())
+	ao_texture = blur_texture;
+	if (!use_temporal)
 		return;
+	ao_texture = ao_temporal->accumulate(blur_texture, fbo->depth_texture, fbo->color_textures[1], fbo_format == GBUFFER_PACKED,
+		camera, inverse_matrix);
+	Profiler::setCounter("ao history rejected", ao_temporal->rejected_pixels);
+}
 
-	Shader* shadow_shader = Shader::Get("flat");
-	if (!shadow_shader)
-		return;
+//same occlusion than the ssao shader but with a quarter of the pixels and a quarter of the samples each. Neighbour pixels
+//take different samples (interleaved), the blur merges them without crossing depth edges and the upsample picks the
+//half resolution pixels with a depth similar to the full resolution one, so there are no halos around the objects.
+//The result ends in blur_texture like the full resolution mode.
+void Renderer::renderHalfResAO(Camera* camera, const Matrix44& inverse_matrix)
+{
+	int width = fbo->depth_texture->width;
+	int height = fbo->depth_texture->height;
+	int half_width = (width + 1) / 2;
+	int half_height = (height + 1) / 2;
 
-	shadow_shader->enable();
+	if (!ao_half_gbuffer || ao_half_gbuffer->width != half_width || ao_half_gbuffer->height != half_height)
+	{
+		delete ao_half_gbuffer;
+		delete ao_half_textures[0];
+		delete ao_half_textures[1];
+		ao_half_gbuffer = new Texture(half_width, half_height, GL_RGBA, GL_FLOAT, false);
+		ao_half_textures[0] = new Texture(half_width, half_height, GL_RED, GL_UNSIGNED_BYTE, false);
+		ao_half_textures[1] = new Texture(half_width, half_height, GL_RED, GL_UNSIGNED_BYTE, false);
+	}
+	if (blur_texture->width != width || blur_texture->height != height)
+		blur_texture->create(width, height);
 
-	if (material->alpha_mode == GTR::AlphaMode::BLEND)
-		return;
+	Vector2 nearfar(camera->near_plane, camera->far_plane);
 
-	glDisable(GL_BLEND);
-	glEnable(GL_DEPTH_TEST);
-	glDisable(GL_CULL_FACE);
+	//normal and depth at half resolution
+	Shader* shader = Shader::Get("ssao_downsample");
+	shader->enable();
+	shader->setUniform("u_normal_texture", fbo->color_textures[1], 1);
+	shader->setUniform("u_gbuffer_packed", fbo_format == GBUFFER_PACKED);
+	fbo->depth_texture->copyTo(ao_half_gbuffer, shader);
 
-	glDepthFunc(GL_LEQUAL);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+	//occlusion
+	shader = Shader::Get("ssao_half");
+	shader->enable();
+	shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
+	shader->setUniform("u_inverse_viewprojection", inverse_matrix);
+	shader->setUniform3Array("u_points", (float*)&points[0], points.size());
+	shader->setUniform1("u_samples", use_temporal ? 4 : 16);
+	shader->setUniform1("u_frame", use_temporal ? ao_temporal->frame : 0);
+	shader->setUniform("u_angle", use_temporal ? ao_temporal->frame * TEMPORAL_GOLDEN_ANGLE : 0.0f);
+	ao_half_gbuffer->copyTo(ao_half_textures[0], shader);
+
+	//separable depth aware blur, horizontal and vertical
+	shader = Shader::Get("ssao_blur");
+	shader->enable();
+	shader->setUniform("u_half_gbuffer", ao_half_gbuffer, 1);
+	shader->setUniform("u_camera_nearfar", nearfar);
+	shader->setUniform("u_direction", Vector2(1, 0));
+	ao_half_textures[0]->copyTo(ao_half_textures[1], shader);
+	shader->enable();
+	shader->setUniform("u_direction", Vector2(0, 1));
+	ao_half_textures[1]->copyTo(ao_half_textures[0], shader);
 
-	shadow_shader->setUniform("u_model", model);
-	shadow_shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
-	shadow_shader->setUniform("u_camera_pos", camera->eye);
+	//bilateral upsample to full resolution
+	shader = Shader::Get("ssao_upsample");
+	shader->enable();
+	shader->setUniform("u_half_gbuffer", ao_half_gbuffer, 1);
+	shader->setUniform("u_depth_texture", fbo->depth_texture, 2);
+	shader->setUniform("u_camera_nearfar", nearfar);
+	ao_half_textures[0]->copyTo(blur_texture, shader);
+	shader->disable();
+}
 
-	mesh->render(GL_TRIANGLES);
+//only the alpha tested materials need their texture in the shadowmaps
+static bool isAlphaTested(GTR::Material* material)
+{
+	return material->alpha_mode == GTR::AlphaMode::MASK && material->color_texture;
+}
 
-	shadow_shader->disable();
+//depth only draw of a shadow caster: positions only and no material uniforms, unless it is alpha tested. The shader stays
+//enabled from one mesh to the next, submitShadowQueue disables it at the end of the pass
+void Renderer::renderMeshShadow(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera)
+{
+	if (!mesh || !mesh->getNumVertices() || material->alpha_mode == GTR::AlphaMode::BLEND)
+		return;
+
+	static UniformId u_model("u_model"), u_viewprojection("u_viewprojection"), u_color("u_color");
+	static UniformId u_color_texture("u_color_texture"), u_alpha_cutoff("u_alpha_cutoff");
+
+	bool alpha_tested = isAlphaTested(material);
+	Shader* shader = Shader::Get(alpha_tested ? "shadow_masked" : "shadow");
+	if (!shader)
+		return;
+
+	if (shader != Shader::current)
+	{
+		shader->enable();
+		shader->setUniform(u_viewprojection, camera->viewprojection_matrix);
+	}
+
+	if (material->two_sided)
+		glDisable(GL_CULL_FACE);
+	else
+		glEnable(GL_CULL_FACE);
 
-};
+	shader->setUniform(u_model, model);
+	if (alpha_tested)
+	{
+		shader->setUniform(u_color, material->color);
+		shader->setUniform(u_color_texture, material->color_texture, 0);
+		shader->setUniform(u_alpha_cutoff, material->alpha_cutoff);
+		mesh->render(GL_TRIANGLES);
+	}
+	else
+		mesh->renderPositions(GL_TRIANGLES);
+}
 
 void Renderer::renderDeferred(Camera* camera)
 {
 
 	int width = Application::instance->window_width;
 	int height = Application::instance->window_height;
+
+	//amortized reflection probe captures, they render forward so it must be before the gbuffers
+	if (use_reflection)
+	{
+		Profiler::begin("reflection probes");
+		reflection_probes->update(this, camera);
+		Profiler::setCounter("reflection probe faces", reflection_probes->faces_rendered);
+		Profiler::end();
+	}
 	this->deferred = true;
 
-	Shader* second_pass = NULL;
 	Shader* ao_shader = NULL;
 	Shader* reflection_pass = NULL;
 
-	//create fbo in case it hasn't been created before
-	if (!this->fbo)
-	{
-		this->fbo = new FBO();
-		this->fbo->create(width, height, 3, GL_RGB);
-	}
+	//create fbo in case it hasn't been created before (or the layout has changed)
+	if (!this->fbo || fbo_format != gbuffer_format)
+		createGBuffers(width, height);
+	Profiler::setCounter("gbuffer bytes", (long)width * height * getGBufferBytesPerPixel());
 
 	//first pass - Geometry
 	renderSkybox(camera);
@@ -311,10 +474,7 @@ void Renderer::renderDeferred(Camera* camera)
 	glDisable(GL_BLEND);
 	glBlendFunc(GL_ONE, GL_ONE);
 
-	for (PrefabEntity* e : Scene::getInstance()->prefabEntities)
-	{
-		renderPrefab(e->model, e->pPrefab, camera);
-	}
+	renderScene(camera, true);
 
 	//calculate the inverse of the viewprojection for future passes (ao and light pass)
 	Matrix44 inverse_matrix = camera->viewprojection_matrix;
@@ -323,47 +483,33 @@ void Renderer::renderDeferred(Camera* camera)
 
 	this->fbo->unbind();
 
-	//DECALS pass
+	//depth pyramid for the occlusion culling of the next frame
+	if (use_gpu_culling && gpu_scene->isBuilt())
+		gpu_scene->buildHiZ(fbo->depth_texture, camera->viewprojection_matrix);
+
+	//DECALS pass, reads the depth of the gbuffers while drawing over their color
 	if(use_decals)
 	{
-		if (!aux_texture)
-			aux_texture = new Texture(fbo->depth_texture->width, fbo->depth_texture->height, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, false);
-		fbo->depth_texture->copyTo(aux_texture);
-
-		fbo->bind();
-
-		glDisable(GL_DEPTH_TEST);
-		glEnable(GL_CULL_FACE);
-		glEnable(GL_BLEND);
-
-		Matrix44 m;
-		m.setTranslation(425, 0, -200);
-		m.scale(75, 1, 75);
-		Matrix44 im;
-		im = m;
-		im.inverse();
-
-		Shader* shader = Shader::Get("decal");
-		shader->enable();
-		shader->setUniform("u_inverse_viewprojection", inverse_matrix);
-		shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
-		shader->setUniform("u_model", m);
-		shader->setUniform("u_imodel", im);
-		shader->setTexture("u_texture", Texture::Get("data/bandera_umusacsual.png"), 0);
-		shader->setUniform("u_iRes", Vector2(1.0 / fbo->width, 1.0 / fbo->height));
-		shader->setTexture("u_depth_texture", aux_texture, 1);
-		shader->setUniform("u_camera_position", camera->eye);
-		cube->render(GL_TRIANGLES);
-
-		fbo->unbind();
-
-		glDisable(GL_CULL_FACE);
+		Profiler::begin("decals");
+		decals->update(camera, Scene::getInstance()->decalEntities);
+		decals->apply(camera, fbo, inverse_matrix);
+		Profiler::setCounter("decals", decals->num_decals);
+		Profiler::setCounter("cluster decal refs", decals->num_indices);
+		Profiler::end();
 	}
 
 	//AMBIENT OCCLUSION pass
 
-	if (use_ao) {
+	if (use_ao && ao_mode == AO_HALF)
+	{
+		Profiler::begin("ssao");
+		renderHalfResAO(camera, inverse_matrix);
+		accumulateAO(camera, inverse_matrix);
+		Profiler::end();
+	}
+	else if (use_ao) {
 
+		Profiler::begin("ssao");
 		glDisable(GL_BLEND);
 		glEnable(GL_DEPTH_TEST);
 
@@ -387,9 +533,13 @@ void Renderer::renderDeferred(Camera* camera)
 		ao_shader->setUniform("u_inverse_viewprojection", inverse_matrix);
 		ao_shader->setUniform("u_iRes", Vector2(1.0 / (float)width, 1.0 / (float)height));
 		ao_shader->setUniform3Array("u_points", (float*)&points[0], points.size());
+		ao_shader->setUniform1("u_samples", use_temporal ? 8 : 64);
+		ao_shader->setUniform1("u_frame", use_temporal ? ao_temporal->frame : 0);
+		ao_shader->setUniform("u_angle", use_temporal ? ao_temporal->frame * TEMPORAL_GOLDEN_ANGLE : 0.0f);
 		
 		ao_shader->setUniform("u_depth_texture", this->fbo->depth_texture, 0);	//pass the depth buffer calculated in the gbuffers
 		ao_shader->setUniform("u_normal_texture", this->fbo->color_textures[1], 1);
+		ao_shader->setUniform("u_gbuffer_packed", fbo_format == GBUFFER_PACKED);
 
 		quad->render(GL_TRIANGLES);
 
@@ -408,7 +558,8 @@ void Renderer::renderDeferred(Camera* camera)
 		this->ssao_fbo->color_textures[0]->copyTo(this->blur_texture, blurShader);
 
 		blurShader->disable();
-
+		accumulateAO(camera, inverse_matrix);
+		Profiler::end();
 	}
 	
 	//second pass - light
@@ -418,121 +569,16 @@ void Renderer::renderDeferred(Camera* camera)
 		glDisable(GL_BLEND);
 		glDisable(GL_DEPTH_TEST);
 
-		//glClearColor(0.0, 0.0, 0.0, 1.0);
-		//glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-
-		second_pass = Shader::Get("deferred_pospo");
-		second_pass->enable();
-
-		//camera pass
-		second_pass->setUniform("u_camera_pos", camera->eye);
-		second_pass->setUniform("u_inverse_viewprojection", inverse_matrix);
-		second_pass->setUniform("u_iRes", Vector2(1.0 / (float)width, 1.0 / (float)height));
-
-		//texture pass
-		second_pass->setUniform("u_color_texture", this->fbo->color_textures[0], 0);
-		second_pass->setUniform("u_normal_texture", this->fbo->color_textures[1], 1);
-		second_pass->setUniform("u_metal_roughness_texture", this->fbo->color_textures[2], 2);
-		second_pass->setUniform("u_depth_texture", this->fbo->depth_texture, 3);
-		if (use_ao && Scene::getInstance()->ambient_occlusion) {
-			second_pass->setUniform("u_ao_texture", blur_texture ?
-				blur_texture : Texture::getWhiteTexture(), 4);
-		}
-		else {
-			second_pass->setUniform("u_ao_texture", Texture::getWhiteTexture(), 4);
-		}
-
-		//IRRADIANCE PASS
-		second_pass->setUniform("u_user_irr", use_irradiance);
-		if(use_irradiance)
-		{
-			second_pass->setUniform("u_irr_texture", probes_texture, 5);
-			second_pass->setUniform("u_irr_start", irr_start_pos);
-			second_pass->setUniform("u_irr_end", irr_end_pos);
-			second_pass->setUniform("u_irr_delta", irr_delta);
-			second_pass->setUniform("u_irr_dims", irr_dim);
-			second_pass->setUniform("u_irr_factor", irr_factor);
-		}
-
-		//lights pass
-		bool firstLight = true;
-		int visibleLights = numLightsVisible() - 1;
-		int currentLight = -1;
-
-		//multipass
-		for (size_t i = 0; i < Scene::getInstance()->lightEntities.size(); i++)	//pass for all lights
-		{
-			glDisable(GL_DEPTH_TEST);
-			Light* light = Scene::getInstance()->lightEntities.at(i);
-			if (!light->visible)
-			{
-				continue;
-			}
-			else
-			{
-				currentLight++;
-			}
-				
-			second_pass->setUniform("u_current_total", Vector2(currentLight, visibleLights));
-
-			if (firstLight) {
-				firstLight = false;
-				glDisable(GL_BLEND);
-				Vector3 ambient = Scene::getInstance()->ambientLight;
-				second_pass->setUniform("u_ambient_light", Scene::getInstance()->ambient_light ? 
-					Scene::getInstance()->ambientLight : Vector3(0,0,0));
-			}
-			else {
-				glEnable(GL_BLEND);
-				glBlendFunc(GL_ONE, GL_ONE);
-				glBlendEquation(GL_FUNC_ADD);
-				assert(glGetError() == GL_NO_ERROR);
-				second_pass->setUniform("u_ambient_light", Vector3(0.0f, 0.0f, 0.0f));
-			}
-
-			if(currentLight == visibleLights)
-			{
-				second_pass->setUniform("u_environment_texture", environment);
-			}
-
-			second_pass->setUniform("u_light_type", light->light_type);
-			second_pass->setUniform("u_light_position", light->model.getTranslation());
-			second_pass->setUniform("u_light_intensity", light->intensity);
-			second_pass->setUniform("u_light_color", light->color);
-			second_pass->setUniform("u_light_maxdist", light->maxDist);
-			second_pass->setUniform("u_light_direction", light->model.frontVector());
-			second_pass->setUniform("u_light_spot_cosine", (float)cos(DEG2RAD * light->angleCutoff));
-			second_pass->setUniform("u_light_spot_inner_cosine", (float)cos(DEG2RAD* light->innerAngle));
-			second_pass->setUniform("u_light_spot_exponent", light->spotExponent);
-			second_pass->setUniform("u_light_bias", light->bias);
-
-			if (light->shadowMap)
-			{
-				second_pass->setUniform("u_is_cascade", light->is_cascade);
-				if (light->light_type == lightType::SPOT || !light->is_cascade)
-					second_pass->setUniform("u_shadow_viewprojection", light->camera->viewprojection_matrix);
-				else if (light->light_type == lightType::DIRECTIONAL && light->is_cascade)
-					second_pass->setMatrix44Array("u_shadow_viewprojection_array", light->shadow_viewprojection, 4);
-				second_pass->setUniform("u_shadow_map", (light->shadowMap) ? 
-					light->shadowMap : Texture::getWhiteTexture(), 6);
-			}
-
-			quad->render(GL_TRIANGLES);	//render with blending for each light
-
-		}
-		
-		//in case there is no lights, render the quad
-		if (Scene::getInstance()->lightEntities.empty())
-		{
-			quad->render(GL_TRIANGLES);
-			std::cout << Scene::getInstance()->ambientLight.x << std::endl;
-			second_pass->setUniform("u_light_type", 3);
-			second_pass->setUniform("u_ambient_light", Scene::getInstance()->ambient_light
-				? Scene::getInstance()->ambientLight : Vector3(0.0f, 0.0f, 0.0f));
-		}
-
-		second_pass->disable();
-
+		Profiler::begin("light pass");
+		if (light_pass_mode == LIGHTPASS_CLUSTERED)
+			renderClusteredLights(camera, inverse_matrix);
+		else if (light_pass_mode == LIGHTPASS_VOLUMES)
+			renderLightVolumes(camera, inverse_matrix);
+		else if (light_pass_mode == LIGHTPASS_SINGLEPASS)
+			renderSinglePassLights(camera, inverse_matrix);
+		else
+			renderMultipassLights(camera, inverse_matrix);
+		Profiler::end();
 	}
 
 	//REFLECTION PASS
@@ -540,21 +586,22 @@ void Renderer::renderDeferred(Camera* camera)
 	{
 		reflection_pass = Shader::Get("reflection");
 
+		//the shader already weights the reflection with the fresnel of the material
 		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glBlendFunc(GL_ONE, GL_ONE);
 
 		glEnable(GL_DEPTH_TEST);
 
 		reflection_pass->enable();
 
 		reflection_pass->setUniform("u_normal_texture", fbo->color_textures[1], 0);
-		reflection_pass->setUniform("u_metal_roughness_texture", fbo->color_textures[2], 1);
+		reflection_pass->setUniform("u_metal_roughness_texture", getGBufferMaterialTexture(), 1);
+		reflection_pass->setUniform("u_gbuffer_packed", fbo_format == GBUFFER_PACKED);
 		reflection_pass->setUniform("u_depth_texture", this->fbo->depth_texture, 2);
-		reflection_pass->setUniform("u_environment_texture", environment, 3);
-		reflection_pass->setUniform("u_reflection_texture_1", reflection_probes[0]->cubemap, 4);
-		reflection_pass->setUniform("u_reflection_texture_2", reflection_probes[1]->cubemap, 5);
-		reflection_pass->setUniform("u_probe_1_pos", reflection_probes[0]->pos);
-		reflection_pass->setUniform("u_probe_2_pos", reflection_probes[1]->pos);
+		reflection_pass->setUniform("u_environment_texture", specular_environment ? specular_environment : environment, 3);
+		reflection_probes->setUniforms(reflection_pass, 4);
+		reflection_pass->setUniform("u_brdf_lut", brdf_lut, 5);
+		reflection_pass->setUniform("u_color_texture", fbo->color_textures[0], 6);
 		reflection_pass->setUniform("u_iRes", Vector2(1.0 / (float)width, 1.0 / (float)height));
 		reflection_pass->setUniform("u_camera_pos", camera->eye);
 		reflection_pass->setUniform("u_inverse_viewprojection", inverse_matrix);
@@ -565,18 +612,46 @@ void Renderer::renderDeferred(Camera* camera)
 	}
 
 	//VOLUMETRIC PASS
-	if (use_volumetric)
+	if (use_volumetric && volumetric_mode == VOLUMETRIC_FROXELS)
 	{
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		Profiler::begin("volumetric");
+		froxels->update(this, camera, Scene::getInstance()->lightEntities);
+		froxels->apply(camera, fbo->depth_texture, inverse_matrix);
+		Profiler::end();
+	}
+	else if (use_volumetric)
+	{
+		Profiler::begin("volumetric");
 		glDisable(GL_DEPTH_TEST);
 
+		//with temporal accumulation the rays are traced in a texture first, then blended over the scene
+		if (use_temporal)
+		{
+			if (!volumetric_fbo || volumetric_fbo->width != width || volumetric_fbo->height != height)
+			{
+				delete volumetric_fbo;
+				volumetric_fbo = new FBO();
+				volumetric_fbo->create(width, height, 1, GL_RGBA, GL_HALF_FLOAT, false);
+			}
+			volumetric_fbo->bind();
+			glClear(GL_COLOR_BUFFER_BIT);
+			glDisable(GL_BLEND);
+		}
+		else
+		{
+			glEnable(GL_BLEND);
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		}
+
 		Light* sun = Scene::getInstance()->sun;
 		Shader* sh = Shader::Get("volumetric");
 		sh->enable();
+		sh->setUniform1("u_samples", use_temporal ? 8 : 64);
+		sh->setUniform("u_jitter", use_temporal ? (float)fmod(volumetric_temporal->frame * 0.618034f, 1.0f) : -1.0f);
 
 		sh->setUniform("u_depth_texture", fbo->depth_texture, 4);
 		sh->setUniform("u_shadow_map", sun->shadowMap, 5);
+		sh->setUniform("u_shadow_rect", sun->shadow_rect);
 
 		sh->setUniform("u_light_color", sun->color );
 		sh->setUniform("u_light_bias", sun->bias );
@@ -596,6 +671,19 @@ void Renderer::renderDeferred(Camera* camera)
 
 		sh->disable();
 
+		if (use_temporal)
+		{
+			volumetric_fbo->unbind();
+			Texture* volumetric = volumetric_temporal->accumulate(volumetric_fbo->color_textures[0], fbo->depth_texture,
+				fbo->color_textures[1], fbo_format == GBUFFER_PACKED, camera, inverse_matrix);
+			Profiler::setCounter("volumetric history rejected", volumetric_temporal->rejected_pixels);
+
+			glEnable(GL_BLEND);
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			volumetric->toViewport();
+		}
+		glDisable(GL_BLEND);
+		Profiler::end();
 	}
 
 	/*****DEBUG OPTIONS **********/
@@ -608,8 +696,8 @@ void Renderer::renderDeferred(Camera* camera)
 	if(show_probe_coefficients_texture && probes_texture != nullptr)
 		probes_texture->toViewport();
 
-	if (show_ao && blur_texture != nullptr)
-		blur_texture->toViewport();
+	if (show_ao && ao_texture != nullptr)
+		ao_texture->toViewport();
 
 	if (show_irr_probes)
 	{
@@ -619,100 +707,587 @@ void Renderer::renderDeferred(Camera* camera)
 	if (show_reflection_probes)
 	{
 		glDisable(GL_DEPTH_TEST);
-		renderReflectionProbe(reflection_probes[0], camera);
-		renderReflectionProbe(reflection_probes[1], camera);
+		for (sReflectionProbe* probe : reflection_probes->probes)
+			renderReflectionProbe(probe, camera);
 	}
 }
 
-void Renderer::computeIrradiance()
+//camera, gbuffers, ao and irradiance uniforms shared by all the light pass shaders (slots 0 to 5)
+void Renderer::setDeferredUniforms(Shader* shader, Camera* camera, const Matrix44& inverse_matrix)
 {
-	irradiance_probes.clear();
-	if (probes_texture)
-		delete probes_texture;
-
-	for(int z = 0; z < irr_dim.z; z++)
-		for(int y = 0; y < irr_dim.y; y++)
-			for (int x = 0; x < irr_dim.x; x++)
-			{
-				sIrradianceProbe p;
-				p.local.set(x, y, z);
+	int width = Application::instance->window_width;
+	int height = Application::instance->window_height;
 
-				p.index = floor(x + y * irr_dim.x + z * irr_dim.x * irr_dim.y);
+	//camera pass
+	shader->setUniform("u_camera_pos", camera->eye);
+	shader->setUniform("u_inverse_viewprojection", inverse_matrix);
+	shader->setUniform("u_iRes", Vector2(1.0 / (float)width, 1.0 / (float)height));
+
+	//texture pass
+	shader->setUniform("u_color_texture", this->fbo->color_textures[0], 0);
+	shader->setUniform("u_normal_texture", this->fbo->color_textures[1], 1);
+	shader->setUniform("u_metal_roughness_texture", getGBufferMaterialTexture(), 2);
+	shader->setUniform("u_gbuffer_packed", fbo_format == GBUFFER_PACKED);
+	shader->setUniform("u_depth_texture", this->fbo->depth_texture, 3);
+	if (use_ao && Scene::getInstance()->ambient_occlusion) {
+		shader->setUniform("u_ao_texture", ao_texture ?
+			ao_texture : Texture::getWhiteTexture(), 4);
+	}
+	else {
+		shader->setUniform("u_ao_texture", Texture::getWhiteTexture(), 4);
+	}
 
-				p.pos = irr_start_pos + irr_delta * Vector3(x, y, z);
-				irradiance_probes.push_back(p);
-			}
+	//IRRADIANCE PASS
+	shader->setUniform("u_user_irr", use_irradiance);
+	if(use_irradiance)
+	{
+		shader->setUniform("u_irr_texture", probes_texture, 5);
+		shader->setUniform("u_irr_start", irr_start_pos);
+		shader->setUniform("u_irr_end", irr_end_pos);
+		shader->setUniform("u_irr_delta", irr_delta);
+		shader->setUniform("u_irr_dims", irr_dim);
+		shader->setUniform("u_irr_factor", irr_factor);
+	}
+}
 
-	if (!irr_fbo) {
-		irr_fbo = new FBO();
-		irr_fbo->create(64, 64, 1, GL_RGB, GL_FLOAT);
+//uniforms of a single light for the deferred_pospo shader (shadowmap in slot 6)
+void Renderer::setLightUniforms(Shader* shader, Light* light)
+{
+	shader->setUniform("u_light_type", light->light_type);
+	shader->setUniform("u_light_position", light->model.getTranslation());
+	shader->setUniform("u_light_intensity", light->intensity);
+	shader->setUniform("u_light_color", light->color);
+	shader->setUniform("u_light_maxdist", light->maxDist);
+	shader->setUniform("u_light_direction", light->model.frontVector());
+	shader->setUniform("u_light_spot_cosine", (float)cos(DEG2RAD * light->angleCutoff));
+	shader->setUniform("u_light_spot_inner_cosine", (float)cos(DEG2RAD* light->innerAngle));
+	shader->setUniform("u_light_spot_exponent", light->spotExponent);
+	shader->setUniform("u_light_bias", light->bias);
+
+	if (light->shadowMap)
+	{
+		shader->setUniform("u_is_cascade", light->is_cascade);
+		if (light->light_type == lightType::SPOT || !light->is_cascade)
+			shader->setUniform("u_shadow_viewprojection", light->camera->viewprojection_matrix);
+		else if (light->light_type == lightType::DIRECTIONAL && light->is_cascade)
+			shader->setMatrix44Array("u_shadow_viewprojection_array", light->shadow_viewprojection, 4);
+		shader->setUniform("u_shadow_map", light->hasShadowMap() ? light->shadowMap : Texture::getWhiteTexture(), 6);
+		shader->setUniform("u_shadow_rect", light->shadow_rect);
 	}
+}
 
-	for (auto& p: irradiance_probes)
+//the proxies are tessellated, scale them a little so they contain the whole light volume
+Matrix44 Renderer::getLightVolumeModel(Light* light)
+{
+	Matrix44 m = light->model;
+	if (light->light_type == lightType::SPOT)	//cone of height maxDist
 	{
-		computeProbeCoeffs(p);
+		float radius = light->maxDist * tan(DEG2RAD * clamp(light->angleCutoff, 1.0f, 89.0f)) / cos(PI / 16.0f);
+		m.scale(radius, radius, light->maxDist);
+	}
+	else
+	{
+		float radius = light->maxDist / (cos(PI / 16.0f) * cos(PI / 12.0f));
+		m.scale(radius, radius, radius);
 	}
+	return m;
+}
 
-	probes_texture = new Texture(9, irradiance_probes.size(), GL_RGB, GL_FLOAT);
-	SphericalHarmonics* sh_data = nullptr;
-	sh_data = new SphericalHarmonics[irr_dim.x * irr_dim.y * irr_dim.z];
+//directional lights and ambient are fullscreen quads, point and spot lights only shade the pixels
+//inside their proxy. The back faces of the proxy are depth tested against the gbuffer depth (GL_GEQUAL)
+//so surfaces behind the light volume are skipped too
+void Renderer::renderLightVolumes(Camera* camera, const Matrix44& inverse_matrix)
+{
+	int width = Application::instance->window_width;
+	int height = Application::instance->window_height;
+	Mesh* quad = Mesh::getQuad();
+	Scene* scene = Scene::getInstance();
 
-	for (size_t i = 0; i < irradiance_probes.size(); i++)
+	//same size as the gbuffers, they are recreated when the window is resized
+	if (!illumination_fbo || illumination_fbo->width != fbo->width || illumination_fbo->height != fbo->height)
 	{
-		sIrradianceProbe p = irradiance_probes.at(i);
-		sh_data[p.index] = p.sh;
+		delete illumination_fbo;
+		illumination_fbo = new FBO();
+		illumination_fbo->create(fbo->width, fbo->height, 1, GL_RGB, GL_UNSIGNED_BYTE, true);
 	}
 
-	sIrrHeader irr_header;
-	irr_header.start = irr_start_pos;
-	irr_header.end = irr_end_pos;
-	irr_header.dims = irr_dim;
-	irr_header.delta = irr_delta;
-	irr_header.num_probes = irr_dim.x * irr_dim.y * irr_dim.z;
+	//the gbuffer depth is sampled by the shader, so the volumes are tested against a copy
+	fbo->depth_texture->copyTo(illumination_fbo->depth_texture);
 
-	FILE* f = fopen("irradiance.bin", "wb");
-	fwrite(&irr_header, sizeof(sIrrHeader), 1, f);
-	fwrite(&sh_data[0], sizeof(SphericalHarmonics), irradiance_probes.size(), f);
-	fclose(f);
-}
+	illumination_fbo->bind();
+	glClearColor(0.0, 0.0, 0.0, 1.0);
+	glClear(GL_COLOR_BUFFER_BIT);
 
-void Renderer::computeProbeCoeffs(sIrradianceProbe& p)
-{
-	FloatImage images[6];
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
 
-	Camera cam;
-	cam.setPerspective(90, 1, 0.1f, 1000.0f);
+	Shader* shader = Shader::Get("deferred_pospo");
+	shader->enable();
+	setDeferredUniforms(shader, camera, inverse_matrix);
 
-	for (int i = 0; i < 6; i++)
-	{
-		Vector3 eye = p.pos;
-		Vector3 front = cubemapFaceNormals[i][2];
-		Vector3 center = p.pos + front;
-		Vector3 up = cubemapFaceNormals[i][1];
-		cam.lookAt(eye, center, up);
-		cam.enable();
+	//ambient and irradiance (u_current_total.y is never reached, the reflection pass adds the environment)
+	shader->setUniform("u_current_total", Vector2(0, -1));
+	shader->setUniform("u_light_type", (int)lightType::AMBIENT);
+	shader->setUniform("u_ambient_light", scene->ambient_light ? scene->ambientLight : Vector3(0, 0, 0));
+	quad->render(GL_TRIANGLES);
 
-		irr_fbo->bind();
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+	glBlendEquation(GL_FUNC_ADD);
+	shader->setUniform("u_current_total", Vector2(1, -1));
+	shader->setUniform("u_ambient_light", Vector3(0, 0, 0));
 
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	int num_quads = 1;
+	for (Light* light : scene->lightEntities)
+	{
+		if (!light->visible || light->light_type != lightType::DIRECTIONAL)
+			continue;
+		setLightUniforms(shader, light);
+		quad->render(GL_TRIANGLES);
+		num_quads++;
+	}
 
-		//Scene::getInstance()->render()
-		Scene::getInstance()->renderForward(&cam, this);
-		irr_fbo->unbind();
+	//A/B: the left half of the screen renders the local lights with fullscreen quads
+	if (light_volumes_split)
+	{
+		glEnable(GL_SCISSOR_TEST);
+		glScissor(0, 0, width / 2, height);
 
-		images[i].fromTexture(irr_fbo->color_textures[0]);
+		Profiler::begin("local lights (quads)");
+		for (Light* light : scene->lightEntities)
+		{
+			if (!light->visible || (light->light_type != lightType::POINT_LIGHT && light->light_type != lightType::SPOT))
+				continue;
+			setLightUniforms(shader, light);
+			quad->render(GL_TRIANGLES);
+			num_quads++;
+		}
+		Profiler::end();
+
+		glScissor(width / 2, 0, width - width / 2, height);
 	}
-	
-	p.sh = computeSH(images);
-}
+	shader->disable();
 
-void Renderer::renderShadowMap()
-{
-	for each (Light* light in Scene::getInstance()->lightEntities)
+	shader = Shader::Get("deferred_volume");
+	shader->enable();
+	setDeferredUniforms(shader, camera, inverse_matrix);
+	shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
+	shader->setUniform("u_current_total", Vector2(1, -1));
+	shader->setUniform("u_ambient_light", Vector3(0, 0, 0));
+
+	//only the back faces, so it also works when the camera is inside the volume
+	glEnable(GL_CULL_FACE);
+	glCullFace(GL_FRONT);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_GEQUAL);
+	glDepthMask(GL_FALSE);
+
+	int num_volumes = 0;
+	Profiler::begin("local lights (volumes)");
+	for (Light* light : scene->lightEntities)
 	{
-		if (light->shadowMap && light->show_shadowMap)
-		{
-			glViewport(0, 0, 300, 300);
+		if (!light->visible || (light->light_type != lightType::POINT_LIGHT && light->light_type != lightType::SPOT))
+			continue;
+		if (camera->testSphereInFrustum(light->model.getTranslation(), light->maxDist) == CLIP_OUTSIDE)
+			continue;
+		setLightUniforms(shader, light);
+		shader->setUniform("u_model", getLightVolumeModel(light));
+		if (light->light_type == lightType::SPOT)
+			cone->render(GL_TRIANGLES);
+		else
+			sphere->render(GL_TRIANGLES);
+		num_volumes++;
+	}
+	Profiler::end();
+
+	shader->disable();
+
+	Profiler::setCounter("light pass quads", num_quads);
+	Profiler::setCounter("light volumes", num_volumes);
+
+	glDepthMask(GL_TRUE);
+	glDepthFunc(GL_LEQUAL);
+	glCullFace(GL_BACK);
+	glDisable(GL_CULL_FACE);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_SCISSOR_TEST);
+	glDisable(GL_BLEND);
+
+	illumination_fbo->unbind();
+
+	illumination_fbo->color_textures[0]->toViewport();
+}
+
+//renders a fullscreen quad per visible light accumulating the result with additive blending
+void Renderer::renderMultipassLights(Camera* camera, const Matrix44& inverse_matrix)
+{
+	Mesh* quad = Mesh::getQuad();
+	Shader* second_pass = NULL;
+
+	second_pass = Shader::Get("deferred_pospo");
+	second_pass->enable();
+
+	setDeferredUniforms(second_pass, camera, inverse_matrix);
+
+	//lights pass
+	bool firstLight = true;
+	int visibleLights = numLightsVisible();
+	int currentLight = -1;
+
+	//multipass
+	for (size_t i = 0; i < Scene::getInstance()->lightEntities.size(); i++)	//pass for all lights
+	{
+		glDisable(GL_DEPTH_TEST);
+		Light* light = Scene::getInstance()->lightEntities.at(i);
+		if (!light->visible)
+		{
+			continue;
+		}
+		else
+		{
+			currentLight++;
+		}
+			
+		second_pass->setUniform("u_current_total", Vector2(currentLight, visibleLights - 1));
+
+		if (firstLight) {
+			firstLight = false;
+			glDisable(GL_BLEND);
+			second_pass->setUniform("u_ambient_light", Scene::getInstance()->ambient_light ? 
+				Scene::getInstance()->ambientLight : Vector3(0,0,0));
+		}
+		else {
+			glEnable(GL_BLEND);
+			glBlendFunc(GL_ONE, GL_ONE);
+			glBlendEquation(GL_FUNC_ADD);
+			assert(glGetError() == GL_NO_ERROR);
+			second_pass->setUniform("u_ambient_light", Vector3(0.0f, 0.0f, 0.0f));
+		}
+
+		if(currentLight == visibleLights - 1)
+		{
+			second_pass->setUniform("u_environment_texture", environment);
+		}
+
+		setLightUniforms(second_pass, light);
+
+		quad->render(GL_TRIANGLES);	//render with blending for each light
+
+	}
+	
+	//in case there is no visible light, render the quad with only the ambient
+	if (visibleLights == 0)
+	{
+		glDisable(GL_DEPTH_TEST);
+		glDisable(GL_BLEND);
+		second_pass->setUniform("u_current_total", Vector2(0, 0));
+		second_pass->setUniform("u_environment_texture", environment);
+		second_pass->setUniform("u_light_type", 3);
+		second_pass->setUniform("u_ambient_light", Scene::getInstance()->ambient_light
+			? Scene::getInstance()->ambientLight : Vector3(0.0f, 0.0f, 0.0f));
+		quad->render(GL_TRIANGLES);
+	}
+
+	Profiler::setCounter("light pass quads", std::max(currentLight + 1, 1));
+
+	second_pass->disable();
+}
+
+//shader names must be literals, the shader caches the pointer of the string
+static const char* ubo_shadow_map_names[UBO_SHADOW_SLOTS] = {
+	"u_shadow_map_0", "u_shadow_map_1", "u_shadow_map_2", "u_shadow_map_3" };
+
+//all the visible lights are uploaded once to a uniform buffer and shaded with a single quad per MAX_UBO_LIGHTS,
+//so with few lights the gbuffer is read only once and there is no blending
+void Renderer::renderSinglePassLights(Camera* camera, const Matrix44& inverse_matrix)
+{
+	Mesh* quad = Mesh::getQuad();
+	Scene* scene = Scene::getInstance();
+
+	static std::vector<sLightUBOData> lights_data;
+	lights_data.clear();
+
+	Light* shadow_lights[UBO_SHADOW_SLOTS];
+	int num_shadows = 0;
+	Light* cascade_light = NULL;
+	Texture* atlas_texture = shadow_atlas->fbo ? shadow_atlas->fbo->depth_texture : NULL;
+
+	for (Light* light : scene->lightEntities)
+	{
+		if (!light->visible || light->light_type == lightType::AMBIENT)
+			continue;
+		if (light->light_type != lightType::DIRECTIONAL &&
+			camera->testSphereInFrustum(light->model.getTranslation(), light->maxDist) == CLIP_OUTSIDE)
+			continue;
+
+		float shadow_slot = -1.0f;
+		if (light->hasShadowMap())
+		{
+			if (light->light_type == lightType::DIRECTIONAL && light->is_cascade)
+			{
+				if (!cascade_light)
+				{
+					cascade_light = light;
+					shadow_slot = UBO_CASCADE_SHADOW_SLOT;
+				}
+			}
+			else if (light->shadowMap == atlas_texture)
+				shadow_slot = UBO_ATLAS_SHADOW_SLOT;
+			else if (num_shadows < UBO_SHADOW_SLOTS)
+			{
+				shadow_slot = (float)num_shadows;
+				shadow_lights[num_shadows++] = light;
+			}
+		}
+
+		Vector3 pos = light->model.getTranslation();
+		Vector3 dir = light->model.frontVector();
+		sLightUBOData data;
+		data.position_maxdist.set(pos.x, pos.y, pos.z, light->maxDist);
+		data.color_intensity.set(light->color.x, light->color.y, light->color.z, light->intensity);
+		data.direction_type.set(dir.x, dir.y, dir.z, (float)light->light_type);
+		data.spot_shadow.set((float)cos(DEG2RAD * light->angleCutoff), (float)cos(DEG2RAD * light->innerAngle), shadow_slot, light->bias);
+		data.shadow_rect = light->shadow_rect;
+		data.shadow_viewprojection = light->camera->viewprojection_matrix;
+		lights_data.push_back(data);
+	}
+
+	//the buffer grows in blocks of MAX_UBO_LIGHTS, every block is bound as the whole array of the shader
+	//(144 bytes * 64 lights is a multiple of any GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT)
+	int num_batches = std::max(1, (int)(lights_data.size() + MAX_UBO_LIGHTS - 1) / MAX_UBO_LIGHTS);
+	if (!lights_ubo)
+		glGenBuffers(1, &lights_ubo);
+	glBindBuffer(GL_UNIFORM_BUFFER, lights_ubo);
+	if (num_batches > lights_ubo_batches)
+	{
+		lights_ubo_batches = num_batches;
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(sLightUBOData) * MAX_UBO_LIGHTS * lights_ubo_batches, NULL, GL_DYNAMIC_DRAW);
+	}
+
+	//one upload per frame instead of a dozen of uniforms per light
+	if (lights_data.size())
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(sLightUBOData) * lights_data.size(), &lights_data[0]);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	Profiler::setCounter("ubo lights", lights_data.size());
+	Profiler::setCounter("light pass quads", num_batches);
+
+	Shader* shader = Shader::Get("deferred_singlepass");
+	shader->enable();
+
+	setDeferredUniforms(shader, camera, inverse_matrix);
+	shader->setUniformBlock("u_lights_block", 0);
+	shader->setUniform("u_environment_texture", environment, 11);
+
+	shader->setUniform("u_shadow_map", cascade_light ? cascade_light->shadowMap : Texture::getWhiteTexture(), 6);
+	if (cascade_light)
+		shader->setMatrix44Array("u_shadow_viewprojection_array", cascade_light->shadow_viewprojection, 4);
+	for (int i = 0; i < UBO_SHADOW_SLOTS; ++i)
+		shader->setUniform(ubo_shadow_map_names[i], i < num_shadows ? shadow_lights[i]->shadowMap : Texture::getWhiteTexture(), 7 + i);
+	shader->setUniform("u_shadow_atlas", atlas_texture ? atlas_texture : Texture::getWhiteTexture(), 12);
+
+	//the first batch adds the ambient, the rest are added on top like the multipass
+	for (int batch = 0; batch < num_batches; ++batch)
+	{
+		int first = batch * MAX_UBO_LIGHTS;
+		glBindBufferRange(GL_UNIFORM_BUFFER, 0, lights_ubo, sizeof(sLightUBOData) * first, sizeof(sLightUBOData) * MAX_UBO_LIGHTS);
+		shader->setUniform("u_num_lights", std::min((int)lights_data.size() - first, MAX_UBO_LIGHTS));
+		shader->setUniform("u_current_total", Vector2((float)batch, -1.0f));
+		if (batch == 0)
+		{
+			glDisable(GL_BLEND);
+			shader->setUniform("u_ambient_light", scene->ambient_light ? scene->ambientLight : Vector3(0, 0, 0));
+		}
+		else
+		{
+			glEnable(GL_BLEND);
+			glBlendFunc(GL_ONE, GL_ONE);
+			shader->setUniform("u_ambient_light", Vector3(0, 0, 0));
+		}
+		quad->render(GL_TRIANGLES);
+	}
+	glDisable(GL_BLEND);
+
+	shader->disable();
+}
+
+//renders all the point and spot lights with a single fullscreen quad using the light clusters
+void Renderer::renderClusteredLights(Camera* camera, const Matrix44& inverse_matrix)
+{
+	Mesh* quad = Mesh::getQuad();
+	Scene* scene = Scene::getInstance();
+
+	if (!light_clusters)
+		light_clusters = new LightClusters();
+
+	Profiler::begin("light assignment");
+	light_clusters->bvh = use_bvh ? bvh : NULL;	//refitted by the gbuffer pass of this frame
+	light_clusters->update(camera, scene->lightEntities, shadow_atlas->fbo ? shadow_atlas->fbo->depth_texture : NULL);
+	Profiler::end();
+
+	Profiler::setCounter("clustered lights", light_clusters->num_lights);
+	Profiler::setCounter("cluster light refs", light_clusters->num_indices);
+	Profiler::setCounter("light pass quads", 1);
+
+	Shader* shader = Shader::Get("deferred_clustered");
+	shader->enable();
+
+	setDeferredUniforms(shader, camera, inverse_matrix);
+	shader->setUniform("u_view", camera->view_matrix);
+	shader->setUniform("u_ambient_light", scene->ambient_light ? scene->ambientLight : Vector3(0, 0, 0));
+
+	//directional lights reach every cluster, only the first one is supported
+	Light* sun = NULL;
+	for (Light* light : scene->lightEntities)
+		if (light->visible && light->light_type == lightType::DIRECTIONAL)
+		{
+			sun = light;
+			break;
+		}
+
+	shader->setUniform("u_sun_enabled", sun != NULL);
+	bool sun_shadow = sun && sun->hasShadowMap();
+	shader->setUniform("u_sun_has_shadow", sun_shadow);
+	if (sun)
+	{
+		shader->setUniform("u_sun_position", sun->model.getTranslation());
+		shader->setUniform("u_sun_color", sun->color);
+		shader->setUniform("u_sun_intensity", sun->intensity);
+		shader->setUniform("u_sun_bias", sun->bias);
+	}
+	if (sun_shadow)
+	{
+		shader->setUniform("u_is_cascade", sun->is_cascade);
+		if (sun->is_cascade)
+			shader->setMatrix44Array("u_shadow_viewprojection_array", sun->shadow_viewprojection, 4);
+		else
+			shader->setUniform("u_shadow_viewprojection", sun->camera->viewprojection_matrix);
+	}
+	shader->setUniform("u_shadow_map", sun_shadow ? sun->shadowMap : Texture::getWhiteTexture(), 6);
+	shader->setUniform("u_shadow_rect", sun_shadow ? sun->shadow_rect : Vector4(0, 0, 1, 1));
+
+	light_clusters->setUniforms(shader, 7);
+
+	quad->render(GL_TRIANGLES);
+
+	shader->disable();
+}
+
+void Renderer::createGBuffers(int width, int height)
+{
+	if (this->fbo)
+		delete this->fbo;
+	this->fbo = new FBO();
+	if (gbuffer_format == GBUFFER_PACKED)
+		this->fbo->create(width, height, 2, GL_RGBA);
+	else
+		this->fbo->create(width, height, 3, GL_RGB);
+	fbo_format = gbuffer_format;
+}
+
+//roughness and metalness share the texture of the normal in the packed layout
+Texture* Renderer::getGBufferMaterialTexture()
+{
+	return fbo->color_textures[fbo_format == GBUFFER_PACKED ? 1 : 2];
+}
+
+//color targets plus 32 bits of depth, RGB8 counts as 4 bytes because GPUs pad it to RGBA8
+int Renderer::getGBufferBytesPerPixel()
+{
+	if (gbuffer_format == GBUFFER_PACKED)
+		return 2 * 4 + 4;
+	return 3 * 4 + 4;
+}
+
+void Renderer::computeIrradiance()
+{
+	irradiance_probes.clear();
+	if (probes_texture)
+		delete probes_texture;
+
+	for(int z = 0; z < irr_dim.z; z++)
+		for(int y = 0; y < irr_dim.y; y++)
+			for (int x = 0; x < irr_dim.x; x++)
+			{
+				sIrradianceProbe p;
+				p.local.set(x, y, z);
+
+				p.index = floor(x + y * irr_dim.x + z * irr_dim.x * irr_dim.y);
+
+				p.pos = irr_start_pos + irr_delta * Vector3(x, y, z);
+				irradiance_probes.push_back(p);
+			}
+
+	if (!irr_fbo) {
+		irr_fbo = new FBO();
+		irr_fbo->create(64, 64, 1, GL_RGB, GL_FLOAT);
+	}
+
+	for (auto& p: irradiance_probes)
+	{
+		computeProbeCoeffs(p);
+	}
+
+	probes_texture = new Texture(9, irradiance_probes.size(), GL_RGB, GL_FLOAT);
+	SphericalHarmonics* sh_data = nullptr;
+	sh_data = new SphericalHarmonics[irr_dim.x * irr_dim.y * irr_dim.z];
+
+	for (size_t i = 0; i < irradiance_probes.size(); i++)
+	{
+		sIrradianceProbe p = irradiance_probes.at(i);
+		sh_data[p.index] = p.sh;
+	}
+
+	sIrrHeader irr_header;
+	irr_header.start = irr_start_pos;
+	irr_header.end = irr_end_pos;
+	irr_header.dims = irr_dim;
+	irr_header.delta = irr_delta;
+	irr_header.num_probes = irr_dim.x * irr_dim.y * irr_dim.z;
+
+	FILE* f = fopen("irradiance.bin", "wb");
+	fwrite(&irr_header, sizeof(sIrrHeader), 1, f);
+	fwrite(&sh_data[0], sizeof(SphericalHarmonics), irradiance_probes.size(), f);
+	fclose(f);
+}
+
+void Renderer::computeProbeCoeffs(sIrradianceProbe& p)
+{
+	FloatImage images[6];
+
+	Camera cam;
+	cam.setPerspective(90, 1, 0.1f, 1000.0f);
+
+	for (int i = 0; i < 6; i++)
+	{
+		Vector3 eye = p.pos;
+		Vector3 front = cubemapFaceNormals[i][2];
+		Vector3 center = p.pos + front;
+		Vector3 up = cubemapFaceNormals[i][1];
+		cam.lookAt(eye, center, up);
+		cam.enable();
+
+		irr_fbo->bind();
+
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		//Scene::getInstance()->render()
+		Scene::getInstance()->renderForward(&cam, this);
+		irr_fbo->unbind();
+
+		images[i].fromTexture(irr_fbo->color_textures[0]);
+	}
+	
+	p.sh = computeSH(images);
+}
+
+void Renderer::renderShadowMap()
+{
+	for each (Light* light in Scene::getInstance()->lightEntities)
+	{
+		if (light->shadowMap && light->show_shadowMap)
+		{
+			glViewport(0, 0, 300, 300);
 			glDisable(GL_BLEND);
 			Shader* shader = Shader::Get("depth");
 			shader->enable();
@@ -721,98 +1296,810 @@ void Renderer::renderShadowMap()
 			if (light->light_type == lightType::SPOT || light->light_type == lightType::POINT_LIGHT)
 				light->shadowMap->toViewport(shader);
 			else
-				light->shadowMap->toViewport();
-			shader->disable();
-			glEnable(GL_BLEND);
+				light->shadowMap->toViewport();
+			shader->disable();
+			glEnable(GL_BLEND);
+		}
+		else if (light->show_camera)
+		{
+			glDisable(GL_BLEND);
+			glEnable(GL_DEPTH_TEST);
+			glViewport(0, 0, 300, 300);
+			light->camera->enable();
+			Scene::getInstance()->render(light->camera, this);
+		}
+	}
+}
+
+void Renderer::renderGBuffers(Camera* camera)
+{
+	float height = Application::instance->window_height;
+	float width = Application::instance->window_width;
+
+	if (show_GBuffers) {
+		glViewport(0, height * 0.5, width * 0.5, height * 0.5);
+		this->fbo->color_textures[0]->toViewport();
+		glViewport(width * 0.5, height * 0.5, width * 0.5, height * 0.5);
+		this->fbo->color_textures[1]->toViewport();
+		if (this->fbo->color_textures[2])
+		{
+			glViewport(0, 0, width * 0.5, height * 0.5);
+			this->fbo->color_textures[2]->toViewport();
+		}
+
+		//depth channel
+		glViewport(width * 0.5, 0, width * 0.5, height * 0.5);
+		Shader* depth_shader = Shader::Get("depth");
+		depth_shader->enable();
+		depth_shader->setUniform("u_camera_nearfar", Vector2(camera->near_plane, camera->far_plane));
+		this->fbo->depth_texture->toViewport(depth_shader);
+		depth_shader->disable();
+
+		glViewport(0, 0, width, height);	//restore viewport size
+	}
+}
+
+void Renderer::renderMeshInDeferred(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera)
+{
+
+	if (!mesh || !mesh->getNumVertices())
+		return;
+
+	Texture* color_texture = NULL;
+	Texture* emissive_texture = NULL;
+	Texture* metal_roughness_texture = NULL;
+
+	static UniformId u_gbuffer_packed("u_gbuffer_packed"), u_emissive("u_emissive"), u_model("u_model");
+	static UniformId u_viewprojection("u_viewprojection"), u_camera_pos("u_camera_pos"), u_color("u_color");
+	static UniformId u_metallic_factor("u_metallic_factor"), u_roughness_factor("u_roughness_factor");
+	static UniformId u_color_texture("u_color_texture"), u_metal_roughness_texture("u_metal_roughness_texture");
+
+	Shader* shader = Shader::Get("deferred");
+	if (!shader)
+		return;
+
+	color_texture = material->color_texture;
+	emissive_texture = material->emissive_texture;
+	metal_roughness_texture = material->metallic_roughness_texture;
+
+	shader->enable();
+
+	glEnable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+	glDepthFunc(GL_LEQUAL);
+
+	//packed gbuffers can not be blended, the shader uses alpha test instead
+	if (material->alpha_mode != GTR::AlphaMode::BLEND || fbo_format == GBUFFER_PACKED)
+		glDisable(GL_BLEND);
+	else {
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	}
+
+	shader->setUniform(u_gbuffer_packed, fbo_format == GBUFFER_PACKED);
+	shader->setUniform(u_emissive, emissive_texture != NULL || material->emissive_factor.length() > 0.0f);
+
+	//camera uniforms
+	shader->setUniform(u_model, model);
+	shader->setUniform(u_viewprojection, camera->viewprojection_matrix);
+	shader->setUniform(u_camera_pos, camera->eye);
+
+	//metal and roughness factors
+	shader->setUniform(u_metallic_factor, material->metallic_factor);
+	shader->setUniform(u_roughness_factor, material->roughness_factor);
+
+	//object uniforms
+	material->color = vec4(1.0, 1.0, 1.0, 1.0);
+	shader->setUniform(u_color, material->color);
+
+	shader->setUniform(u_color_texture, color_texture ? color_texture : Texture::getWhiteTexture(), 0);
+
+	shader->setUniform(u_metal_roughness_texture, metal_roughness_texture ? metal_roughness_texture : Texture::getRedTexture(), 1);
+
+	mesh->render(GL_TRIANGLES);
+
+	shader->disable();
+
+}
+
+//renders all the prefab entities of the scene, through the render queue when it is enabled
+void Renderer::renderScene(Camera* camera, bool main_view)
+{
+	Scene* scene = Scene::getInstance();
+
+	//the shadowmaps only need depth, the queue and the gpu scene have a depth only path for them
+	bool depth_only = shadow && use_depth_only_shadows;
+
+	if (use_gpu_culling && depth_only && GPUScene::isSupported())
+	{
+		renderGPUSceneShadow(camera);
+		return;
+	}
+	if (use_gpu_culling && deferred && GPUScene::isSupported())
+	{
+		renderGPUScene(camera, main_view);
+		return;
+	}
+
+	//the shadow casters always go through the queue so the repeated ones can be instanced
+	if (depth_only)
+	{
+		render_queue->clear();
+		render_queue->collecting = true;
+		if (use_bvh)
+			renderSceneBVH(camera);
+		else
+			for (PrefabEntity* e : scene->prefabEntities)
+				renderPrefabEntity(e, camera);
+		render_queue->collecting = false;
+
+		if (use_instancing)
+			render_queue->assignInstancing(min_instances);
+		else
+			render_queue->sort();
+		submitShadowQueue(camera);
+		return;
+	}
+
+	//the forward path still draws while traversing the nodes
+	if (!use_render_queue || !deferred)
+	{
+		if (use_bvh)
+			renderSceneBVH(camera);
+		else
+			for (PrefabEntity* e : scene->prefabEntities)
+				renderPrefabEntity(e, camera);
+		return;
+	}
+
+	if (main_view && use_occlusion_culling)
+		renderOccluders(camera);
+
+	render_queue->clear();
+	render_queue->collecting = true;
+	if (use_bvh)
+		renderSceneBVH(camera);
+	else
+		for (PrefabEntity* e : scene->prefabEntities)
+			renderPrefabEntity(e, camera);
+	render_queue->collecting = false;
+	if (occlusion_camera)
+		Profiler::setCounter("occlusion culled", occlusion_culler->num_culled);
+	occlusion_camera = NULL;
+
+	if (use_instancing)
+		render_queue->assignInstancing(min_instances);
+	else
+		render_queue->sort();
+	submitRenderQueue(camera);
+}
+
+//same as renderPrefab for all the prefabs, but the bvh rejects whole groups of nodes outside the frustum
+void Renderer::renderSceneBVH(Camera* camera)
+{
+	bvh->update(Scene::getInstance()->prefabEntities);
+
+	bvh_visible.clear();
+	bvh->cullFrustum(camera, bvh_visible);
+	for (int i = 0; i < bvh_visible.size(); ++i)
+	{
+		sBVHItem& item = bvh->items[bvh_visible[i]];
+		if (passesCasterFilter(item.entity))
+			renderVisibleNode(item.model, item.node, item.box, camera);
+	}
+
+	Profiler::addCounter("bvh nodes visited", bvh->num_visited);
+	Profiler::setCounter("bvh refits", bvh->num_refits);
+}
+
+//same test than Camera::testBoxInFrustum but with the planes of any frustum
+static bool isBoxInFrustum(const float planes[6][4], const BoundingBox& box)
+{
+	for (int p = 0; p < 6; ++p)
+	{
+		const float* plane = planes[p];
+		float radius = fabs(plane[0]) * box.halfsize.x + fabs(plane[1]) * box.halfsize.y + fabs(plane[2]) * box.halfsize.z;
+		if (plane[0] * box.center.x + plane[1] * box.center.y + plane[2] * box.center.z + plane[3] <= -radius)
+			return false;
+	}
+	return true;
+}
+
+//gathers the nodes that cast shadow in any of the views and the views each one touches. The candidates come from the
+//camera if there is one (the biggest cascade, it contains the others) or from the sphere (the range of a point light)
+void Renderer::collectShadowCasters(sShadowViews& views, Camera* camera, const Vector3& center, float radius)
+{
+	Scene* scene = Scene::getInstance();
+	shadow_casters.clear();
+
+	if (use_bvh)
+	{
+		bvh->update(scene->prefabEntities);
+		bvh_visible.clear();
+		if (camera)
+			bvh->cullFrustum(camera, bvh_visible);
+		else
+			bvh->queryRadius(center, radius, bvh_visible);
+		for (int i = 0; i < bvh_visible.size(); ++i)
+		{
+			sBVHItem& item = bvh->items[bvh_visible[i]];
+			sShadowCaster caster = { item.entity, item.world_index, 0 };
+			shadow_casters.push_back(caster);
+		}
+	}
+	else
+		for (PrefabEntity* e : scene->prefabEntities)
+		{
+			std::vector<PrefabEntity::sWorldNode>& nodes = e->getWorldNodes();
+			for (int i = 0; i < nodes.size(); ++i)
+			{
+				sShadowCaster caster = { e, i, 0 };
+				shadow_casters.push_back(caster);
+			}
+		}
+
+	int last = 0;
+	for (int i = 0; i < shadow_casters.size(); ++i)
+	{
+		sShadowCaster& caster = shadow_casters[i];
+		PrefabEntity::sWorldNode& node = caster.entity->getWorldNodes()[caster.world_index];
+		GTR::Material* material = node.node->material;
+		if (!node.visible || !node.node->mesh || !material || material->alpha_mode == GTR::AlphaMode::BLEND || !passesCasterFilter(caster.entity))
+			continue;
+		for (int j = 0; j < views.num; ++j)
+			if (isBoxInFrustum(views.frustums[j], node.box))
+				caster.views |= 1 << j;
+		if (caster.views)
+			shadow_casters[last++] = caster;
+	}
+	shadow_casters.resize(last);
+}
+
+//draws the collected casters in all the views of view_mask at once: every mesh is drawn instanced once for each view
+//it touches and the geometry shader sends each instance to the viewport of its view. The opaque casters go first with
+//positions only, then the alpha tested ones. Returns false if the GL version cant do it.
+bool Renderer::renderShadowViewsSinglePass(sShadowViews& views, int x, int y, int view_mask)
+{
+	Shader* shaders[2] = { Shader::Get("shadow_views"), Shader::Get("shadow_views_masked") };
+	if (!shaders[0] || !shaders[1])
+		return false;
+
+	for (int i = 0; i < views.num; ++i)
+	{
+		int* viewport = views.viewports[i];
+		glViewportIndexedf(i, (float)(x + viewport[0]), (float)(y + viewport[1]), (float)viewport[2], (float)viewport[3]);
+	}
+
+	glDisable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LEQUAL);
+
+	long instances = 0;
+	for (int alpha_tested = 0; alpha_tested < 2; ++alpha_tested)
+	{
+		Shader* shader = shaders[alpha_tested];
+		bool enabled = false;
+		for (sShadowCaster& caster : shadow_casters)
+		{
+			int view_list[MAX_SHADOW_VIEWS];
+			int num = 0;
+			for (int i = 0; i < views.num; ++i)
+				if (caster.views & view_mask & (1 << i))
+					view_list[num++] = i;
+			if (!num)
+				continue;
+
+			PrefabEntity::sWorldNode& node = caster.entity->getWorldNodes()[caster.world_index];
+			GTR::Material* material = node.node->material;
+			if (isAlphaTested(material) != (alpha_tested == 1))
+				continue;
+
+			if (!enabled)
+			{
+				shader->enable();
+				shader->setMatrix44Array("u_view_vps", views.viewprojections, views.num);
+				enabled = true;
+			}
+
+			if (material->two_sided)
+				glDisable(GL_CULL_FACE);
+			else
+				glEnable(GL_CULL_FACE);
+
+			shader->setUniform("u_model", node.model);
+			shader->setUniform1Array("u_views", view_list, num);
+			if (alpha_tested)
+			{
+				shader->setUniform("u_color", material->color);
+				shader->setUniform("u_color_texture", material->color_texture, 0);
+				shader->setUniform("u_alpha_cutoff", material->alpha_cutoff);
+				node.node->mesh->render(GL_TRIANGLES, -1, num);
+			}
+			else
+				node.node->mesh->renderPositions(GL_TRIANGLES, num);
+			instances += num;
 		}
-		else if (light->show_camera)
+		if (enabled)
+			shader->disable();
+	}
+
+	glDisable(GL_CULL_FACE);
+	Profiler::addCounter("shadow view instances", instances);
+	return true;
+}
+
+//rasterizes the biggest opaque meshes of the scene in the cpu depth buffer, the queue of this camera is tested against it
+void Renderer::renderOccluders(Camera* camera)
+{
+	occlusion_culler->setViewProjection(camera->viewprojection_matrix);
+	for (PrefabEntity* e : Scene::getInstance()->prefabEntities)
+	{
+		std::vector<PrefabEntity::sWorldNode>& nodes = e->getWorldNodes();
+		for (int i = 0; i < nodes.size(); ++i)
 		{
-			glDisable(GL_BLEND);
-			glEnable(GL_DEPTH_TEST);
-			glViewport(0, 0, 300, 300);
-			light->camera->enable();
-			Scene::getInstance()->render(light->camera, this);
+			Mesh* mesh = nodes[i].node->mesh;
+			if (!nodes[i].visible || nodes[i].node->material->alpha_mode != GTR::AlphaMode::NO_ALPHA || mesh->indices.size() > OCCLUDER_MAX_TRIANGLES)
+				continue;
+			if (nodes[i].box.halfsize.length() < occluder_min_size)
+				continue;
+
+			const Matrix44& model = nodes[i].model;
+			const unsigned int* indices = mesh->indices.size() ? (const unsigned int*)&mesh->indices[0] : NULL;
+			if (mesh->interleaved.size())
+				occlusion_culler->addOccluder(model, &mesh->interleaved[0].vertex.x, sizeof(Mesh::tInterleaved), (int)mesh->interleaved.size(), indices, (int)mesh->indices.size() * 3);
+			else if (mesh->vertices.size())
+				occlusion_culler->addOccluder(model, &mesh->vertices[0].x, sizeof(Vector3), (int)mesh->vertices.size(), indices, (int)mesh->indices.size() * 3);
 		}
 	}
+	occlusion_culler->render();
+	occlusion_camera = camera;
+
+	Profiler::setCounter("occluder triangles", occlusion_culler->num_triangles);
 }
 
-void Renderer::renderGBuffers(Camera* camera)
+void Renderer::buildGPUScene()
 {
-	float height = Application::instance->window_height;
-	float width = Application::instance->window_width;
+	std::vector<Matrix44> models;
+	std::vector<bool> static_nodes;
+	gpu_scene_entities = Scene::getInstance()->prefabEntities;
+	gpu_scene_versions.clear();
+	gpu_scene_static.clear();
+	gpu_scene_first.clear();
+	gpu_scene_nodes.clear();
+	for (PrefabEntity* e : gpu_scene_entities)
+	{
+		gpu_scene_first.push_back((int)gpu_scene_nodes.size());
+		for (PrefabEntity::sWorldNode& world_node : e->getWorldNodes())
+			if (world_node.visible)
+			{
+				models.push_back(world_node.model);
+				gpu_scene_nodes.push_back(world_node.node);
+				static_nodes.push_back(e->is_static);
+			}
+		gpu_scene_versions.push_back(e->world_version);
+		gpu_scene_static.push_back(e->is_static);
+	}
+	gpu_scene_first.push_back((int)gpu_scene_nodes.size());
+	gpu_scene->build(models, gpu_scene_nodes, static_nodes);
+}
 
-	if (show_GBuffers) {
-		glViewport(0, height * 0.5, width * 0.5, height * 0.5);
-		this->fbo->color_textures[0]->toViewport();
-		glViewport(width * 0.5, height * 0.5, width * 0.5, height * 0.5);
-		this->fbo->color_textures[1]->toViewport();
-		glViewport(0, 0, width * 0.5, height * 0.5);
-		this->fbo->color_textures[2]->toViewport();
+//entities that moved or changed between static and dynamic rewrite their instances, the scene is only rebuilt if the entities or their visible nodes change
+void Renderer::updateGPUScene()
+{
+	std::vector<PrefabEntity*>& entities = Scene::getInstance()->prefabEntities;
+	if (!gpu_scene->isBuilt() || entities != gpu_scene_entities)
+	{
+		buildGPUScene();
+		return;
+	}
 
-		//depth channel
-		glViewport(width * 0.5, 0, width * 0.5, height * 0.5);
-		Shader* depth_shader = Shader::Get("depth");
-		depth_shader->enable();
-		depth_shader->setUniform("u_camera_nearfar", Vector2(camera->near_plane, camera->far_plane));
-		this->fbo->depth_texture->toViewport(depth_shader);
-		depth_shader->disable();
+	for (int i = 0; i < entities.size(); ++i)
+	{
+		PrefabEntity* e = entities[i];
+		std::vector<PrefabEntity::sWorldNode>& world_nodes = e->getWorldNodes();	//recomputed here if it is dirty
+		if (e->world_version == gpu_scene_versions[i] && e->is_static == gpu_scene_static[i])
+			continue;
 
-		glViewport(0, 0, width, height);	//restore viewport size
+		int index = gpu_scene_first[i];
+		for (PrefabEntity::sWorldNode& world_node : world_nodes)
+		{
+			if (!world_node.visible)
+				continue;
+			if (index == gpu_scene_first[i + 1] || gpu_scene_nodes[index] != world_node.node)
+			{
+				buildGPUScene();
+				return;
+			}
+			index++;
+		}
+		if (index != gpu_scene_first[i + 1])
+		{
+			buildGPUScene();
+			return;
+		}
+
+		index = gpu_scene_first[i];
+		for (PrefabEntity::sWorldNode& world_node : world_nodes)
+			if (world_node.visible)
+				gpu_scene->updateInstance(index++, world_node.model, world_node.box, e->is_static);
+		gpu_scene_versions[i] = e->world_version;
+		gpu_scene_static[i] = e->is_static;
+		Profiler::addCounter("gpu instance updates", gpu_scene_first[i + 1] - gpu_scene_first[i]);
 	}
 }
 
-void Renderer::renderMeshInDeferred(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera)
+//culls all the instances in a compute shader and draws every material with one indirect call
+void Renderer::renderGPUScene(Camera* camera, bool main_view)
 {
+	static UniformId u_gbuffer_packed("u_gbuffer_packed"), u_viewprojection("u_viewprojection"), u_camera_pos("u_camera_pos");
+	static UniformId u_color("u_color"), u_emissive("u_emissive");
+	static UniformId u_metallic_factor("u_metallic_factor"), u_roughness_factor("u_roughness_factor");
+	static UniformId u_color_texture("u_color_texture"), u_metal_roughness_texture("u_metal_roughness_texture");
 
-	if (!mesh || !mesh->getNumVertices())
+	updateGPUScene();
+
+	Shader* shader = Shader::Get("deferred_instanced");
+	if (!shader || !gpu_scene->isBuilt())
 		return;
 
-	Texture* color_texture = NULL;
-	Texture* emissive_texture = NULL;
-	Texture* metal_roughness_texture = NULL;
+	gpu_scene->cull(camera, main_view, caster_filter);
 
-	Shader* shader = Shader::Get("deferred");
-	if (!shader)
+	glEnable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+	glDepthFunc(GL_LEQUAL);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	shader->enable();
+	shader->setUniform(u_gbuffer_packed, fbo_format == GBUFFER_PACKED);
+	shader->setUniform(u_viewprojection, camera->viewprojection_matrix);
+	shader->setUniform(u_camera_pos, camera->eye);
+	shader->setUniform(u_color, vec4(1.0, 1.0, 1.0, 1.0));
+
+	gpu_scene->enableBuffers(shader);
+	for (int i = 0; i < gpu_scene->batches.size(); ++i)
+	{
+		GTR::Material* material = gpu_scene->batches[i].material;
+
+		//packed gbuffers can not be blended, the shader uses alpha test instead
+		if (material->alpha_mode == GTR::AlphaMode::BLEND && fbo_format != GBUFFER_PACKED)
+			glEnable(GL_BLEND);
+		else
+			glDisable(GL_BLEND);
+
+		shader->setUniform(u_emissive, material->emissive_texture != NULL || material->emissive_factor.length() > 0.0f);
+		shader->setUniform(u_metallic_factor, material->metallic_factor);
+		shader->setUniform(u_roughness_factor, material->roughness_factor);
+		shader->setUniform(u_color_texture, material->color_texture ? material->color_texture : Texture::getWhiteTexture(), 0);
+		shader->setUniform(u_metal_roughness_texture, material->metallic_roughness_texture ? material->metallic_roughness_texture : Texture::getRedTexture(), 1);
+
+		gpu_scene->drawBatch(i);
+	}
+	gpu_scene->disableBuffers();
+	shader->disable();
+	glDisable(GL_BLEND);
+
+	Profiler::setCounter("gpu instances", gpu_scene->num_instances);
+	Profiler::setCounter("gpu visible (last cull)", gpu_scene->num_visible);
+	Profiler::addCounter("gpu indirect draw calls", (long)gpu_scene->batches.size());
+}
+
+//depth only draw of the gpu scene for a shadow view: the pyramid is from the main camera so the cull only tests the
+//frustum of the light, the caster filter of the cached shadowmaps is applied by the compute shader
+void Renderer::renderGPUSceneShadow(Camera* camera)
+{
+	static UniformId u_viewprojection("u_viewprojection"), u_color("u_color");
+	static UniformId u_color_texture("u_color_texture"), u_alpha_cutoff("u_alpha_cutoff");
+
+	updateGPUScene();
+
+	Shader* shaders[2] = { Shader::Get("shadow_instanced"), Shader::Get("shadow_instanced_masked") };
+	if (!shaders[0] || !shaders[1] || !gpu_scene->isBuilt())
 		return;
 
-	color_texture = material->color_texture;
-	emissive_texture = material->emissive_texture;
-	metal_roughness_texture = material->metallic_roughness_texture;
+	gpu_scene->cull(camera, false, caster_filter);
 
-	shader->enable();
+	glDisable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LEQUAL);
+
+	long draw_calls = 0;
+	Shader* shader = NULL;
+	for (int i = 0; i < gpu_scene->batches.size(); ++i)
+	{
+		GTR::Material* material = gpu_scene->batches[i].material;
+		if (material->alpha_mode == GTR::AlphaMode::BLEND)	//blended materials dont cast shadows
+			continue;
+
+		//the batches are sorted by material, so the shader only changes between opaque and alpha tested ones
+		bool alpha_tested = isAlphaTested(material);
+		if (shaders[alpha_tested] != shader)
+		{
+			if (shader)
+			{
+				gpu_scene->disableBuffers();
+				shader->disable();
+			}
+			shader = shaders[alpha_tested];
+			shader->enable();
+			shader->setUniform(u_viewprojection, camera->viewprojection_matrix);
+			gpu_scene->enableBuffers(shader);
+		}
+
+		if (material->two_sided)
+			glDisable(GL_CULL_FACE);
+		else
+			glEnable(GL_CULL_FACE);
+
+		if (alpha_tested)
+		{
+			shader->setUniform(u_color, material->color);
+			shader->setUniform(u_color_texture, material->color_texture, 0);
+			shader->setUniform(u_alpha_cutoff, material->alpha_cutoff);
+		}
+
+		gpu_scene->drawBatch(i);
+		draw_calls++;
+	}
+	if (shader)
+	{
+		gpu_scene->disableBuffers();
+		shader->disable();
+	}
+	glDisable(GL_CULL_FACE);
+
+	Profiler::addCounter("gpu shadow indirect draw calls", draw_calls);
+}
+
+//draws the sorted items setting only the state that changed from the previous item
+void Renderer::submitRenderQueue(Camera* camera)
+{
+	static UniformId u_gbuffer_packed("u_gbuffer_packed"), u_viewprojection("u_viewprojection"), u_camera_pos("u_camera_pos");
+	static UniformId u_color("u_color"), u_emissive("u_emissive"), u_model("u_model");
+	static UniformId u_metallic_factor("u_metallic_factor"), u_roughness_factor("u_roughness_factor");
+	static UniformId u_color_texture("u_color_texture"), u_metal_roughness_texture("u_metal_roughness_texture");
+
+	Shader* shaders[2] = { Shader::Get("deferred"), Shader::Get("deferred_instanced") };
+	if (!shaders[QUEUESHADER_DEFAULT] || render_queue->items.empty())
+		return;
+
+	long material_binds = 0, material_binds_skipped = 0;
+	long texture_binds = 0, texture_binds_skipped = 0;
+	long mesh_binds = 0, mesh_binds_skipped = 0;
+	long blend_changes = 0, blend_changes_skipped = 0;
+	long shader_binds = 0, draw_calls = 0, instanced_draws = 0;
 
+	//state shared by all the items, set once per pass
 	glEnable(GL_DEPTH_TEST);
 	glDisable(GL_CULL_FACE);
 	glDepthFunc(GL_LEQUAL);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glDisable(GL_BLEND);
 
-	if (material->alpha_mode != GTR::AlphaMode::BLEND)
-		glDisable(GL_BLEND);
-	else {
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	bool blending = false;
+	Shader* shader = NULL;
+	GTR::Material* current_material = NULL;
+	Mesh* current_mesh = NULL;
+	Texture* current_textures[2] = { NULL, NULL };
+
+	std::vector<sDrawItem>& items = render_queue->items;
+	size_t i = 0;
+	while (i < items.size())
+	{
+		sDrawItem& item = items[i];
+		Mesh* mesh = item.mesh;
+		GTR::Material* material = item.material;
+
+		//amount of consecutive items drawn by this call
+		size_t count = 1;
+		if (item.shader_id == QUEUESHADER_INSTANCED)
+			while (i + count < items.size() && items[i + count].mesh == mesh && items[i + count].material == material)
+				count++;
+
+		if (!mesh->getNumVertices())
+		{
+			i += count;
+			continue;
+		}
+
+		//instanced items are sorted after the regular ones, so this only happens once per pass
+		Shader* item_shader = shaders[item.shader_id];
+		if (!item_shader)
+			item_shader = shaders[QUEUESHADER_DEFAULT];
+		if (item_shader != shader)
+		{
+			if (current_mesh)
+				current_mesh->disableBuffers(shader);
+			shader = item_shader;
+			shader->enable();
+			shader->setUniform(u_gbuffer_packed, fbo_format == GBUFFER_PACKED);
+			shader->setUniform(u_viewprojection, camera->viewprojection_matrix);
+			shader->setUniform(u_camera_pos, camera->eye);
+			shader->setUniform(u_color, vec4(1.0, 1.0, 1.0, 1.0));
+			current_material = NULL;
+			current_mesh = NULL;
+			current_textures[0] = current_textures[1] = NULL;
+			shader_binds++;
+		}
+
+		if (material != current_material)
+		{
+			//packed gbuffers can not be blended, the shader uses alpha test instead
+			bool blend = material->alpha_mode == GTR::AlphaMode::BLEND && fbo_format != GBUFFER_PACKED;
+			if (blend != blending)
+			{
+				if (blend)
+					glEnable(GL_BLEND);
+				else
+					glDisable(GL_BLEND);
+				blending = blend;
+				blend_changes++;
+			}
+			else
+				blend_changes_skipped++;
+
+			material->color = vec4(1.0, 1.0, 1.0, 1.0);
+			shader->setUniform(u_emissive, material->emissive_texture != NULL || material->emissive_factor.length() > 0.0f);
+			shader->setUniform(u_metallic_factor, material->metallic_factor);
+			shader->setUniform(u_roughness_factor, material->roughness_factor);
+
+			Texture* textures[2] = {
+				material->color_texture ? material->color_texture : Texture::getWhiteTexture(),
+				material->metallic_roughness_texture ? material->metallic_roughness_texture : Texture::getRedTexture() };
+			if (textures[0] != current_textures[0])
+			{
+				shader->setUniform(u_color_texture, textures[0], 0);
+				texture_binds++;
+			}
+			else
+				texture_binds_skipped++;
+			if (textures[1] != current_textures[1])
+			{
+				shader->setUniform(u_metal_roughness_texture, textures[1], 1);
+				texture_binds++;
+			}
+			else
+				texture_binds_skipped++;
+			current_textures[0] = textures[0];
+			current_textures[1] = textures[1];
+
+			current_material = material;
+			material_binds++;
+		}
+		else
+			material_binds_skipped++;
+
+		if (shader == shaders[QUEUESHADER_INSTANCED])
+		{
+			//renderInstanced binds its own buffers
+			if (current_mesh)
+				current_mesh->disableBuffers(shader);
+			current_mesh = NULL;
+
+			std::vector<Matrix44>& models = render_queue->instance_models;
+			models.resize(count);
+			for (size_t j = 0; j < count; ++j)
+				models[j] = items[i + j].model;
+			mesh->renderInstanced(GL_TRIANGLES, &models[0], (int)count);
+			instanced_draws++;
+		}
+		else
+		{
+			if (mesh != current_mesh)
+			{
+				if (current_mesh)
+					current_mesh->disableBuffers(shader);
+				mesh->enableBuffers(shader);
+				current_mesh = mesh;
+				mesh_binds++;
+			}
+			else
+				mesh_binds_skipped++;
+
+			shader->setUniform(u_model, item.model);
+			mesh->drawCall(GL_TRIANGLES, -1, 0);
+		}
+
+		draw_calls++;
+		i += count;
 	}
 
-	//camera uniforms
-	shader->setUniform("u_model", model);
-	shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
-	shader->setUniform("u_camera_pos", camera->eye);
+	if (current_mesh)
+		current_mesh->disableBuffers(shader);
+	if (shader)
+		shader->disable();
+	glDisable(GL_BLEND);
 
-	//metal and roughness factors
-	shader->setUniform("u_metallic_factor", material->metallic_factor);
-	shader->setUniform("u_roughness_factor", material->roughness_factor);
+	//without the queue every item enables the shader and sets depth, cull and blend state
+	long shader_binds_skipped = (long)items.size() - shader_binds;
+	Profiler::addCounter("queue items", (long)items.size());
+	Profiler::addCounter("queue draw calls", draw_calls);
+	Profiler::addCounter("queue instanced draws", instanced_draws);
+	Profiler::addCounter("queue material binds", material_binds);
+	Profiler::addCounter("queue texture binds", texture_binds);
+	Profiler::addCounter("queue mesh binds", mesh_binds);
+	Profiler::addCounter("queue blend changes", blend_changes);
+	Profiler::addCounter("state changes avoided", shader_binds_skipped + material_binds_skipped +
+		texture_binds_skipped + mesh_binds_skipped + blend_changes_skipped);
+}
 
-	//object uniforms
-	material->color = vec4(1.0, 1.0, 1.0, 1.0);
-	shader->setUniform("u_color", material->color);
+//depth only version of submitRenderQueue: the instanced groups are drawn with the positions and the per instance model,
+//the rest go one by one through renderMeshShadow
+void Renderer::submitShadowQueue(Camera* camera)
+{
+	static UniformId u_viewprojection("u_viewprojection"), u_color("u_color");
+	static UniformId u_color_texture("u_color_texture"), u_alpha_cutoff("u_alpha_cutoff");
 
-	shader->setUniform("u_color_texture", color_texture ? color_texture : Texture::getWhiteTexture(), 0);
+	glDisable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LEQUAL);
 
-	shader->setUniform("u_metal_roughness_texture", metal_roughness_texture ? metal_roughness_texture : Texture::getRedTexture(), 1);
+	std::vector<sDrawItem>& items = render_queue->items;
+	long draw_calls = 0;
+	long instanced_draws = 0;
 
-	mesh->render(GL_TRIANGLES);
+	size_t i = 0;
+	while (i < items.size())
+	{
+		sDrawItem& item = items[i];
+		if (item.pass == RENDERPASS_BLEND)	//blended materials dont cast shadows
+		{
+			i++;
+			continue;
+		}
+		if (item.shader_id != QUEUESHADER_INSTANCED)
+		{
+			renderMeshShadow(item.model, item.mesh, item.material, camera);
+			draw_calls++;
+			i++;
+			continue;
+		}
 
-	shader->disable();
+		//assignInstancing left the items of every group next to each other
+		size_t count = 1;
+		while (i + count < items.size() && items[i + count].shader_id == QUEUESHADER_INSTANCED &&
+			items[i + count].mesh == item.mesh && items[i + count].material == item.material)
+			count++;
+
+		bool alpha_tested = isAlphaTested(item.material);
+		Shader* shader = Shader::Get(alpha_tested ? "shadow_instanced_masked" : "shadow_instanced");
+		if (shader && item.mesh->getNumVertices())
+		{
+			if (shader != Shader::current)
+			{
+				shader->enable();
+				shader->setUniform(u_viewprojection, camera->viewprojection_matrix);
+			}
+
+			if (item.material->two_sided)
+				glDisable(GL_CULL_FACE);
+			else
+				glEnable(GL_CULL_FACE);
+
+			if (alpha_tested)
+			{
+				shader->setUniform(u_color, item.material->color);
+				shader->setUniform(u_color_texture, item.material->color_texture, 0);
+				shader->setUniform(u_alpha_cutoff, item.material->alpha_cutoff);
+			}
+
+			std::vector<Matrix44>& models = render_queue->instance_models;
+			models.resize(count);
+			for (size_t j = 0; j < count; ++j)
+				models[j] = items[i + j].model;
+			item.mesh->renderInstanced(GL_TRIANGLES, &models[0], (int)count, !alpha_tested);
+			draw_calls++;
+			instanced_draws++;
+		}
+		i += count;
+	}
+
+	if (Shader::current)	//left enabled by renderMeshShadow
+		Shader::current->disable();
+	glDisable(GL_CULL_FACE);
 
+	Profiler::addCounter("shadow queue items", (long)items.size());
+	Profiler::addCounter("shadow draw calls", draw_calls);
+	Profiler::addCounter("shadow instanced draws", instanced_draws);
 }
 
 void GTR::Renderer::renderIrradianceProbes(Vector3 pos, float size, float* coeffs)
@@ -837,7 +2124,9 @@ void GTR::Renderer::renderIrradianceProbes(Vector3 pos, float size, float* coeff
 void Renderer::renderReflectionProbe(sReflectionProbe* p, Camera* camera)
 {
 	
-	Shader* shader = Shader::Get("skybox");
+	Shader* shader = Shader::Get("reflection_probe");
+	if (!reflection_probes->cubemap_array)
+		return;
 
 	glDisable(GL_BLEND);
 	glDisable(GL_CULL_FACE);
@@ -851,7 +2140,8 @@ void Renderer::renderReflectionProbe(sReflectionProbe* p, Camera* camera)
 	shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
 	shader->setUniform("u_camera_position", camera->eye);
 	shader->setUniform("u_model", model);
-	shader->setUniform("u_texture", p->cubemap, 0);
+	shader->setUniform("u_probes_texture", reflection_probes->cubemap_array, 0);
+	shader->setUniform("u_probe_index", (float)p->index);
 
 	Mesh::Get("data/meshes/sphere.obj")->render(GL_TRIANGLES);
 
@@ -915,38 +2205,7 @@ void Renderer::renderSkybox(Camera* camera)
 
 void Renderer::computeReflection()
 {
-	for(auto probe : reflection_probes)
-	{
-		computeProbeReflection(probe);
-	}
-}
-
-void Renderer::computeProbeReflection(sReflectionProbe* p)
-{
-	Camera cam;
-	cam.setPerspective(90, 1, 0.1f, 1000.0f);
-
-	for(int i = 0; i < 6; ++i)
-	{
-		//assign cubemap face to FBO
-		reflections_fbo->setTexture(p->cubemap, i);
-
-		//bind FBO
-		reflections_fbo->bind();
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		
-		//render view
-		Vector3 eye = p->pos;
-		Vector3 center = p->pos + cubemapFaceNormals[i][2];
-		Vector3 up = cubemapFaceNormals[i][1];
-		cam.lookAt(eye, center, up);
-		cam.enable();
-		Scene::getInstance()->render(&cam, this);
-		reflections_fbo->unbind();
-	}
-
-	//generate the mipmaps
-	p->cubemap->generateMipmaps();
+	reflection_probes->captureAll(this);
 }
 
 int Renderer::numLightsVisible()
@@ -962,7 +2221,7 @@ int Renderer::numLightsVisible()
 	return count;
 }
 
-Texture* GTR::CubemapFromHDRE(const char* filename)
+Texture* GTR::CubemapFromHDRE(const char* filename, bool hdre_levels)
 {
 	HDRE* hdre = new HDRE();
 	if (!hdre->load(filename))
@@ -973,6 +2232,11 @@ Texture* GTR::CubemapFromHDRE(const char* filename)
 
 	Texture* texture = new Texture();
 	texture->createCubemap(hdre->width, hdre->height, (Uint8**)hdre->getFaces(0), hdre->header.numChannels == 3 ? GL_RGB : GL_RGBA, GL_FLOAT);
+	if (!hdre_levels)
+	{
+		texture->generateMipmaps();
+		return texture;
+	}
 	for (int i = 1; i < 6; ++i)
 		texture->uploadCubemap(texture->format, texture->type, false, (Uint8**)hdre->getFaces(i), GL_RGBA32F, i);
 	return texture;
@@ -1026,11 +2290,100 @@ bool Renderer::loadIrradiance(const char* filename)
 
 void Renderer::renderOptionsInMenu() {
 	ImGui::Checkbox("Real Time Shadows", &use_realtime_shadows);
+	if (use_realtime_shadows)
+	{
+		ImGui::Checkbox("Cache static shadows", &use_shadow_cache);
+		ImGui::Checkbox("Shadow atlas", &use_shadow_atlas);
+		if (Shader::isViewportArraySupported())
+			ImGui::Checkbox("Single pass cascades and cube faces", &use_single_pass_shadows);
+		ImGui::Checkbox("Depth only shadow shaders", &use_depth_only_shadows);
+		if (use_shadow_atlas)
+			ImGui::Text("Atlas tiles: %d (%d repacks)", shadow_atlas->num_tiles, shadow_atlas->num_repacks);
+	}
 	ImGui::Checkbox("Ambient Occlusion", &Scene::getInstance()->ambient_occlusion);
+	ImGui::Combo("AO resolution", &ao_mode, "Full (64 samples)\0Half (16 interleaved samples)\0");
+	if (ImGui::Checkbox("Temporal AO and volumetric", &use_temporal))
+	{
+		ao_temporal->reset();
+		volumetric_temporal->reset();
+	}
+	if (use_temporal)
+	{
+		ImGui::SliderInt("Temporal history", &ao_temporal->max_history, 1, 64);
+		volumetric_temporal->max_history = ao_temporal->max_history;
+	}
 
 	ImGui::Checkbox("Use Deferred", &use_deferred);
 	ImGui::Checkbox("Use Volumetric", &use_volumetric);
+	if (use_volumetric)
+	{
+		ImGui::Combo("Volumetric mode", &volumetric_mode, "Ray march (sun)\0Froxels (shadowed lights)\0");
+		if (volumetric_mode == VOLUMETRIC_FROXELS)
+		{
+			ImGui::SliderFloat("Fog density", &froxels->density, 0.0f, 0.005f, "%.5f");
+			ImGui::SliderFloat("Fog intensity", &froxels->intensity, 0.0f, 1.0f);
+			ImGui::Text("Froxels %dx%dx%d, %d lights", FROXELS_X, FROXELS_Y, FROXELS_Z, froxels->num_lights);
+		}
+	}
+	if (ReflectionProbes::isSupported())
+	{
+		ImGui::SliderInt("Probe faces per frame", &reflection_probes->faces_per_frame, 0, 6);
+		ImGui::Text("Reflection probes: %d of %d, %d faces this frame", (int)reflection_probes->probes.size(), MAX_REFLECTION_PROBES, reflection_probes->faces_rendered);
+		if (ImGui::Button("Add reflection probe at camera"))
+			reflection_probes->addProbe(Camera::current->eye, Vector3(250, 250, 250));
+	}
 	ImGui::Checkbox("Use Decals", &use_decals);
+	if (use_decals)
+	{
+		ImGui::Text("Decals: %d visible, %d cluster refs, %d textures", decals->num_decals, decals->num_indices, decals->num_slots);
+		ImGui::SliderInt("Benchmark decals", &benchmark_decals, 1, MAX_DECALS);
+		if (ImGui::Button("Generate benchmark decals"))
+			Scene::getInstance()->generateBenchmarkDecals(benchmark_decals);
+	}
+	if (GPUScene::isSupported())
+	{
+		ImGui::Checkbox("GPU culling (indirect)", &use_gpu_culling);
+		if (use_gpu_culling)
+		{
+			ImGui::Checkbox("Hi-Z occlusion", &gpu_scene->use_hiz);
+			if (ImGui::Button("Rebuild GPU scene"))
+				buildGPUScene();
+		}
+	}
+	else
+		ImGui::Text("GPU culling needs OpenGL 4.3");
+	ImGui::Checkbox("Use BVH culling", &use_bvh);
+	if (use_bvh)
+	{
+		ImGui::Text("BVH: %d items, %d nodes", (int)bvh->items.size(), (int)bvh->nodes.size());
+		ImGui::Checkbox("Traverse BVH (off: cull all the boxes in batches)", &bvh->use_tree);
+		if (ImGui::Button("Rebuild BVH"))	//refitting keeps the topology, rebuilding improves it after big moves
+			bvh->build(Scene::getInstance()->prefabEntities);
+	}
+	ImGui::Checkbox("Use render queue", &use_render_queue);
+	if (use_render_queue)
+	{
+		ImGui::Checkbox("Use instancing", &use_instancing);
+		ImGui::SliderInt("Min instances", &min_instances, 2, 16);
+		ImGui::Checkbox("CPU occlusion culling", &use_occlusion_culling);
+		if (use_occlusion_culling)
+		{
+			ImGui::SliderFloat("Occluder min size", &occluder_min_size, 1.0f, 500.0f);
+			ImGui::SliderInt("Occlusion threads", &occlusion_culler->num_threads, 1, OCCLUSION_MAX_THREADS);
+			ImGui::Text("Occlusion: %d triangles, %d of %d culled", occlusion_culler->num_triangles, occlusion_culler->num_culled, occlusion_culler->num_tested);
+		}
+	}
+
+	ImGui::Combo("GBuffer format", &gbuffer_format, "Classic (3 x RGB8)\0Packed (2 x RGBA8)\0");
+	ImGui::Text("GBuffer: %.1f MB at 1080p, %.1f MB at 4K", 1920 * 1080 * getGBufferBytesPerPixel() / (1024.0f * 1024.0f),
+		3840 * 2160 * getGBufferBytesPerPixel() / (1024.0f * 1024.0f));
+
+	ImGui::Combo("Light pass", &light_pass_mode, "Multipass\0Clustered\0Light volumes\0Single pass\0");
+	if (light_pass_mode == LIGHTPASS_VOLUMES)
+		ImGui::Checkbox("Split quads | volumes", &light_volumes_split);
+	ImGui::SliderInt("Benchmark lights", &benchmark_lights, 6, MAX_CLUSTERED_LIGHTS);
+	if (ImGui::Button("Generate benchmark lights"))
+		Scene::getInstance()->generateBenchmarkLights(benchmark_lights, shadow_atlas);
 
 	ImGui::Checkbox("Show AO", &show_ao);
 	ImGui::Checkbox("Show GBuffers", &show_GBuffers);
@@ -5,6 +5,9 @@
 
 //forward declarations
 class Camera;
+class Shader;
+class Light;
+class PrefabEntity;
 
 struct sIrradianceProbe {
 	Vector3 pos;
@@ -15,7 +18,43 @@ struct sIrradianceProbe {
 
 struct sReflectionProbe {
 	Vector3 pos;
-	Texture* cubemap = NULL;
+	Vector3 extents;	//half size of the influence box centered at pos
+	int index = 0;	//cubemap of the probe in the array of GTR::ReflectionProbes
+	int next_face = 0;	//face of the capture in progress
+	long last_capture = -1;	//update of the last complete capture, -1 if it was never captured
+};
+
+#define MAX_UBO_LIGHTS 64
+#define OCCLUDER_MAX_TRIANGLES 20000	//bigger meshes are too slow to rasterize on the cpu
+#define UBO_CASCADE_SHADOW_SLOT 4	//the cascaded light uses the regular shadowmap slot
+#define UBO_SHADOW_SLOTS 4
+#define UBO_ATLAS_SHADOW_SLOT 5	//lights with a tile in the shadow atlas, there is no limit for them
+
+//light as stored in the uniform buffer of the single pass shader (std140 layout)
+struct sLightUBOData {
+	Vector4 position_maxdist;
+	Vector4 color_intensity;
+	Vector4 direction_type;
+	Vector4 spot_shadow;	//cos outer, cos inner, shadow slot (-1 without shadow), bias
+	Vector4 shadow_rect;	//offset and scale of the shadowmap in its texture
+	Matrix44 shadow_viewprojection;
+};
+
+#define MAX_SHADOW_VIEWS 6
+
+//cascades of a directional light or faces of a point light, drawn together by Renderer::renderShadowViewsSinglePass
+struct sShadowViews {
+	int num;
+	Matrix44 viewprojections[MAX_SHADOW_VIEWS];
+	float frustums[MAX_SHADOW_VIEWS][6][4];
+	int viewports[MAX_SHADOW_VIEWS][4];	//relative to the corner of the shadowmap
+};
+
+//node of an entity that casts shadow in some of the views
+struct sShadowCaster {
+	PrefabEntity* entity;
+	int world_index;	//in the world nodes of the entity
+	int views;	//bit mask of the views its box touches
 };
 
 struct sIrrHeader {
@@ -30,14 +69,57 @@ namespace GTR {
 
 	class Prefab;
 	class Material;
+	class LightClusters;
+	class RenderQueue;
+	class GPUScene;
+	class OcclusionCuller;
+	class SceneBVH;
+	class ShadowAtlas;
+	class TemporalAccumulator;
+	class FroxelVolume;
+	class DecalSystem;
+	class ReflectionProbes;
+
+	//layout of the gbuffers
+	enum eGBufferFormat {
+		GBUFFER_CLASSIC,	//color | normal xyz | occlusion, roughness, metalness (3 x RGB8)
+		GBUFFER_PACKED		//color + occlusion | octahedral normal, roughness, metalness + emissive (2 x RGBA8)
+	};
+
+	//how the deferred light pass accumulates the lights
+	enum eLightPassMode {
+		LIGHTPASS_MULTIPASS,	//one fullscreen quad per light with additive blending
+		LIGHTPASS_CLUSTERED,	//one fullscreen quad, every pixel iterates the lights of its cluster
+		LIGHTPASS_VOLUMES,		//point and spot lights rasterize a sphere or cone proxy
+		LIGHTPASS_SINGLEPASS	//one fullscreen quad, all the lights read from a uniform buffer
+	};
 	
+	//resolution of the ambient occlusion pass
+	enum eAOMode {
+		AO_FULL,	//64 samples per pixel and three 5x5 blurs at full resolution
+		AO_HALF		//16 interleaved samples per pixel at half resolution, depth aware blur and bilateral upsample
+	};
+
+	//how the volumetric light is computed
+	enum eVolumetricMode {
+		VOLUMETRIC_RAYMARCH,	//64 shadowmap lookups per pixel along the view ray, only the sun
+		VOLUMETRIC_FROXELS		//3d grid with the light of all the shadowed lights, one fetch per pixel
+	};
+
+	//entities drawn by renderScene, the cached shadowmaps draw the static and the dynamic casters separately
+	enum eCasterFilter {
+		CASTERS_ALL,
+		CASTERS_STATIC,
+		CASTERS_DYNAMIC
+	};
+
 	// This class is in charge of rendering anything in our system.
 	// Separating the render from anything else makes the code cleaner
 	class Renderer
 	{
 
 	public:
-		bool shadow;
+		bool shadow;	//rendering the shadowmaps
 		bool deferred;
 
 		bool use_ao;
@@ -60,17 +142,17 @@ namespace GTR {
 		FBO* fbo;
 		FBO* ssao_fbo;
 		FBO* irr_fbo;
-		FBO* reflections_fbo;
 		Texture* blur_texture;
 		Texture* probes_texture;
 		Texture* environment;
-		Texture* aux_texture;
+		Texture* specular_environment;	//environment prefiltered with GGX for the reflection pass
+		Texture* brdf_lut;
 
 		Mesh* cube;
 
 		std::vector<Vector3> points;
 		std::vector<sIrradianceProbe> irradiance_probes;
-		std::vector<sReflectionProbe*> reflection_probes;
+		ReflectionProbes* reflection_probes;
 
 		Vector3 irr_start_pos;
 		Vector3 irr_end_pos;
@@ -79,16 +161,93 @@ namespace GTR {
 		int irr_num_probes;
 		float irr_factor;
 
+		int gbuffer_format;	//eGBufferFormat
+		int fbo_format;	//format of the gbuffers already created
+
+		int light_pass_mode;	//eLightPassMode
+		LightClusters* light_clusters;
+		int benchmark_lights;	//amount of lights generated by the light benchmark
+		bool light_volumes_split;	//A/B: left half of the screen uses quads, right half uses volumes
+		FBO* illumination_fbo;	//shares the depth of the gbuffers so the volumes can be depth tested
+		Mesh* sphere;
+		Mesh* cone;
+		GLuint lights_ubo;	//uniform buffer with all the lights for the single pass shader
+		int lights_ubo_batches;	//blocks of MAX_UBO_LIGHTS it can hold
+
+		bool use_render_queue;	//sort the draw calls by state instead of drawing while traversing the prefabs
+		RenderQueue* render_queue;
+		bool use_instancing;	//repeated (mesh, material) pairs of the queue are drawn with one instanced call
+		int min_instances;	//repetitions needed to use the instanced shader
+		bool use_gpu_culling;	//cull in a compute shader and draw with multi draw indirect (GL 4.3)
+		GPUScene* gpu_scene;
+		std::vector<PrefabEntity*> gpu_scene_entities;	//entities in the scene when the gpu scene was built
+		std::vector<int> gpu_scene_versions;	//PrefabEntity::world_version of every entity when its instances were written
+		std::vector<bool> gpu_scene_static;	//PrefabEntity::is_static of every entity when its instances were written
+		std::vector<int> gpu_scene_first;	//first node of every entity in gpu_scene_nodes (one more for the end)
+		std::vector<GTR::Node*> gpu_scene_nodes;	//nodes passed to GPUScene::build
+		bool use_occlusion_culling;	//test the queued nodes against a cpu rasterized depth of the big meshes
+		OcclusionCuller* occlusion_culler;
+		float occluder_min_size;	//bounding box radius needed to be an occluder
+		Camera* occlusion_camera;	//camera of the current occlusion buffer, NULL when not testing
+		bool use_bvh;	//cull the nodes with the scene bvh instead of walking all the prefabs
+		SceneBVH* bvh;
+		std::vector<int> bvh_visible;	//items of the bvh that passed the last frustum query
+		bool use_shadow_cache;	//lights keep a depth map of the static casters
+		int caster_filter;	//eCasterFilter
+		bool use_shadow_atlas;	//all the shadowmaps share one texture, tiles sized by screen coverage
+		ShadowAtlas* shadow_atlas;
+		bool use_single_pass_shadows;	//one submission for all the cascades or cube faces, routed to their viewports (GL 4.1)
+		std::vector<sShadowCaster> shadow_casters;	//of the last collectShadowCasters
+		bool use_depth_only_shadows;	//shadow casters go through a position only shader instead of the material ones
+		int ao_mode;	//eAOMode
+		Texture* ao_half_gbuffer;	//normal and depth of one pixel of every 2x2 block of the gbuffers
+		Texture* ao_half_textures[2];	//occlusion at half resolution, ping pong of the separable blur
+		Texture* ao_texture;	//occlusion used by the light pass
+		bool use_temporal;	//ssao and volumetric take a few rotated samples per frame and accumulate them
+		TemporalAccumulator* ao_temporal;
+		TemporalAccumulator* volumetric_temporal;
+		FBO* volumetric_fbo;	//the volumetric light is accumulated before blending it over the scene
+		int volumetric_mode;	//eVolumetricMode
+		FroxelVolume* froxels;
+		DecalSystem* decals;
+		int benchmark_decals;	//amount of decals generated by the decal benchmark
+
 		Renderer();
 
 		//add here your functions
 		void renderDeferred(Camera* camera);
-		void renderPrefabShadowMap(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera);
+		void createGBuffers(int width, int height);
+		Texture* getGBufferMaterialTexture();
+		int getGBufferBytesPerPixel();
+		void setDeferredUniforms(Shader* shader, Camera* camera, const Matrix44& inverse_matrix);
+		void renderMultipassLights(Camera* camera, const Matrix44& inverse_matrix);
+		void renderClusteredLights(Camera* camera, const Matrix44& inverse_matrix);
+		void renderLightVolumes(Camera* camera, const Matrix44& inverse_matrix);
+		void renderSinglePassLights(Camera* camera, const Matrix44& inverse_matrix);
+		void setLightUniforms(Shader* shader, Light* light);
+		Matrix44 getLightVolumeModel(Light* light);
+		void renderHalfResAO(Camera* camera, const Matrix44& inverse_matrix);
+		void accumulateAO(Camera* camera, const Matrix44& inverse_matrix);
+		void renderMeshShadow(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera);
 		void renderMeshInDeferred(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera);
+		void renderScene(Camera* camera, bool main_view = false);	//main_view: the camera of the gbuffer pass
+		void renderPrefabEntity(PrefabEntity* entity, Camera* camera);
+		bool passesCasterFilter(PrefabEntity* entity);
+		bool hasDynamicCasters();
+		void renderVisibleNode(const Matrix44& model, GTR::Node* node, const BoundingBox& world_bounding, Camera* camera);
+		void renderSceneBVH(Camera* camera);
+		void collectShadowCasters(sShadowViews& views, Camera* camera, const Vector3& center, float radius);
+		bool renderShadowViewsSinglePass(sShadowViews& views, int x, int y, int view_mask);
+		void renderOccluders(Camera* camera);
+		void buildGPUScene();
+		void updateGPUScene();
+		void renderGPUScene(Camera* camera, bool main_view);
+		void renderGPUSceneShadow(Camera* camera);
+		void submitRenderQueue(Camera* camera);
+		void submitShadowQueue(Camera* camera);
 		void computeIrradiance();
 		void computeProbeCoeffs(sIrradianceProbe& p);
-		void computeReflection();
-		void computeProbeReflection(sReflectionProbe* p);
+		void computeReflection();	//captures all the reflection probes at once
 		int numLightsVisible();
 		bool loadIrradiance(const char* filename);
 
@@ -102,9 +261,6 @@ namespace GTR {
 		//to render a whole prefab (with all its nodes)
 		void renderPrefab(const Matrix44& model, GTR::Prefab* prefab, Camera* camera);
 
-		//to render one node from the prefab and its children
-		void renderNode(const Matrix44& model, GTR::Node* node, Camera* camera);
-
 		//to render one mesh given its material and transformation matrix
 		void renderMeshWithMaterial(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera);
 		
@@ -113,5 +269,6 @@ namespace GTR {
 	};
 
 	std::vector<Vector3> generateSpherePoints(int num, float radius, bool hemi);
-	Texture* CubemapFromHDRE(const char* filename);
+	//the mipmaps are the blurred levels of the hdre, or generated from its first level if hdre_levels is false
+	Texture* CubemapFromHDRE(const char* filename, bool hdre_levels = true);
 };
\ No newline at end of file
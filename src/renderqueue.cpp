@@ -0,0 +1,90 @@
+#include "renderqueue.h"
+
+#include "mesh.h"
+#include "camera.h"
+#include "material.h"
+
+#include <algorithm>
+
+using namespace GTR;
+
+RenderQueue::RenderQueue()
+{
+	collecting = false;
+}
+
+void RenderQueue::clear()
+{
+	items.clear();
+}
+
+//pointers are hashed to 16 bits, a collision only means the items are not grouped together
+static uint64_t hashPointer(const void* ptr)
+{
+	uintptr_t value = (uintptr_t)ptr;
+	return (uint64_t)((value >> 4) ^ (value >> 20)) & 0xFFFF;
+}
+
+uint64_t RenderQueue::computeKey(int pass, int shader_id, Material* material, Mesh* mesh, float depth)
+{
+	uint64_t depth_bits = (uint64_t)(clamp(depth, 0.0f, 1.0f) * 0xFFFFFF);
+	uint64_t state = ((uint64_t)(shader_id & 0x3F) << 32) | (hashPointer(material) << 16) | hashPointer(mesh);
+
+	if (pass == RENDERPASS_BLEND)
+		return ((uint64_t)pass << 62) | ((0xFFFFFF - depth_bits) << 38) | state;
+	return ((uint64_t)pass << 62) | (state << 24) | depth_bits;
+}
+
+void RenderQueue::add(const Matrix44& model, Mesh* mesh, Material* material, Camera* camera, int shader_id)
+{
+	sDrawItem item;
+	item.mesh = mesh;
+	item.material = material;
+	item.model = model;
+
+	Vector3 center = model * mesh->box.center;
+	item.distance = camera->eye.distance(center);
+
+	item.pass = material->alpha_mode == GTR::AlphaMode::BLEND ? RENDERPASS_BLEND : RENDERPASS_OPAQUE;
+	item.shader_id = shader_id;
+	item.key = computeKey(item.pass, shader_id, material, mesh, item.distance / camera->far_plane);
+	items.push_back(item);
+}
+
+void RenderQueue::sort()
+{
+	std::sort(items.begin(), items.end(), [](const sDrawItem& a, const sDrawItem& b) { return a.key < b.key; });
+}
+
+int RenderQueue::assignInstancing(int min_instances)
+{
+	//after sorting the items with the same material and mesh are next to each other
+	sort();
+
+	int num_moved = 0;
+	size_t i = 0;
+	while (i < items.size())
+	{
+		sDrawItem& first = items[i];
+		size_t end = i + 1;
+		while (end < items.size() && items[end].mesh == first.mesh && items[end].material == first.material)
+			end++;
+
+		//blended items must keep their back to front order
+		if (first.pass == RENDERPASS_OPAQUE && end - i >= (size_t)min_instances)
+		{
+			for (size_t j = i; j < end; ++j)
+			{
+				items[j].shader_id = QUEUESHADER_INSTANCED;
+				items[j].key |= (uint64_t)QUEUESHADER_INSTANCED << 56;	//shader bits of the opaque layout
+			}
+			num_moved += (int)(end - i);
+		}
+		i = end;
+	}
+
+	//the instanced groups go after the regular ones, so the shader only changes once
+	if (num_moved)
+		sort();
+	return num_moved;
+}
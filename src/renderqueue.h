@@ -0,0 +1,63 @@
+#pragma once
+
+#include "framework.h"
+#include <vector>
+#include <cstdint>
+
+//forward declarations
+class Mesh;
+class Camera;
+
+namespace GTR {
+
+	class Material;
+
+	//passes are the highest bits of the key, so all the opaque items are submitted first
+	enum eRenderPass {
+		RENDERPASS_OPAQUE = 0,
+		RENDERPASS_BLEND = 1
+	};
+
+	//shaders used by the queue, stored in the shader bits of the key
+	enum eQueueShader {
+		QUEUESHADER_DEFAULT = 0,
+		QUEUESHADER_INSTANCED = 1	//the model comes from a per instance attribute
+	};
+
+	//everything needed to submit one draw call
+	struct sDrawItem {
+		uint64_t key;
+		Mesh* mesh;
+		Material* material;
+		Matrix44 model;
+		float distance;	//from the camera to the center of the bounding box
+		int pass;	//eRenderPass
+		int shader_id;	//eQueueShader
+	};
+
+	//Instead of drawing while walking the prefab tree, the nodes are stored in a flat array,
+	//sorted by a 64 bit key and then submitted skipping the binds that didnt change.
+	//Key layout:
+	// - opaque: pass(2) | shader(6) | material(16) | mesh(16) | depth(24) -> grouped by state, front to back
+	// - blend:  pass(2) | inverse depth(24) | shader(6) | material(16) | mesh(16) -> back to front
+	class RenderQueue
+	{
+	public:
+		std::vector<sDrawItem> items;
+		bool collecting;	//while true the renderer stores the nodes instead of drawing them
+		std::vector<Matrix44> instance_models;	//scratch buffer to upload the matrices of an instanced draw
+
+		RenderQueue();
+
+		void clear();
+		void add(const Matrix44& model, Mesh* mesh, Material* material, Camera* camera, int shader_id = 0);
+		void sort();
+
+		//moves the opaque (mesh, material) pairs repeated at least min_instances times to the instanced shader
+		//so they can be drawn with one call, returns the amount of items moved
+		int assignInstancing(int min_instances);
+
+		static uint64_t computeKey(int pass, int shader_id, Material* material, Mesh* mesh, float depth);
+	};
+
+};
@@ -4,6 +4,8 @@
 #include "texture.h"
 
 #include "camera.h"
+#include "shadowatlas.h"
+#include "profiler.h"
 
 Scene* Scene::instance = nullptr;
 
@@ -29,23 +31,16 @@ void Scene::render(Camera* camera, GTR::Renderer* renderer) {
 
 	renderer->renderSkybox(camera);
 
-	for (size_t i = 0; i < this->prefabEntities.size(); i++) {
-		renderer->shadow = true;
-		//this->prefabEntities.at(i)->render(camera, renderer);
-		renderer->shadow = false;
-		renderer->deferred = false;
-		this->prefabEntities.at(i)->render(camera, renderer);
-	}
+	renderer->shadow = false;
+	renderer->deferred = false;
+	renderer->renderScene(camera);
 };
 
 void Scene::renderForward(Camera* camera, GTR::Renderer* renderer)
 {
 	renderer->shadow = false;
 	renderer->deferred = false;
-	for (PrefabEntity* e : prefabEntities)
-	{
-		e->render(camera, renderer);
-	}
+	renderer->renderScene(camera);
 }
 
 void Scene::generateTerrain(float size)
@@ -159,6 +154,13 @@ void Scene::generateScene(Camera* camera) {
 	this->prefabEntities.push_back(car3);
 	this->prefabEntities.push_back(car4);
 
+	//generate decals
+	//---------------
+
+	DecalEntity* flag = new DecalEntity("data/bandera_umusacsual.png");
+	flag->model.setTranslation(425, 0, -200);
+	flag->model.scale(75, 1, 75);
+	this->decalEntities.push_back(flag);
 }
 
 void Scene::generateSecondScene(Camera* camera) 
@@ -255,12 +257,92 @@ void Scene::generateTestScene()
 	this->prefabEntities.push_back(cubeEntity);
 }
 
+//removes the point and spot lights of the scene and creates num_lights of them in a grid
+//over the floor, used to compare the cost of the different light passes
+void Scene::generateBenchmarkLights(int num_lights, GTR::ShadowAtlas* shadow_atlas)
+{
+	std::vector<Light*> kept_lights;
+	for (Light* light : lightEntities)
+	{
+		if (light->light_type == lightType::DIRECTIONAL || light->light_type == lightType::AMBIENT)
+		{
+			kept_lights.push_back(light);
+			continue;
+		}
+		if (gizmoEntity == light)
+			gizmoEntity = nullptr;
+		if (shadow_atlas)
+			shadow_atlas->release(light);
+		delete light;
+	}
+	lightEntities = kept_lights;
+
+	int grid = (int)ceil(sqrt((float)num_lights));
+	float size = 1800.0f;
+	float spacing = size / grid;
+
+	for (int i = 0; i < num_lights; ++i)
+	{
+		int x = i % grid;
+		int z = i / grid;
+
+		//alternate point and spot lights
+		Light* light = new Light(i % 2 ? lightType::SPOT : lightType::POINT_LIGHT);
+		light->setPosition(-size * 0.5f + spacing * (x + 0.5f), 60.0f, -size * 0.5f + spacing * (z + 0.5f));
+		if (light->light_type == lightType::SPOT)
+		{
+			light->model.rotate(90 * DEG2RAD, Vector3(-1, 0, 0));	//look at the floor
+			light->angleCutoff = 45;
+			light->innerAngle = 30;
+		}
+		light->setColor(random(1.0f), random(1.0f), random(1.0f));
+		light->intensity = 5;
+		light->maxDist = spacing * 1.5f;
+		light->cast_shadows = false;
+		lightEntities.push_back(light);
+	}
+}
+
+void Scene::generateBenchmarkDecals(int num_decals)
+{
+	for (DecalEntity* decal : decalEntities)
+	{
+		if (gizmoEntity == decal)
+			gizmoEntity = nullptr;
+		delete decal;
+	}
+	decalEntities.clear();
+
+	int grid = (int)ceil(sqrt((float)num_decals));
+	float size = 1800.0f;
+	float spacing = size / grid;
+
+	for (int i = 0; i < num_decals; ++i)
+	{
+		int x = i % grid;
+		int z = i / grid;
+
+		//alternate the two textures, like road markings and graffiti of different sizes
+		DecalEntity* decal = new DecalEntity(i % 2 ? "data/urgull_umusacsual.png" : "data/bandera_umusacsual.png");
+		decal->model.setTranslation(-size * 0.5f + spacing * (x + 0.5f), 0.0f, -size * 0.5f + spacing * (z + 0.5f));
+		decal->model.rotate(random(360.0f) * DEG2RAD, Vector3(0, 1, 0));
+		float half = spacing * (0.2f + random(0.3f));
+		decal->model.scale(half, 1, half);
+		decalEntities.push_back(decal);
+	}
+}
+
 void Scene::generateDepthMap(GTR::Renderer* renderer, Camera* user_camera)
 {
+	GTR::Profiler::begin("shadow maps");
+	if (renderer->use_shadow_atlas)
+		renderer->shadow_atlas->allocate(lightEntities, user_camera);
+
 	for (auto light : lightEntities)
 	{
 		light->renderShadowMap(renderer, user_camera);
 	}
+	GTR::Profiler::end();
 }
 
 void Scene::renderDeferred(Camera* camera, GTR::Renderer* renderer)
@@ -15,6 +15,7 @@ public:
 
 	std::vector<PrefabEntity*> prefabEntities;
 	std::vector<Light*> lightEntities;
+	std::vector<DecalEntity*> decalEntities;
 	Vector3 ambientLight;
 	Entity* gizmoEntity;
 	Light* sun;
@@ -41,6 +42,8 @@ public:
 	void generateTestScene();
 	void generateSecondScene(Camera* camera);
 	void generateDepthMap(GTR::Renderer* renderer, Camera* camera);
+	void generateBenchmarkLights(int num_lights, GTR::ShadowAtlas* shadow_atlas);	//replaces point and spot lights with a grid of lights
+	void generateBenchmarkDecals(int num_decals);	//replaces the decals with a grid of decals over the floor
 };
 
 #endif // !SCENE_H
\ No newline at end of file
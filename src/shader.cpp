@@ -57,12 +57,21 @@ std::map<std::string,Shader*> Shader::s_Shaders;
 bool Shader::s_ready = false;
 Shader* Shader::current = NULL;
 
+long Shader::s_gl_calls_issued = 0;
+long Shader::s_gl_calls_skipped = 0;
+GLuint Shader::s_bound_textures[MAX_TEXTURE_UNITS] = { 0 };
+int Shader::s_active_unit = -1;
+std::vector<std::string> Shader::s_uniform_names;
+std::map<std::string, int> Shader::s_uniform_ids;
+
 Shader::Shader()
 {
 	if(!Shader::s_ready)
 		Shader::init();
 	compiled = false;
 	from_atlas = false;
+	locations_resolved = false;
+	vs = fs = cs = gs = program = 0;
 }
 
 Shader::~Shader()
@@ -159,6 +168,20 @@ void Shader::setMacros(const char* macros)
 	this->recompile();
 }
 
+//macros must go after the #version directive or the shader wont compile
+static std::string insertMacros(const std::string& code, const std::string& macros)
+{
+	if (macros.empty())
+		return code;
+	size_t pos = code.find("#version");
+	if (pos == std::string::npos)
+		return macros + "\n" + code;
+	pos = code.find('\n', pos);
+	if (pos == std::string::npos)
+		return code + "\n" + macros + "\n";
+	return code.substr(0, pos + 1) + macros + "\n" + code.substr(pos + 1);
+}
+
 bool Shader::LoadAtlas(const char* filename)
 {
 	std::string content;
@@ -226,10 +249,65 @@ bool Shader::LoadAtlas(const char* filename)
 			pos3 = std::string::npos;
 		std::string name = line.substr(0,pos);
 		std::string vs_filename = trim(line.substr(pos+1,pos2 - pos));
+
+		//compute shaders only have one file: name file.cs [macros]
+		if (vs_filename.size() > 3 && vs_filename.substr(vs_filename.size() - 3) == ".cs")
+		{
+			if (!isComputeSupported())
+				continue;	//the features that need it will be disabled
+			std::string cs_code = s_shaders_atlas[vs_filename];
+			if (!cs_code.size())
+			{
+				std::cout << " * Error in shader atlas, couldnt find files for " << name << std::endl;
+				continue;
+			}
+			cs_code = insertMacros(cs_code, pos2 != std::string::npos ? line.substr(pos2 + 1) : "");
+
+			Shader* shader = NULL;
+			auto it = s_Shaders.find(name);
+			if (it == s_Shaders.end())
+			{
+				shader = new Shader();
+				s_Shaders[name] = shader;
+			}
+			else
+				shader = it->second;
+
+			if (!shader->compileComputeFromMemory(cs_code))
+			{
+				std::cout << " * Compilation error in compute shader at atlas: " << name << std::endl;
+				continue;
+			}
+			shader->vs_filename = vs_filename;
+			shader->from_atlas = true;
+			std::cout << " + Compute shader from atlas: " << name << std::endl;
+			continue;
+		}
+
 		std::string fs_filename = trim(line.substr(pos2+1,pos3 - pos2));
 		std::string macros = "";
 		if(pos3 != std::string::npos)
 			macros = line.substr(pos3+1);
+
+		//with geometry shader: name file.vs file.gs file.fs [macros]
+		std::string gs_code;
+		if (fs_filename.size() > 3 && fs_filename.substr(fs_filename.size() - 3) == ".gs")
+		{
+			if (!isViewportArraySupported())
+				continue;	//the features that need it will be disabled
+			gs_code = s_shaders_atlas[fs_filename];
+			if (!gs_code.size())
+			{
+				std::cout << " * Error in shader atlas, couldnt find files for " << name << std::endl;
+				continue;
+			}
+			macros = trim(macros);
+			int pos4 = macros.find_first_of(' ');
+			fs_filename = macros.substr(0, pos4);
+			macros = pos4 != std::string::npos ? macros.substr(pos4 + 1) : "";
+			gs_code = insertMacros(gs_code, macros);
+		}
+
 		std::string vs_code = s_shaders_atlas[vs_filename];
 		std::string fs_code = s_shaders_atlas[fs_filename];
 		if(!vs_code.size() || !fs_code.size())
@@ -238,8 +316,8 @@ bool Shader::LoadAtlas(const char* filename)
 			continue;
 		}
 
-		vs_code = macros + "\n" + vs_code;
-		fs_code = macros + "\n" + fs_code;
+		vs_code = insertMacros(vs_code, macros);
+		fs_code = insertMacros(fs_code, macros);
 
 		Shader* shader = NULL;
 		auto it = s_Shaders.find( name );
@@ -251,7 +329,7 @@ bool Shader::LoadAtlas(const char* filename)
 		else
 			shader = it->second;
 	
-		if (!shader->compileFromMemory(vs_code,fs_code))
+		if (gs_code.size() ? !shader->compileFromMemory(vs_code, gs_code, fs_code) : !shader->compileFromMemory(vs_code,fs_code))
 		{
 			delete shader;
 			std::cout << " * Compilation error in shader at atlas: " << name << std::endl;
@@ -317,6 +395,57 @@ bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
 		return false;
 	}
 
+	return linkProgram();
+}
+
+bool Shader::compileFromMemory(const std::string& vsm, const std::string& gsm, const std::string& psm)
+{
+	program = glCreateProgram();
+	assert(glGetError() == GL_NO_ERROR);
+
+	if (!createVertexShaderObject(vsm))
+	{
+		printf("Vertex shader compilation failed\n");
+		return false;
+	}
+
+	if (!createShaderObject(GL_GEOMETRY_SHADER, gs, gsm))
+	{
+		printf("Geometry shader compilation failed\n");
+		return false;
+	}
+
+	if (!createFragmentShaderObject(psm))
+	{
+		printf("Fragment shader compilation failed\n");
+		return false;
+	}
+
+	return linkProgram();
+}
+
+bool Shader::compileComputeFromMemory(const std::string& csm)
+{
+	if (!isComputeSupported())
+	{
+		std::cout << "Error: compute shaders need OpenGL 4.3" << std::endl;
+		return false;
+	}
+
+	program = glCreateProgram();
+	assert(glGetError() == GL_NO_ERROR);
+
+	if (!createShaderObject(GL_COMPUTE_SHADER, cs, csm))
+	{
+		printf("Compute shader compilation failed\n");
+		return false;
+	}
+
+	return linkProgram();
+}
+
+bool Shader::linkProgram()
+{
 	glLinkProgram(program);
 	assert (glGetError() == GL_NO_ERROR);
 
@@ -336,6 +465,7 @@ bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
 	validate();
 #endif
 
+	reflectUniforms();
 	compiled = true;
 
 	return true;
@@ -424,6 +554,20 @@ void Shader::release()
 		fs = 0;
 	}
 
+	if (cs)
+	{
+		glDeleteShader(cs);
+		assert (glGetError() == GL_NO_ERROR);
+		cs = 0;
+	}
+
+	if (gs)
+	{
+		glDeleteShader(gs);
+		assert (glGetError() == GL_NO_ERROR);
+		gs = 0;
+	}
+
 	if (program)
 	{
 		glDeleteProgram(program);
@@ -432,6 +576,10 @@ void Shader::release()
 	}
 
 	locations.clear();
+	uniforms.clear();
+	uniform_values.clear();
+	id_locations.clear();
+	locations_resolved = false;
 
 	compiled = false;
 }
@@ -440,7 +588,11 @@ void Shader::release()
 void Shader::enable()
 {
 	if (current == this)
+	{
+		s_gl_calls_skipped++;
 		return;
+	}
+	s_gl_calls_issued++;
 
 	current = this;
 
@@ -461,6 +613,32 @@ void Shader::disable()
 	assert (glGetError() == GL_NO_ERROR);
 }
 
+bool Shader::isComputeSupported()
+{
+	static int supported = -1;	//the version of the context doesnt change
+	if (supported == -1)
+	{
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		supported = (major > 4 || (major == 4 && minor >= 3)) ? 1 : 0;
+	}
+	return supported == 1;
+}
+
+bool Shader::isViewportArraySupported()
+{
+	static int supported = -1;
+	if (supported == -1)
+	{
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		supported = (major > 4 || (major == 4 && minor >= 1)) ? 1 : 0;
+	}
+	return supported == 1;
+}
+
 void Shader::disableShaders()
 {
 	glUseProgram(0);
@@ -522,6 +700,9 @@ GLint Shader::getLocation(const char* varname,loctable* table)
 	
 	if(cur == locs->end()) //not found in the locations table
 	{
+		//all the active uniforms were stored after linking, only single elements of arrays are missing
+		if (locations_resolved && !strchr(varname, '['))
+			return -1;
 		loc = glGetUniformLocation(program, varname);
 		if (loc == -1)
 		{
@@ -538,6 +719,120 @@ GLint Shader::getLocation(const char* varname,loctable* table)
 	return loc;
 }
 
+//reads all the active uniforms after linking into a flat table, so they are never asked to GL while rendering
+void Shader::reflectUniforms()
+{
+	locations.clear();
+	uniforms.clear();
+	uniform_values.clear();
+	id_locations.clear();
+
+	GLint count = 0;
+	GLint max_length = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+
+	//the names are the keys of the locations table, reserve so the strings never move
+	uniforms.reserve(count);
+	std::vector<char> name(max_length + 1);
+	int max_location = -1;
+
+	for (int i = 0; i < count; ++i)
+	{
+		sUniformInfo info;
+		GLsizei length = 0;
+		glGetActiveUniform(program, i, (GLsizei)name.size(), &length, &info.size, &info.type, &name[0]);
+		info.location = glGetUniformLocation(program, &name[0]);
+		if (info.location == -1)
+			continue;	//members of uniform blocks dont have location
+
+		//arrays are reported as name[0]
+		info.name.assign(&name[0], length);
+		if (info.name.size() > 3 && info.name.compare(info.name.size() - 3, 3, "[0]") == 0)
+			info.name.resize(info.name.size() - 3);
+
+		uniforms.push_back(info);
+		locations.insert(loctable::value_type(uniforms.back().name.c_str(), info.location));
+		max_location = std::max(max_location, info.location + info.size - 1);
+	}
+
+	uniform_values.resize(max_location + 1);
+	for (size_t i = 0; i < uniform_values.size(); ++i)
+		uniform_values[i].size = 0;
+	locations_resolved = true;
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+int Shader::registerUniformName(const char* name)
+{
+	auto it = s_uniform_ids.find(name);
+	if (it != s_uniform_ids.end())
+		return it->second;
+	int id = (int)s_uniform_names.size();
+	s_uniform_names.push_back(name);
+	s_uniform_ids[name] = id;
+	return id;
+}
+
+//the location of every id is searched in the table the first time this shader uses it
+GLint Shader::getLocation(UniformId uniform)
+{
+	if (uniform.id < 0)
+		return -1;
+	if (uniform.id >= (int)id_locations.size())
+		id_locations.resize(s_uniform_names.size(), LOCATION_UNRESOLVED);
+
+	GLint& loc = id_locations[uniform.id];
+	if (loc == LOCATION_UNRESOLVED)
+	{
+		loc = -1;
+		const std::string& name = s_uniform_names[uniform.id];
+		for (size_t i = 0; i < uniforms.size(); ++i)
+			if (uniforms[i].name == name)
+			{
+				loc = uniforms[i].location;
+				break;
+			}
+	}
+	return loc;
+}
+
+bool Shader::isUniformCached(GLint loc, const void* data, int size)
+{
+	if (loc < 0 || loc >= (int)uniform_values.size() || size > sizeof(sUniformValue::data))
+	{
+		s_gl_calls_issued++;
+		return false;
+	}
+
+	sUniformValue& value = uniform_values[loc];
+	if (value.size == size && memcmp(value.data, data, size) == 0)
+	{
+		s_gl_calls_skipped++;
+		return true;
+	}
+
+	memcpy(value.data, data, size);
+	value.size = size;
+	s_gl_calls_issued++;
+	return false;
+}
+
+//arrays are not cached, the stored values of their locations are not valid anymore
+void Shader::forgetUniformValues(GLint loc, int count)
+{
+	for (int i = std::max(loc, 0); i < loc + count && i < (int)uniform_values.size(); ++i)
+		uniform_values[i].size = 0;
+	s_gl_calls_issued++;
+}
+
+void Shader::resetStateCache()
+{
+	for (int i = 0; i < MAX_TEXTURE_UNITS; ++i)
+		s_bound_textures[i] = 0;
+	s_active_unit = -1;
+}
+
 int Shader::getAttribLocation(const char* varname)
 {
 	int loc = glGetAttribLocation(program, varname);
@@ -563,10 +858,27 @@ int Shader::getUniformLocation(const char* varname)
 
 void Shader::setTexture(const char* varname, Texture* tex, int slot)
 {
-	glActiveTexture(GL_TEXTURE0 + slot);
-	glBindTexture(tex->texture_type, tex->texture_id);
+	bindTexture(tex, slot);
 	setUniform1(varname, slot);
-	glActiveTexture(GL_TEXTURE0 + slot);
+}
+
+void Shader::bindTexture(Texture* tex, int slot)
+{
+	assert(slot < MAX_TEXTURE_UNITS);
+	if (s_bound_textures[slot] != tex->texture_id || !tex->texture_id)
+	{
+		if (s_active_unit != slot)
+		{
+			glActiveTexture(GL_TEXTURE0 + slot);
+			s_active_unit = slot;
+			s_gl_calls_issued++;
+		}
+		glBindTexture(tex->texture_type, tex->texture_id);
+		s_bound_textures[slot] = tex->texture_id;
+		s_gl_calls_issued++;
+	}
+	else
+		s_gl_calls_skipped++;
 }
 
 /*
@@ -584,22 +896,23 @@ void Shader::setUniform1(const char* varname, bool input1)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
-	glUniform1i(loc, input1);
-	assert(glGetError() == GL_NO_ERROR);
+	setLocation(loc, (int)input1);
 }
 
 void Shader::setUniform1(const char* varname, int input1)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniform1i(loc, input1);
-	assert (glGetError() == GL_NO_ERROR);
+	setLocation(loc, input1);
 }
 
 void Shader::setUniform2(const char* varname, int input1, int input2)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
+	int data[2] = { input1, input2 };
+	if (isUniformCached(loc, data, sizeof(data)))
+		return;
 	glUniform2i(loc, input1, input2);
 	assert (glGetError() == GL_NO_ERROR);
 }
@@ -608,6 +921,9 @@ void Shader::setUniform3(const char* varname, int input1, int input2, int input3
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
+	int data[3] = { input1, input2, input3 };
+	if (isUniformCached(loc, data, sizeof(data)))
+		return;
 	glUniform3i(loc, input1, input2, input3);
 	assert (glGetError() == GL_NO_ERROR);
 }
@@ -616,6 +932,9 @@ void Shader::setUniform4(const char* varname, const int input1, const int input2
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
+	int data[4] = { input1, input2, input3, input4 };
+	if (isUniformCached(loc, data, sizeof(data)))
+		return;
 	glUniform4i(loc, input1, input2, input3, input4);
 	assert (glGetError() == GL_NO_ERROR);
 }
@@ -624,6 +943,7 @@ void Shader::setUniform1Array(const char* varname, const int* input, const int c
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
+	forgetUniformValues(loc, count);
 	glUniform1iv(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
 }
@@ -632,6 +952,7 @@ void Shader::setUniform2Array(const char* varname, const int* input, const int c
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
+	forgetUniformValues(loc, count);
 	glUniform2iv(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
 }
@@ -640,6 +961,7 @@ void Shader::setUniform3Array(const char* varname, const int* input, const int c
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
+	forgetUniformValues(loc, count);
 	glUniform3iv(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
 }
@@ -648,6 +970,7 @@ void Shader::setUniform4Array(const char* varname, const int* input, const int c
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
+	forgetUniformValues(loc, count);
 	glUniform4iv(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
 }
@@ -656,38 +979,38 @@ void Shader::setUniform1(const char* varname, const float input1)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniform1f(loc, input1);
-	assert (glGetError() == GL_NO_ERROR);
+	setLocation(loc, &input1, 1);
 }
 
 void Shader::setUniform2(const char* varname, const float input1, const float input2)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniform2f(loc, input1, input2);
-	assert (glGetError() == GL_NO_ERROR);
+	float data[2] = { input1, input2 };
+	setLocation(loc, data, 2);
 }
 
 void Shader::setUniform3(const char* varname, const float input1, const float input2, const float input3)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniform3f(loc, input1, input2, input3);
-	assert (glGetError() == GL_NO_ERROR);
+	float data[3] = { input1, input2, input3 };
+	setLocation(loc, data, 3);
 }
 
 void Shader::setUniform4(const char* varname, const float input1, const float input2, const float input3, const float input4)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniform4f(loc, input1, input2, input3, input4);
-	checkGLErrors();
+	float data[4] = { input1, input2, input3, input4 };
+	setLocation(loc, data, 4);
 }
 
 void Shader::setUniform1Array(const char* varname, const float* input, const int count)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
+	forgetUniformValues(loc, count);
 	glUniform1fv(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
 }
@@ -696,6 +1019,7 @@ void Shader::setUniform2Array(const char* varname, const float* input, const int
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
+	forgetUniformValues(loc, count);
 	glUniform2fv(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
 }
@@ -704,6 +1028,7 @@ void Shader::setUniform3Array(const char* varname, const float* input, const int
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
+	forgetUniformValues(loc, count);
 	glUniform3fv(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
 }
@@ -712,6 +1037,7 @@ void Shader::setUniform4Array(const char* varname, const float* input, const int
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
+	forgetUniformValues(loc, count);
 	glUniform4fv(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
 }
@@ -720,26 +1046,59 @@ void Shader::setMatrix44(const char* varname, const float* m)
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniformMatrix4fv(loc, 1, GL_FALSE, m);
-	assert (glGetError() == GL_NO_ERROR);
+	setLocation(loc, m, 16);
 }
 
 void Shader::setMatrix44( const char* varname, const Matrix44 &m )
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
-	glUniformMatrix4fv(loc, 1, GL_FALSE, m.m);
-	assert (glGetError() == GL_NO_ERROR);
+	setLocation(loc, m.m, 16);
 }
 
 void Shader::setMatrix44Array( const char* varname, Matrix44* m_array, int num )
 {
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
+	forgetUniformValues(loc, num);
 	glUniformMatrix4fv(loc, num, GL_FALSE, (GLfloat*)m_array);
 	assert(glGetError() == GL_NO_ERROR);
 }
 
+//uploads by location, used by the string and the UniformId setters
+void Shader::setLocation(GLint loc, int value)
+{
+	if (loc == -1 || isUniformCached(loc, &value, sizeof(value)))
+		return;
+	glUniform1i(loc, value);
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+void Shader::setLocation(GLint loc, const float* values, int num_floats)
+{
+	if (loc == -1 || isUniformCached(loc, values, sizeof(float) * num_floats))
+		return;
+	switch (num_floats)
+	{
+		case 1: glUniform1fv(loc, 1, values); break;
+		case 2: glUniform2fv(loc, 1, values); break;
+		case 3: glUniform3fv(loc, 1, values); break;
+		case 4: glUniform4fv(loc, 1, values); break;
+		case 16: glUniformMatrix4fv(loc, 1, GL_FALSE, values); break;
+		default: assert(0 && "unsupported uniform size");
+	}
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+void Shader::setUniformBlock(const char* blockname, int binding_point)
+{
+	GLuint index = glGetUniformBlockIndex(program, blockname);
+	if (index == GL_INVALID_INDEX)
+		return;
+	glUniformBlockBinding(program, index, binding_point);
+	assert(glGetError() == GL_NO_ERROR);
+}
+
 void Shader::init()
 {
 	static bool firsttime = true;
@@ -8,6 +8,7 @@
 #include "includes.h"
 #include <string>
 #include <map>
+#include <vector>
 #include "framework.h"
 #include <cassert>
 
@@ -18,8 +19,21 @@
 	#define CHECK_SHADER_VAR(a,b) if (a == -1) return
 #endif
 
+#define MAX_TEXTURE_UNITS 32
+#define LOCATION_UNRESOLVED -2	//UniformId not searched yet in this shader
+
 class Texture;
 
+//Handle to a uniform name, it can be stored in a static at the call site so the name is only looked up once:
+//	static UniformId u_model("u_model");
+//	shader->setUniform(u_model, model);
+//the same handle works with any shader, each one resolves the location the first time it is used.
+struct UniformId {
+	int id;
+	UniformId() : id(-1) {}
+	explicit UniformId(const char* name);
+};
+
 class Shader
 {
 	int last_slot;
@@ -40,12 +54,21 @@ public:
 
 	//internal functions
 	virtual bool compileFromMemory(const std::string& vsm, const std::string& psm);
+	bool compileComputeFromMemory(const std::string& csm);	//needs GL 4.3
+	bool compileFromMemory(const std::string& vsm, const std::string& gsm, const std::string& psm);	//with geometry shader
 	virtual void release();
 	virtual void enable();
 	virtual void disable();
 
 	static void init();
 	static void disableShaders();
+	static bool isComputeSupported();	//compute shaders and storage buffers (GL 4.3)
+	static bool isViewportArraySupported();	//gl_ViewportIndex from the geometry shader (GL 4.1)
+
+	//state cache, the values already uploaded and the textures already bound are not sent again to GL
+	static void resetStateCache();	//call it after binding textures without the shader (or when other code may have)
+	static long s_gl_calls_issued;	//stats of the frame
+	static long s_gl_calls_skipped;
 
 	//check
 	virtual bool IsUniform(const char* varname) { return (getUniformLocation(varname) != -1); } //uniform exist
@@ -64,6 +87,16 @@ public:
 	//for textures you must specify an slot (a number from 0 to 16) where this texture is stored in the shader
 	void setUniform(const char* varname, Texture* texture, int slot) { assert(current == this); setTexture(varname, texture, slot); }
 
+	//same as above but using a handle, no string lookup
+	void setUniform(UniformId u, bool input) { assert(current == this); setLocation(getLocation(u), (int)input); }
+	void setUniform(UniformId u, int input) { assert(current == this); setLocation(getLocation(u), input); }
+	void setUniform(UniformId u, float input) { assert(current == this); setLocation(getLocation(u), &input, 1); }
+	void setUniform(UniformId u, const Vector2& input) { assert(current == this); setLocation(getLocation(u), &input.x, 2); }
+	void setUniform(UniformId u, const Vector3& input) { assert(current == this); setLocation(getLocation(u), &input.x, 3); }
+	void setUniform(UniformId u, const Vector4& input) { assert(current == this); setLocation(getLocation(u), &input.x, 4); }
+	void setUniform(UniformId u, const Matrix44& input) { assert(current == this); setLocation(getLocation(u), input.m, 16); }
+	void setUniform(UniformId u, Texture* texture, int slot) { assert(current == this); bindTexture(texture, slot); setLocation(getLocation(u), slot); }
+
 
 	virtual void setInt(const char* varname, const int& input) { setUniform1(varname, input); }
 	virtual void setFloat(const char* varname, const float& input) { setUniform1(varname, input); }
@@ -71,6 +104,7 @@ public:
 	virtual void setMatrix44(const char* varname, const float* m);
 	virtual void setMatrix44(const char* varname, const Matrix44 &m);
 	virtual void setMatrix44Array(const char* varname, Matrix44* m_array, int num);
+	void setUniformBlock(const char* blockname, int binding_point); //links a uniform block to a buffer binding point
 
 	virtual void setUniform1Array(const char* varname, const float* input, const int count) ;
 	virtual void setUniform2Array(const char* varname, const float* input, const int count) ;
@@ -98,6 +132,7 @@ public:
 
 	//virtual void setTexture(const char* varname, const unsigned int tex) ;
 	virtual void setTexture(const char* varname, Texture* texture, int slot);
+	void bindTexture(Texture* texture, int slot);	//without setting the sampler uniform
 
 	virtual int getAttribLocation(const char* varname);
 	virtual int getUniformLocation(const char* varname);
@@ -128,6 +163,7 @@ protected:
 	std::string macros;
 	bool from_atlas;
 
+	bool linkProgram();
 	bool createVertexShaderObject(const std::string& shader);
 	bool createFragmentShaderObject(const std::string& shader);
 	bool createShaderObject(unsigned int type, GLuint& handle, const std::string& shader);
@@ -138,9 +174,42 @@ protected:
 
 	GLuint vs;
 	GLuint fs;
+	GLuint cs;
+	GLuint gs;
 	GLuint program;
 	std::string log;
 
+	//last value uploaded to every uniform location, so repeated values can be skipped
+	struct sUniformValue {
+		unsigned char data[sizeof(Matrix44)];
+		int size;	//in bytes, 0 if unknown
+	};
+	std::vector<sUniformValue> uniform_values;
+	bool locations_resolved;	//every active uniform is in the table, unknown names are not asked to GL
+
+	//active uniforms of the program, arrays are stored without the [0]
+	struct sUniformInfo {
+		std::string name;
+		GLint location;
+		GLenum type;
+		GLint size;	//elements of the array, 1 if not an array
+	};
+	std::vector<sUniformInfo> uniforms;
+	std::vector<GLint> id_locations;	//location of every UniformId in this program
+
+	void reflectUniforms();
+	void setLocation(GLint loc, int value);
+	void setLocation(GLint loc, const float* values, int num_floats);
+	bool isUniformCached(GLint loc, const void* data, int size);	//true if the value was already uploaded
+	void forgetUniformValues(GLint loc, int count);
+
+	static GLuint s_bound_textures[MAX_TEXTURE_UNITS];	//texture bound to every unit, 0 if unknown
+	static int s_active_unit;
+
+	//names of all the UniformIds created, the id is the index
+	static std::vector<std::string> s_uniform_names;
+	static std::map<std::string, int> s_uniform_ids;
+
 //this is a hack to speed up shader usage (save info locally)
 private: 
 
@@ -155,7 +224,12 @@ private:
 
 public:
 	GLint getLocation( const char* varname, loctable* table );
+	GLint getLocation(UniformId uniform);
 	loctable locations;	
+
+	static int registerUniformName(const char* name);
 };
 
+inline UniformId::UniformId(const char* name) : id(Shader::registerUniformName(name)) {}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,149 @@
+#include "shadowatlas.h"
+
+#include "camera.h"
+#include "entity.h"
+#include "fbo.h"
+#include "texture.h"
+#include "profiler.h"
+
+#include <cmath>
+
+//imgui already compiles it as static, so we need our own copy
+#define STBRP_STATIC
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "extra/imgui/imstb_rectpack.h"
+
+using namespace GTR;
+
+ShadowAtlas::ShadowAtlas(int size)
+{
+	this->size = size;
+	fbo = NULL;
+	static_fbo = NULL;
+	num_tiles = 0;
+	num_repacks = 0;
+}
+
+int ShadowAtlas::getTileSize(Light* light, Camera* camera)
+{
+	if (!light->cast_shadows)
+		return 0;
+	if (light->light_type == lightType::DIRECTIONAL)
+		return light->is_cascade ? SHADOW_TILE_SUN : SHADOW_TILE_SUN / 2;
+	if (light->light_type != lightType::SPOT && light->light_type != lightType::POINT_LIGHT)
+		return 0;
+	int max_tile = light->light_type == lightType::POINT_LIGHT ? SHADOW_TILE_POINT : SHADOW_TILE_MAX;
+
+	//fraction of the screen height covered by the sphere of influence of the light
+	Vector3 pos = light->model.getTranslation();
+	float coverage = 1.0f;
+	if (camera->testSphereInFrustum(pos, light->maxDist) == CLIP_OUTSIDE)
+		coverage = 0.0f;
+	else
+	{
+		float distance = camera->eye.distance(pos);
+		if (distance > light->maxDist)
+			coverage = light->maxDist / (distance * std::tan(camera->fov * 0.5f * DEG2RAD));
+	}
+
+	int tile = SHADOW_TILE_MIN;
+	while (tile < max_tile && tile < coverage * max_tile)
+		tile *= 2;
+	return tile;
+}
+
+void ShadowAtlas::allocate(std::vector<Light*>& lights, Camera* camera)
+{
+	if (!fbo)
+	{
+		fbo = new FBO();
+		fbo->setDepthOnly(size, size);
+	}
+
+	bool same_lights = lights == this->lights;
+	std::vector<int> new_sizes(lights.size());
+	for (int i = 0; i < lights.size(); ++i)
+	{
+		int tile = getTileSize(lights[i], camera);
+		//tiles only shrink when the light needs a quarter of it, so they dont jump between two sizes every frame
+		if (same_lights && tile && tile < sizes[i] && tile * 2 >= sizes[i])
+			tile = sizes[i];
+		new_sizes[i] = tile;
+	}
+	if (same_lights && new_sizes == sizes)
+		return;
+
+	this->lights = lights;
+	sizes = new_sizes;
+
+	//if they dont fit, halve all the tiles and try again
+	std::vector<int> tiles = new_sizes;
+	for (int tries = 0; !pack(tiles) && tries < 4; ++tries)
+		for (int& tile : tiles)
+			if (tile > SHADOW_TILE_MIN)
+				tile /= 2;
+
+	num_repacks++;
+	GTR::Profiler::addCounter("shadow atlas repacks", 1);
+}
+
+FBO* ShadowAtlas::getStaticFBO()
+{
+	if (!static_fbo)
+	{
+		static_fbo = new FBO();
+		static_fbo->setDepthOnly(size, size);
+	}
+	return static_fbo;
+}
+
+void ShadowAtlas::release(Light* light)
+{
+	for (int i = 0; i < lights.size(); ++i)
+		if (lights[i] == light)
+		{
+			if (light->atlas_size)
+				num_tiles--;
+			lights.erase(lights.begin() + i);
+			sizes.erase(sizes.begin() + i);
+			break;
+		}
+	light->atlas_size = 0;
+}
+
+bool ShadowAtlas::pack(std::vector<int>& tiles)
+{
+	std::vector<stbrp_rect> rects;
+	for (int i = 0; i < tiles.size(); ++i)
+	{
+		lights[i]->atlas_size = 0;
+		if (!tiles[i])
+			continue;
+		stbrp_rect rect;
+		rect.id = i;
+		rect.w = (stbrp_coord)(tiles[i] * lights[i]->getShadowColumns());
+		rect.h = (stbrp_coord)(tiles[i] * lights[i]->getShadowRows());
+		rects.push_back(rect);
+	}
+	num_tiles = 0;
+	if (rects.empty())
+		return true;
+
+	std::vector<stbrp_node> nodes(size);
+	stbrp_context context;
+	stbrp_init_target(&context, size, size, &nodes[0], (int)nodes.size());
+	bool all_packed = stbrp_pack_rects(&context, &rects[0], (int)rects.size()) != 0;
+
+	//the lights that didnt fit keep atlas_size at 0 and use their own shadowmap
+	for (stbrp_rect& rect : rects)
+	{
+		if (!rect.was_packed)
+			continue;
+		Light* light = lights[rect.id];
+		light->atlas_x = rect.x;
+		light->atlas_y = rect.y;
+		light->atlas_size = rect.w / light->getShadowColumns();
+		num_tiles++;
+	}
+	return all_packed;
+}
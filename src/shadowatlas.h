@@ -0,0 +1,54 @@
+#pragma once
+
+#include "framework.h"
+#include <vector>
+
+//forward declarations
+class Camera;
+class Light;
+class FBO;
+
+#define SHADOW_ATLAS_SIZE 4096
+#define SHADOW_TILE_MIN 128	//lights far away or out of view
+#define SHADOW_TILE_MAX 1024	//spot light filling the screen
+#define SHADOW_TILE_SUN 2048	//directional lights always get the biggest tile (a quarter per cascade)
+#define SHADOW_TILE_POINT 512	//max size of a cube face, point lights take a grid of 3x2 faces
+
+namespace GTR {
+
+	//Single depth texture shared by the shadowmaps of all the lights.
+	//Every shadowed light gets a tile (3x2 squares for point lights) whose size (a power of two) depends on how much of the
+	//screen its area of influence covers. The tiles are packed with stb_rect_pack and only repacked when
+	//some size changes, lights that dont fit (or when the atlas is disabled) keep using their own fbo.
+	//The shadow cache keeps the static casters in a second atlas with the same tiles, copied to the first every frame.
+	class ShadowAtlas
+	{
+	public:
+		FBO* fbo;
+		FBO* static_fbo;	//created the first time a cached shadowmap is drawn
+		int size;
+
+		int num_tiles;	//lights placed in the atlas
+		int num_repacks;	//times the tiles have been reallocated
+
+		ShadowAtlas(int size = SHADOW_ATLAS_SIZE);
+
+		//computes the tile size of every light for this camera and repacks if any changed, writes Light::atlas_*
+		void allocate(std::vector<Light*>& lights, Camera* camera);
+
+		FBO* getStaticFBO();
+
+		//frees the tile of a light that is going to be deleted, the rest keep theirs until the next repack
+		void release(Light* light);
+
+		//tile size the light wants for this camera (of one face for point lights), 0 if it has no shadows
+		static int getTileSize(Light* light, Camera* camera);
+
+	private:
+		std::vector<Light*> lights;	//of the current packing
+		std::vector<int> sizes;
+
+		bool pack(std::vector<int>& sizes);
+	};
+
+};
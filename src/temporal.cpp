@@ -0,0 +1,110 @@
+#include "temporal.h"
+
+#include "camera.h"
+#include "fbo.h"
+#include "mesh.h"
+#include "shader.h"
+#include "texture.h"
+#include "profiler.h"
+
+using namespace GTR;
+
+TemporalAccumulator::TemporalAccumulator(int max_history)
+{
+	this->max_history = max_history;
+	frame = 0;
+	rejected_pixels = 0;
+	fbos[0] = fbos[1] = NULL;
+	current = 0;
+	has_history = false;
+	query = 0;
+	query_pending = false;
+}
+
+void TemporalAccumulator::reset()
+{
+	has_history = false;
+}
+
+Texture* TemporalAccumulator::accumulate(Texture* input, Texture* depth_texture, Texture* normal_texture, bool gbuffer_packed,
+	Camera* camera, const Matrix44& inverse_viewprojection)
+{
+	int width = depth_texture->width;
+	int height = depth_texture->height;
+	if (!fbos[0] || fbos[0]->width != width || fbos[0]->height != height)
+	{
+		for (int i = 0; i < 2; ++i)
+		{
+			delete fbos[i];
+			fbos[i] = new FBO();
+			fbos[i]->create(width, height, 2, GL_RGBA, GL_HALF_FLOAT, false);
+		}
+		has_history = false;
+	}
+
+	FBO* history = fbos[current];
+	FBO* target = fbos[1 - current];
+	Mesh* quad = Mesh::getQuad();
+
+	glDisable(GL_BLEND);
+	glDisable(GL_DEPTH_TEST);
+
+	target->bind();
+	Shader* shader = Shader::Get("temporal");
+	shader->enable();
+	shader->setUniform("u_texture", input, 0);
+	shader->setUniform("u_history", history->color_textures[0], 1);
+	shader->setUniform("u_history_geometry", history->color_textures[1], 2);
+	shader->setUniform("u_depth_texture", depth_texture, 3);
+	shader->setUniform("u_normal_texture", normal_texture, 4);
+	shader->setUniform("u_gbuffer_packed", gbuffer_packed);
+	shader->setUniform("u_inverse_viewprojection", inverse_viewprojection);
+	shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
+	shader->setUniform("u_prev_viewprojection", prev_viewprojection);
+	shader->setUniform("u_has_history", has_history);
+	shader->setUniform("u_max_history", (float)max_history);
+	quad->render(GL_TRIANGLES);
+	shader->disable();
+	target->unbind();
+
+	//count the pixels without history (disocclusions, ghosting candidates) with an occlusion query over the new
+	//geometry, drawn in the old fbo with the color writes disabled so it is not read and written at the same time
+	if (Profiler::enabled)
+	{
+		if (!query)
+			glGenQueries(1, &query);
+		if (query_pending)
+		{
+			GLint available = 0;
+			glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available)
+			{
+				GLuint samples = 0;
+				glGetQueryObjectuiv(query, GL_QUERY_RESULT, &samples);
+				rejected_pixels = samples;
+				query_pending = false;
+			}
+		}
+		if (!query_pending)
+		{
+			history->bind();
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+			glBeginQuery(GL_SAMPLES_PASSED, query);
+			shader = Shader::Get("temporal_rejected");
+			shader->enable();
+			shader->setUniform("u_history_geometry", target->color_textures[1], 0);
+			quad->render(GL_TRIANGLES);
+			shader->disable();
+			glEndQuery(GL_SAMPLES_PASSED);
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			history->unbind();
+			query_pending = true;
+		}
+	}
+
+	prev_viewprojection = camera->viewprojection_matrix;
+	current = 1 - current;
+	has_history = true;
+	frame++;
+	return target->color_textures[0];
+}
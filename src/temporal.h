@@ -0,0 +1,41 @@
+#pragma once
+
+#include "includes.h"
+#include "framework.h"
+
+//forward declarations
+class Camera;
+class FBO;
+class Texture;
+
+#define TEMPORAL_GOLDEN_ANGLE 2.39996323f	//rotation of the sample kernels between frames
+
+namespace GTR {
+
+	//Accumulates a noisy screen space effect over the frames. The history of the previous frame is reprojected with the
+	//depth of the gbuffers and the previous viewprojection, and it is dropped where the depth or the normal of the
+	//reprojected pixel disagree (disocclusions), so the effect only needs a few new samples every frame.
+	class TemporalAccumulator
+	{
+	public:
+		int max_history;	//frames averaged at most, lower reacts faster to changes
+		int frame;	//frames accumulated, the effects use it to rotate their samples
+		long rejected_pixels;	//pixels that restarted their history in the last measured frame
+
+		TemporalAccumulator(int max_history = 16);
+
+		//blends input with the reprojected history, the texture returned is valid until the next call
+		Texture* accumulate(Texture* input, Texture* depth_texture, Texture* normal_texture, bool gbuffer_packed,
+			Camera* camera, const Matrix44& inverse_viewprojection);
+		void reset();	//the next frame starts without history
+
+	private:
+		FBO* fbos[2];	//ping pong, value | octahedral normal, linear depth and history length
+		int current;	//fbo with the history
+		bool has_history;
+		Matrix44 prev_viewprojection;
+		GLuint query;	//pixels rejected, read one frame later like the profiler
+		bool query_pending;
+	};
+
+};
@@ -77,6 +77,7 @@ Texture::~Texture()
 void Texture::clear()
 {
 	glDeleteTextures(1, &texture_id);
+	Shader::resetStateCache();	//the id can be reused by a new texture
 	glBindTexture(this->texture_type, 0);
 	texture_id = 0;
 }
@@ -161,10 +162,47 @@ void Texture::createCubemap(unsigned int width, unsigned int height, Uint8** dat
 	if (texture_id == 0)
 		glGenTextures(1, &texture_id); //we need to create an unique ID for the texture
 
+	Shader::resetStateCache();
 	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 	uploadCubemap(format, type, mipmaps, data, internal_format);
 }
 
+void Texture::createCubemapArray(unsigned int width, unsigned int height, unsigned int layers, unsigned int format, unsigned int type, bool mipmaps, unsigned int internal_format)
+{
+	assert(width && height && layers && "texture must have a size");
+
+	this->width = (float)width;
+	this->height = (float)height;
+	this->depth = (float)layers;
+	this->format = format;
+	this->internal_format = internal_format;
+	this->type = type;
+	this->texture_type = GL_TEXTURE_CUBE_MAP_ARRAY;
+	this->mipmaps = mipmaps && isPowerOfTwo(width) && isPowerOfTwo(height) && format != GL_DEPTH_COMPONENT;
+
+	this->wrapS = GL_CLAMP_TO_EDGE;
+	this->wrapT = GL_CLAMP_TO_EDGE;
+
+	if (texture_id == 0)
+		glGenTextures(1, &texture_id); //we need to create an unique ID for the texture
+
+	Shader::resetStateCache();
+	glBindTexture(this->texture_type, texture_id);
+
+	//the faces of every cubemap are consecutive layers (cubemap * 6 + face), the mipmaps are generated once the faces are rendered
+	glTexImage3D(this->texture_type, 0, internal_format == 0 ? format : internal_format, width, height, layers * 6, 0, format, type, NULL);
+
+	glTexParameteri(this->texture_type, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);
+	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR);
+	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, this->wrapS);
+	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, this->wrapT);
+	if (this->mipmaps)
+		glGenerateMipmapEXT(this->texture_type);	//allocates the levels
+
+	glBindTexture(this->texture_type, 0);
+	assert(glGetError() == GL_NO_ERROR && "Error creating texture");
+}
+
 Texture* Texture::Get(const char* filename, bool mipmaps, bool wrap)
 {
 	assert(filename);
@@ -251,6 +289,7 @@ void Texture::upload(unsigned int format, unsigned int type, bool mipmaps, Uint8
 	assert(texture_id && "Must create texture before uploading data.");
 	assert(texture_type == GL_TEXTURE_2D && "Texture type does not match.");
 
+	Shader::resetStateCache();
 	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 
 	if (internal_format == 0)
@@ -280,6 +319,7 @@ void Texture::upload3D(unsigned int format, unsigned int type, bool mipmaps, Uin
 	assert(texture_id && "Must create texture before uploading data.");
 	assert(texture_type == GL_TEXTURE_3D && "Texture type does not match.");
 
+	Shader::resetStateCache();
 	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 
 	glTexImage3D(this->texture_type, 0, internal_format == 0 ? format : internal_format, width, height, depth, 0, format, type, data);
@@ -302,6 +342,7 @@ void Texture::uploadCubemap(unsigned int format, unsigned int type, bool mipmaps
 	assert(texture_id && "Must create texture before uploading data.");
 	assert(texture_type == GL_TEXTURE_CUBE_MAP && "Texture type does not match.");
 
+	Shader::resetStateCache();
 	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 
 	int width = ((int)this->width) >> level;
@@ -387,6 +428,7 @@ void Texture::uploadAsArray(unsigned int texture_size, bool mipmaps)
 	assert(glGetError() == GL_NO_ERROR);
 	if (texture_id == 0)
 		glGenTextures(1, &texture_id); //we need to create an unique ID for the texture
+	Shader::resetStateCache();
 	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 	glTexImage3D(this->texture_type, 0, format, width, height, num_textures, 0, dataFormat, type, data);
 	assert(glGetError() == GL_NO_ERROR);
@@ -408,12 +450,14 @@ void Texture::uploadAsArray(unsigned int texture_size, bool mipmaps)
 void Texture::bind()
 {
 	//glEnable(this->texture_type); //enable the textures 
+	Shader::resetStateCache();
 	glBindTexture(this->texture_type, texture_id);	//enable the id of the texture we are going to use
 }
 
 void Texture::unbind()
 {
 	//glDisable(this->texture_type); //disable the textures 
+	Shader::resetStateCache();
 	glBindTexture(this->texture_type, 0);	//disable the id of the texture we are going to use
 }
 
@@ -422,6 +466,7 @@ void Texture::UnbindAll()
 	glDisable(GL_TEXTURE_CUBE_MAP);
 	glDisable(GL_TEXTURE_2D);
 	glDisable(GL_TEXTURE_3D);
+	Shader::resetStateCache();
 	glBindTexture(GL_TEXTURE_2D, 0);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
 	glBindTexture(GL_TEXTURE_3D, 0);
@@ -432,6 +477,7 @@ void Texture::generateMipmaps()
 	if (!glGenerateMipmapEXT)
 		return;
 
+	Shader::resetStateCache();
 	glBindTexture(this->texture_type, texture_id);	//enable the id of the texture we are going to use
 	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, Texture::default_min_filter); //set the mag filter
 	glGenerateMipmapEXT(this->texture_type);